@@ -0,0 +1,287 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! `Arena`, which allocates tendril buffers for release all at once.
+//!
+//! This is a submodule of `tendril` so that it can build external buffers.
+
+use std::cell::{Cell, UnsafeCell};
+use std::marker::PhantomData;
+use std::{cmp, mem, ptr, u32};
+
+use fmt::{self, Slice};
+use OFLOW;
+
+use super::{Atomicity, ExternalHeader, Inline8, InlineCapacity, NonAtomic, Tendril};
+
+/// The default size of an arena chunk, in bytes.
+const DEFAULT_CHUNK_SIZE: usize = 64 * 1024;
+
+/// The unit of an arena chunk, aligned for a `Header` even where `usize`
+/// and `u64` are not.
+#[repr(C, align(8))]
+struct Word([u8; 8]);
+
+/// A bump allocator for tendril buffers.
+///
+/// Copying a string into an `Arena` costs no call to the global allocator,
+/// except to get a new chunk once in a while. The resulting `Tendril`s are
+/// shared and reference-counted as usual; mutating one copies it out of the
+/// arena. When the last of them is dropped, nothing is freed: the arena's
+/// chunks are released all at once, when the `Arena` and every `Tendril`
+/// allocated from it are gone.
+///
+/// Strings short enough to be stored in-line do not use the arena.
+///
+/// With `A = Atomic`, both the `Arena` and its tendrils can be sent between
+/// threads.
+pub struct Arena<A = NonAtomic>
+where
+    A: Atomicity,
+{
+    inner: *mut ArenaInner<A>,
+    marker: PhantomData<ArenaInner<A>>,
+}
+
+unsafe impl<A> Send for Arena<A> where A: Atomicity + Sync {}
+
+struct ArenaInner<A>
+where
+    A: Atomicity,
+{
+    /// One for the `Arena`, plus one for each live buffer.
+    refcount: A,
+    chunk_size: usize,
+    next: Cell<*mut u8>,
+    end: Cell<*mut u8>,
+    chunks: UnsafeCell<Vec<Vec<Word>>>,
+}
+
+impl<A> ArenaInner<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    unsafe fn decref(inner: *mut ArenaInner<A>) {
+        if (*inner).refcount.decrement() == 1 {
+            A::fence_acquire();
+            drop(Box::from_raw(inner));
+        }
+    }
+}
+
+/// `release` for an `ExternalHeader` in an arena.
+unsafe fn release_arena<A>(header: *mut ExternalHeader<A>)
+where
+    A: Atomicity,
+{
+    let inner = (*header).owner as *mut ArenaInner<A>;
+    ptr::drop_in_place(header);
+    ArenaInner::decref(inner);
+}
+
+impl<A> Arena<A>
+where
+    A: Atomicity,
+{
+    /// Create a new, empty `Arena`.
+    #[inline]
+    pub fn new() -> Arena<A> {
+        Arena::with_chunk_size(DEFAULT_CHUNK_SIZE)
+    }
+
+    /// Create a new, empty `Arena` which allocates chunks of a given size.
+    ///
+    /// Larger strings get a chunk of their own.
+    pub fn with_chunk_size(chunk_size: usize) -> Arena<A> {
+        let inner = Box::new(ArenaInner {
+            refcount: A::new(),
+            chunk_size: chunk_size,
+            next: Cell::new(ptr::null_mut()),
+            end: Cell::new(ptr::null_mut()),
+            chunks: UnsafeCell::new(vec![]),
+        });
+        Arena {
+            inner: Box::into_raw(inner),
+            marker: PhantomData,
+        }
+    }
+
+    /// Build a `Tendril` by copying a slice into the arena.
+    #[inline]
+    pub fn alloc_slice<F>(&self, x: &F::Slice) -> Tendril<F, A>
+    where
+        F: fmt::SliceFormat,
+    {
+        unsafe { self.alloc_bytes_without_validating(x.as_bytes()) }
+    }
+
+    /// Build a `Tendril` by copying a byte slice into the arena, if it
+    /// conforms to the format.
+    #[inline]
+    pub fn try_alloc_byte_slice<F>(&self, x: &[u8]) -> Result<Tendril<F, A>, ()>
+    where
+        F: fmt::Format,
+    {
+        match F::validate(x) {
+            true => Ok(unsafe { self.alloc_bytes_without_validating(x) }),
+            false => Err(()),
+        }
+    }
+
+    /// Build a `Tendril` by copying a byte slice into the arena, without
+    /// validating.
+    pub unsafe fn alloc_bytes_without_validating<F>(&self, x: &[u8]) -> Tendril<F, A>
+    where
+        F: fmt::Format,
+    {
+        if x.len() <= Inline8::LEN {
+            return Tendril::from_byte_slice_without_validating(x);
+        }
+        if x.len() > u32::MAX as usize {
+            panic!("{}", OFLOW);
+        }
+
+        let inner = &*self.inner;
+        let header =
+            self.bump(mem::size_of::<ExternalHeader<A>>() + x.len()) as *mut ExternalHeader<A>;
+        let data = header.offset(1) as *mut u8;
+        ptr::copy_nonoverlapping(x.as_ptr(), data, x.len());
+        ptr::write(
+            header,
+            ExternalHeader::new(
+                data,
+                x.len() as u32,
+                release_arena::<A>,
+                self.inner as *mut (),
+            ),
+        );
+        inner.refcount.increment();
+        Tendril::external(header)
+    }
+
+    /// Get `size` bytes, aligned for an `ExternalHeader`.
+    #[inline]
+    unsafe fn bump(&self, size: usize) -> *mut u8 {
+        let inner = &*self.inner;
+        let align = mem::align_of::<ExternalHeader<A>>();
+        debug_assert!(align <= mem::align_of::<Word>());
+        let size = size.checked_add(align - 1).expect(OFLOW) & !(align - 1);
+
+        let next = inner.next.get();
+        if (inner.end.get() as usize) - (next as usize) >= size {
+            inner.next.set(next.offset(size as isize));
+            return next;
+        }
+
+        let words = cmp::max(size, inner.chunk_size) / mem::size_of::<Word>() + 1;
+        let mut chunk: Vec<Word> = Vec::with_capacity(words);
+        let start = chunk.as_mut_ptr() as *mut u8;
+        if size >= inner.chunk_size {
+            // Leave the current chunk to fill up with smaller strings.
+            (*inner.chunks.get()).push(chunk);
+            return start;
+        }
+        inner.next.set(start.offset(size as isize));
+        inner
+            .end
+            .set(start.offset((words * mem::size_of::<Word>()) as isize));
+        (*inner.chunks.get()).push(chunk);
+        start
+    }
+}
+
+impl<A> Default for Arena<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn default() -> Arena<A> {
+        Arena::new()
+    }
+}
+
+impl<A> Drop for Arena<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { ArenaInner::decref(self.inner) }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::Arena;
+    use fmt;
+    use std::thread;
+    use tendril::{Atomic, NonAtomic, StrTendril, Tendril};
+
+    #[test]
+    fn smoke_test() {
+        let arena: Arena = Arena::with_chunk_size(64);
+        let short: StrTendril = arena.alloc_slice("short");
+        let long: StrTendril = arena.alloc_slice("a longer string in the arena");
+        let huge: StrTendril = arena.alloc_slice(&*"huge ".repeat(100));
+        let more: Vec<StrTendril> = (0..10)
+            .map(|i| arena.alloc_slice(&*format!("string number {}", i)))
+            .collect();
+
+        assert!(!short.is_shared());
+        assert!(long.is_shared());
+        assert_eq!("short", &*short);
+        assert_eq!("a longer string in the arena", &*long);
+        assert_eq!(500, huge.len());
+        for (i, t) in more.iter().enumerate() {
+            assert_eq!(format!("string number {}", i), &**t);
+        }
+
+        let mut sub = long.subtendril(2, 13);
+        assert!(sub.is_shared_with(&long));
+        assert_eq!("longer string", &*sub);
+        sub.push_slice("!");
+        assert!(!sub.is_shared());
+        assert_eq!("longer string!", &*sub);
+
+        let mut tail = long.subtendril(16, 12);
+        assert!(tail.is_shared_with(&long));
+        tail.pop_front(7);
+        assert!(!tail.is_shared());
+        assert_eq!("arena", &*tail);
+
+        drop(arena);
+        assert_eq!("a longer string in the arena", &*long);
+        assert_eq!("string number 9", &*more[9]);
+    }
+
+    #[test]
+    fn validation() {
+        let arena: Arena<NonAtomic> = Arena::new();
+        assert!(arena
+            .try_alloc_byte_slice::<fmt::UTF8>(b"\xFF not UTF-8 at all")
+            .is_err());
+        let t: Tendril<fmt::UTF8> = arena
+            .try_alloc_byte_slice(b"valid UTF-8 \xEA\x99\xAE")
+            .unwrap();
+        assert_eq!("valid UTF-8 \u{a66e}", &*t);
+    }
+
+    #[test]
+    fn atomic() {
+        let arena: Arena<Atomic> = Arena::new();
+        let t: Tendril<fmt::UTF8, Atomic> = arena.alloc_slice("sent to another thread");
+        let u = t.clone();
+        let v: Tendril<fmt::UTF8, Atomic> = thread::spawn(move || {
+            assert_eq!("sent to another thread", &*u);
+            arena.alloc_slice("allocated in another thread")
+        })
+        .join()
+        .unwrap();
+        assert_eq!("sent to another thread", &*t);
+        assert_eq!("allocated in another thread", &*v);
+    }
+}
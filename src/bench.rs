@@ -4,10 +4,50 @@
 // option. This file may not be copied, modified, or distributed
 // except according to those terms.
 
-use std::borrow::ToOwned;
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::borrow::{Cow, ToOwned};
+use std::cell::Cell;
 use std::collections::hash_map::{Entry, HashMap};
+use std::io;
 
-use tendril::StrTendril;
+use fmt;
+use simd::AsciiSet;
+use stream::TendrilSink;
+use tendril::{Arena, ByteTendril, InlineCapacity, NonAtomic, StrTendril, Tendril};
+
+/// Counts allocations on each thread, so that benchmarks can report them.
+struct CountingAlloc;
+
+thread_local!(static ALLOCATIONS: Cell<usize> = const { Cell::new(0) });
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+/// The number of allocations made on this thread so far.
+fn allocations() -> usize {
+    ALLOCATIONS.with(|n| n.get())
+}
 
 fn index_words_string(input: &String) -> HashMap<char, Vec<String>> {
     let mut index = HashMap::new();
@@ -29,7 +69,12 @@ fn index_words_string(input: &String) -> HashMap<char, Vec<String>> {
     index
 }
 
-fn index_words_tendril(input: &StrTendril) -> HashMap<char, Vec<StrTendril>> {
+fn index_words_tendril<I>(
+    input: &Tendril<fmt::UTF8, NonAtomic, I>,
+) -> HashMap<char, Vec<Tendril<fmt::UTF8, NonAtomic, I>>>
+where
+    I: InlineCapacity,
+{
     let mut index = HashMap::new();
     let mut t = input.clone();
     loop {
@@ -48,6 +93,97 @@ fn index_words_tendril(input: &StrTendril) -> HashMap<char, Vec<StrTendril>> {
     }
 }
 
+/// `index_words_tendril`, splitting words with `pop_front_set_run`.
+fn index_words_tendril_set<I>(
+    input: &Tendril<fmt::UTF8, NonAtomic, I>,
+) -> HashMap<char, Vec<Tendril<fmt::UTF8, NonAtomic, I>>>
+where
+    I: InlineCapacity,
+{
+    let space = AsciiSet::from_bytes(b" ");
+    let mut index = HashMap::new();
+    let mut t = input.clone();
+    loop {
+        match t.pop_front_set_run(&space, |_| false) {
+            None => return index,
+            Some((_, true)) => (),
+            Some((word, false)) => match index.entry(word.chars().next().unwrap()) {
+                Entry::Occupied(mut e) => {
+                    e.get_mut().push(word);
+                }
+                Entry::Vacant(e) => {
+                    e.insert(vec![word]);
+                }
+            },
+        }
+    }
+}
+
+/// Copy every word into its own tendril. Words which fit in-line cost no
+/// allocation.
+fn copy_words<I>(input: &str) -> Vec<Tendril<fmt::UTF8, NonAtomic, I>>
+where
+    I: InlineCapacity,
+{
+    input
+        .split(|c| c == ' ')
+        .filter(|w| w.len() > 0)
+        .map(Tendril::from_slice)
+        .collect()
+}
+
+/// Like `copy_words`, but copy into an `Arena`, which is released when the
+/// result is dropped.
+fn copy_words_arena(input: &str) -> Vec<StrTendril> {
+    let arena = Arena::new();
+    input
+        .split(|c| c == ' ')
+        .filter(|w| w.len() > 0)
+        .map(|w| arena.alloc_slice(w))
+        .collect()
+}
+
+/// A sink which counts bytes and drops the tendrils, like a parser that
+/// copies out what it needs.
+struct CountBytes(u64);
+
+impl TendrilSink<fmt::Bytes> for CountBytes {
+    fn process(&mut self, t: ByteTendril) {
+        self.0 += t.len() as u64;
+    }
+
+    fn error(&mut self, _: Cow<'static, str>) {}
+
+    type Output = u64;
+
+    fn finish(self) -> u64 {
+        self.0
+    }
+}
+
+/// `TendrilSink::read_from` as it was before `TendrilPool`: a fresh 4 KiB
+/// tendril for every read.
+fn read_from_fresh<S, R>(mut sink: S, r: &mut R) -> io::Result<S::Output>
+where
+    S: TendrilSink<fmt::Bytes>,
+    R: io::Read,
+{
+    const BUFFER_SIZE: u32 = 4 * 1024;
+    loop {
+        let mut tendril = ByteTendril::new();
+        unsafe {
+            tendril.push_uninitialized(BUFFER_SIZE);
+        }
+        match r.read(&mut tendril)? {
+            0 => return Ok(sink.finish()),
+            n => {
+                tendril.pop_back(BUFFER_SIZE - n as u32);
+                sink.process(tendril);
+            }
+        }
+    }
+}
+
 static EN_1: &'static str = "Days turn to nights turn to paper into rocks into plastic";
 
 static EN_2: &'static str =
@@ -78,6 +214,10 @@ static HTML_KR_1: &'static str =
        메모리-안전하고 병렬 프로그래밍이 쉬운 차세대 프로그래밍 언어입니다. \
        아직 개발 단계이며 많은 기능이 구현 중으로, MIT/Apache2 라이선스로 배포됩니다.</p>";
 
+static URL_1: &'static str = "https://github.com/servo/tendril/blob/master/src/tendril.rs#L1234 \
+     https://doc.rust-lang.org/std/primitive.str.html#method.split_whitespace \
+     https://www.mozilla.org/en-US/firefox/new/?redirect_source=firefox-com ";
+
 mod index_words {
     macro_rules! bench {
         ($txt:ident) => {
@@ -104,6 +244,55 @@ mod index_words {
                     b.iter(|| ::tendril::bench::index_words_tendril(&t));
                 }
 
+                #[bench]
+                fn index_words_tendril_set(b: &mut ::test::Bencher) {
+                    let mut t = ::tendril::StrTendril::new();
+                    while t.len() < SMALL_SIZE {
+                        t.push_slice(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::index_words_tendril_set(&t));
+                }
+
+                #[bench]
+                fn index_words_tendril_inline16(b: &mut ::test::Bencher) {
+                    let mut t: ::tendril::Tendril<
+                        ::fmt::UTF8,
+                        ::tendril::NonAtomic,
+                        ::tendril::Inline16,
+                    > = ::tendril::Tendril::new();
+                    while t.len() < SMALL_SIZE {
+                        t.push_slice(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::index_words_tendril(&t));
+                }
+
+                #[bench]
+                fn copy_words_tendril(b: &mut ::test::Bencher) {
+                    let mut s = String::new();
+                    while s.len() < SMALL_SIZE {
+                        s.push_str(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::copy_words::<::tendril::Inline8>(&s));
+                }
+
+                #[bench]
+                fn copy_words_tendril_inline16(b: &mut ::test::Bencher) {
+                    let mut s = String::new();
+                    while s.len() < SMALL_SIZE {
+                        s.push_str(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::copy_words::<::tendril::Inline16>(&s));
+                }
+
+                #[bench]
+                fn copy_words_arena(b: &mut ::test::Bencher) {
+                    let mut s = String::new();
+                    while s.len() < SMALL_SIZE {
+                        s.push_str(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::copy_words_arena(&s));
+                }
+
                 #[bench]
                 fn index_words_big_string(b: &mut ::test::Bencher) {
                     let mut s = String::new();
@@ -122,10 +311,21 @@ mod index_words {
                     b.iter(|| ::tendril::bench::index_words_tendril(&t));
                 }
 
+                #[bench]
+                fn index_words_big_tendril_set(b: &mut ::test::Bencher) {
+                    let mut t = ::tendril::StrTendril::new();
+                    while t.len() < LARGE_SIZE {
+                        t.push_slice(::tendril::bench::$txt);
+                    }
+                    b.iter(|| ::tendril::bench::index_words_tendril_set(&t));
+                }
+
                 #[test]
                 fn correctness() {
                     use std::borrow::ToOwned;
-                    use tendril::bench::{index_words_string, index_words_tendril};
+                    use tendril::bench::{
+                        index_words_string, index_words_tendril, index_words_tendril_set,
+                    };
                     use tendril::SliceExt;
 
                     let txt = ::tendril::bench::$txt;
@@ -147,6 +347,7 @@ mod index_words {
                         assert_eq!(vs.len(), vt.len());
                         assert!(vs.iter().zip(vt.iter()).all(|(s, t)| **s == **t));
                     }
+                    assert!(index_words_tendril_set(&input_tendril) == count_t);
                 }
             }
         };
@@ -156,4 +357,596 @@ mod index_words {
     bench!(EN_2);
     bench!(KR_1);
     bench!(HTML_KR_1);
+    bench!(URL_1);
+}
+
+mod read_from {
+    use super::{allocations, read_from_fresh, CountBytes};
+    use stream::TendrilSink;
+
+    const SIZE: usize = 16 << 20;
+
+    #[bench]
+    fn read_from_fresh_buffers(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| read_from_fresh(CountBytes(0), &mut &*input).unwrap());
+    }
+
+    #[bench]
+    fn read_from_pooled_buffers(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| CountBytes(0).read_from(&mut &*input).unwrap());
+    }
+
+    #[bench]
+    fn read_from_async(b: &mut ::test::Bencher) {
+        use std::future::Future;
+        use std::pin::Pin;
+        use std::sync::Arc;
+        use std::task::{Context, Poll, Wake, Waker};
+
+        // The source is always ready, so waking needs to do nothing.
+        struct Noop;
+        impl Wake for Noop {
+            fn wake(self: Arc<Self>) {}
+        }
+
+        let input = vec![b'x'; SIZE];
+        let waker = Waker::from(Arc::new(Noop));
+        b.bytes = SIZE as u64;
+        b.iter(|| {
+            let mut f = CountBytes(0).read_from_async(&*input);
+            let mut cx = Context::from_waker(&waker);
+            loop {
+                if let Poll::Ready(n) = Pin::new(&mut f).poll(&mut cx) {
+                    break n.unwrap();
+                }
+            }
+        });
+    }
+
+    /// Allocations per GB streamed; run with `--nocapture` to see them.
+    #[test]
+    fn allocations_per_gb() {
+        let input = vec![b'x'; SIZE];
+        let per_gb = |f: &dyn Fn() -> u64| {
+            let before = allocations();
+            assert_eq!(SIZE as u64, f());
+            (allocations() - before) * ((1 << 30) / SIZE)
+        };
+
+        let fresh = per_gb(&|| read_from_fresh(CountBytes(0), &mut &*input).unwrap());
+        let pooled = per_gb(&|| CountBytes(0).read_from(&mut &*input).unwrap());
+        println!("allocations per GB: {} fresh, {} pooled", fresh, pooled);
+        assert!(fresh >= (1 << 30) / 4096);
+        assert!(pooled * 1000 < fresh);
+    }
+}
+
+mod read_from_blocks {
+    use super::{allocations, read_from_fresh};
+    use std::borrow::Cow;
+    use std::io;
+    use stream::TendrilSink;
+    use tendril::{fmt, ByteTendril};
+
+    const SIZE: usize = 16 << 20;
+
+    /// Returns at most 1500 bytes a read, like a socket.
+    struct Packets<'a>(&'a [u8]);
+
+    impl<'a> io::Read for Packets<'a> {
+        fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+            let n = self.0.len().min(1500).min(buf.len());
+            buf[..n].copy_from_slice(&self.0[..n]);
+            self.0 = &self.0[n..];
+            Ok(n)
+        }
+    }
+
+    /// Keeps every tendril, as a parser building a tree does.
+    struct Keep(Vec<ByteTendril>);
+
+    impl TendrilSink<fmt::Bytes> for Keep {
+        fn process(&mut self, t: ByteTendril) {
+            self.0.push(t);
+        }
+
+        fn error(&mut self, _: Cow<'static, str>) {}
+
+        type Output = usize;
+
+        fn finish(self) -> usize {
+            self.0.len()
+        }
+    }
+
+    #[bench]
+    fn pooled_4k(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| Keep(vec![]).read_from(&mut Packets(&input)).unwrap());
+    }
+
+    #[bench]
+    fn blocks_64k(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| {
+            Keep(vec![])
+                .read_from_blocks(&mut Packets(&input), 64 * 1024)
+                .unwrap()
+        });
+    }
+
+    #[bench]
+    fn blocks_1m(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| {
+            Keep(vec![])
+                .read_from_blocks(&mut Packets(&input), 1 << 20)
+                .unwrap()
+        });
+    }
+
+    /// Allocations for 16 MiB of packets; run with `--nocapture` to see
+    /// them.
+    #[test]
+    fn allocations_per_block_size() {
+        let input = vec![b'x'; SIZE];
+        let count = |f: &dyn Fn(Keep) -> usize| {
+            let sink = Keep(Vec::with_capacity(SIZE / 1500 + 1));
+            let before = allocations();
+            f(sink);
+            allocations() - before
+        };
+
+        let fresh = count(&|sink| read_from_fresh(sink, &mut Packets(&input)).unwrap());
+        let pooled = count(&|sink| sink.read_from(&mut Packets(&input)).unwrap());
+        let blocks = count(&|sink| {
+            sink.read_from_blocks(&mut Packets(&input), 64 * 1024)
+                .unwrap()
+        });
+        println!(
+            "allocations: {} fresh, {} pooled, {} in 64 KiB blocks",
+            fresh, pooled, blocks
+        );
+        assert!(blocks * 16 < fresh);
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod from_files {
+    use super::CountBytes;
+    use std::path::PathBuf;
+    use std::{env, fs, process};
+    use stream::{self, TendrilSink};
+
+    const FILES: usize = 1000;
+    const FILE_SIZE: usize = 64 * 1024;
+
+    /// Files for one benchmark, removed when dropped.
+    struct Files(PathBuf, Vec<PathBuf>);
+
+    impl Files {
+        fn new(name: &str) -> Files {
+            let dir = env::temp_dir().join(format!("tendril-{}-{}", process::id(), name));
+            fs::create_dir_all(&dir).unwrap();
+            let contents = vec![b'x'; FILE_SIZE];
+            let paths = (0..FILES)
+                .map(|i| {
+                    let path = dir.join(i.to_string());
+                    fs::write(&path, &contents).unwrap();
+                    path
+                })
+                .collect();
+            Files(dir, paths)
+        }
+    }
+
+    /// Evict the files from the page cache, so that they are read from the
+    /// disk.
+    fn evict(files: &Files) {
+        use libc;
+        use std::os::unix::io::AsRawFd;
+        for path in &files.1 {
+            let file = fs::File::open(path).unwrap();
+            unsafe {
+                libc::fdatasync(file.as_raw_fd());
+                libc::posix_fadvise(file.as_raw_fd(), 0, 0, libc::POSIX_FADV_DONTNEED);
+            }
+        }
+    }
+
+    impl Drop for Files {
+        fn drop(&mut self) {
+            let _ = fs::remove_dir_all(&self.0);
+        }
+    }
+
+    #[bench]
+    fn sequential_from_file(b: &mut ::test::Bencher) {
+        let files = Files::new("sequential_from_file");
+        b.bytes = (FILES * FILE_SIZE) as u64;
+        b.iter(|| {
+            files
+                .1
+                .iter()
+                .map(|path| CountBytes(0).from_file(path).unwrap())
+                .sum::<u64>()
+        });
+    }
+
+    #[bench]
+    fn sequential_from_file_cold(b: &mut ::test::Bencher) {
+        let files = Files::new("sequential_from_file_cold");
+        b.bytes = (FILES * FILE_SIZE) as u64;
+        b.iter(|| {
+            evict(&files);
+            files
+                .1
+                .iter()
+                .map(|path| CountBytes(0).from_file(path).unwrap())
+                .sum::<u64>()
+        });
+    }
+
+    #[bench]
+    fn from_files_cold(b: &mut ::test::Bencher) {
+        let files = Files::new("from_files_cold");
+        b.bytes = (FILES * FILE_SIZE) as u64;
+        b.iter(|| {
+            evict(&files);
+            stream::from_files(&files.1, |_| CountBytes(0))
+                .into_iter()
+                .map(|r| r.unwrap())
+                .sum::<u64>()
+        });
+    }
+
+    #[bench]
+    fn from_files(b: &mut ::test::Bencher) {
+        let files = Files::new("from_files");
+        b.bytes = (FILES * FILE_SIZE) as u64;
+        b.iter(|| {
+            stream::from_files(&files.1, |_| CountBytes(0))
+                .into_iter()
+                .map(|r| r.unwrap())
+                .sum::<u64>()
+        });
+    }
+}
+
+mod read_to_tendril {
+    use super::allocations;
+    use tendril::{ByteTendril, ReadExt};
+
+    const SIZE: usize = 16 << 20;
+
+    #[bench]
+    fn growing(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| {
+            let mut t = ByteTendril::new();
+            (&*input).read_to_tendril(&mut t).unwrap();
+            t
+        });
+    }
+
+    #[bench]
+    fn hinted(b: &mut ::test::Bencher) {
+        let input = vec![b'x'; SIZE];
+        b.bytes = SIZE as u64;
+        b.iter(|| {
+            let mut t = ByteTendril::new();
+            (&*input)
+                .read_to_tendril_with_hint(&mut t, SIZE as u64)
+                .unwrap();
+            t
+        });
+    }
+
+    #[test]
+    fn hinted_allocates_once() {
+        let input = vec![b'x'; SIZE];
+        let mut t = ByteTendril::new();
+        let before = allocations();
+        (&*input)
+            .read_to_tendril_with_hint(&mut t, SIZE as u64)
+            .unwrap();
+        assert_eq!(1, allocations() - before);
+        assert_eq!(SIZE, t.len());
+    }
+}
+
+mod hash_map_key {
+    use std::collections::HashMap;
+    use tendril::{HashedTendril, StrTendril};
+
+    const KEYS: usize = 64;
+
+    fn keys(len: usize) -> Vec<StrTendril> {
+        (0..KEYS)
+            .map(|i| StrTendril::from_slice(&*format!("{:1$}", i, len)))
+            .collect()
+    }
+
+    macro_rules! bench {
+        ($name:ident, $len:expr) => {
+            mod $name {
+                use super::*;
+
+                #[bench]
+                fn lookup_tendril(b: &mut ::test::Bencher) {
+                    let keys = keys($len);
+                    let map: HashMap<StrTendril, usize> = keys.iter().cloned().zip(0..).collect();
+                    b.iter(|| keys.iter().map(|k| map[k]).sum::<usize>());
+                }
+
+                #[bench]
+                fn lookup_hashed_tendril(b: &mut ::test::Bencher) {
+                    let keys: Vec<HashedTendril<_>> =
+                        keys($len).into_iter().map(HashedTendril::from).collect();
+                    let map: HashMap<HashedTendril<_>, usize> =
+                        keys.iter().cloned().zip(0..).collect();
+                    b.iter(|| keys.iter().map(|k| map[k]).sum::<usize>());
+                }
+            }
+        };
+    }
+
+    bench!(key_16, 16);
+    bench!(key_256, 256);
+    bench!(key_4096, 4096);
+}
+
+mod compare {
+    use tendril::ByteTendril;
+
+    fn pair(len: usize) -> (ByteTendril, ByteTendril) {
+        let bytes: Vec<u8> = (0..len).map(|i| (i % 251) as u8).collect();
+        let mut other = bytes.clone();
+        other[len - 1] ^= 1;
+        (
+            ByteTendril::from_slice(&bytes),
+            ByteTendril::from_slice(&other),
+        )
+    }
+
+    macro_rules! bench {
+        ($name:ident, $len:expr) => {
+            mod $name {
+                use super::*;
+                use test::black_box;
+
+                #[bench]
+                fn eq_shared(b: &mut ::test::Bencher) {
+                    let (t, _) = pair($len);
+                    let u = t.clone();
+                    b.iter(|| black_box(&t) == black_box(&u));
+                }
+
+                #[bench]
+                fn eq_copied(b: &mut ::test::Bencher) {
+                    let (t, _) = pair($len);
+                    let u = ByteTendril::from_slice(&t);
+                    b.iter(|| black_box(&t) == black_box(&u));
+                }
+
+                #[bench]
+                fn cmp_shared(b: &mut ::test::Bencher) {
+                    let (t, _) = pair($len);
+                    let u = t.clone();
+                    b.iter(|| black_box(&t).cmp(black_box(&u)));
+                }
+
+                #[bench]
+                fn cmp_tendrils(b: &mut ::test::Bencher) {
+                    let (t, u) = pair($len);
+                    b.iter(|| black_box(&t).cmp(black_box(&u)));
+                }
+
+                #[bench]
+                fn mismatch_bytewise(b: &mut ::test::Bencher) {
+                    let (t, u) = pair($len);
+                    b.iter(|| {
+                        let (t, u) = (black_box(&t), black_box(&u));
+                        t.iter().zip(u.iter()).position(|(x, y)| x != y)
+                    });
+                }
+
+                #[bench]
+                fn mismatch_index(b: &mut ::test::Bencher) {
+                    let (t, u) = pair($len);
+                    b.iter(|| black_box(&t).mismatch_index(black_box(&u)));
+                }
+            }
+        };
+    }
+
+    bench!(len_64, 64);
+    bench!(len_4096, 4096);
+    bench!(len_65536, 65536);
+}
+
+mod clone_drop {
+    use std::sync::atomic::{AtomicBool, Ordering};
+    use std::sync::Arc;
+    use std::thread;
+    use test::black_box;
+
+    use fmt;
+    use tendril::{Atomic, Atomicity, BiasedAtomic, NonAtomic, Tendril};
+
+    const CLONES: usize = 1000;
+
+    fn buffer<A: Atomicity>() -> Tendril<fmt::Bytes, A> {
+        Tendril::from_slice(&[b'x'; 64][..])
+    }
+
+    fn clone_drop<A: Atomicity>(t: &Tendril<fmt::Bytes, A>) {
+        for _ in 0..CLONES {
+            black_box(t.clone());
+        }
+    }
+
+    /// Clone and drop `t` on another thread until `stop` is set.
+    fn in_background<T, A>(t: T, stop: &Arc<AtomicBool>) -> thread::JoinHandle<()>
+    where
+        T: Into<Tendril<fmt::Bytes, A>> + Send + 'static,
+        A: Atomicity,
+    {
+        let stop = stop.clone();
+        thread::spawn(move || {
+            let t = t.into();
+            while !stop.load(Ordering::Relaxed) {
+                clone_drop(&t);
+            }
+        })
+    }
+
+    #[bench]
+    fn non_atomic(b: &mut ::test::Bencher) {
+        let t = buffer::<NonAtomic>();
+        b.iter(|| clone_drop(&t));
+    }
+
+    #[bench]
+    fn atomic(b: &mut ::test::Bencher) {
+        let t = buffer::<Atomic>();
+        b.iter(|| clone_drop(&t));
+    }
+
+    #[bench]
+    fn biased_atomic(b: &mut ::test::Bencher) {
+        let t = buffer::<BiasedAtomic>();
+        b.iter(|| clone_drop(&t));
+    }
+
+    #[bench]
+    fn atomic_with_another_thread(b: &mut ::test::Bencher) {
+        let t = buffer::<Atomic>();
+        let stop = Arc::new(AtomicBool::new(false));
+        let other = in_background::<_, Atomic>(t.clone(), &stop);
+        b.iter(|| clone_drop(&t));
+        stop.store(true, Ordering::Relaxed);
+        other.join().unwrap();
+    }
+
+    #[bench]
+    fn biased_atomic_with_another_thread(b: &mut ::test::Bencher) {
+        let t = buffer::<BiasedAtomic>();
+        let stop = Arc::new(AtomicBool::new(false));
+        let other = in_background::<_, BiasedAtomic>(t.clone().into_send_biased(), &stop);
+        b.iter(|| clone_drop(&t));
+        stop.store(true, Ordering::Relaxed);
+        other.join().unwrap();
+    }
+}
+
+mod split_and_append {
+    use tendril::StrTendril;
+
+    /// Append a word at a time, keeping a view of the whole after each.
+    fn build(words: usize) -> Vec<StrTendril> {
+        let mut t = StrTendril::new();
+        let mut views = Vec::with_capacity(words);
+        for _ in 0..words {
+            t.push_slice("a word ");
+            views.push(t.clone());
+        }
+        views
+    }
+
+    #[bench]
+    fn words_1000(b: &mut ::test::Bencher) {
+        b.iter(|| build(1000));
+    }
+
+    #[bench]
+    fn words_10000(b: &mut ::test::Bencher) {
+        b.iter(|| build(10000));
+    }
+}
+
+mod split_lines {
+    use tendril::StrTendril;
+
+    /// 64 KB of lines of varying length.
+    fn chunk() -> StrTendril {
+        let mut t = StrTendril::new();
+        let mut i = 0;
+        while t.len() < 64 * 1024 {
+            t.push_slice(&"a line ".repeat(i % 16));
+            t.push_slice("\n");
+            i += 1;
+        }
+        t
+    }
+
+    #[bench]
+    fn lines(b: &mut ::test::Bencher) {
+        let t = chunk();
+        b.iter(|| t.lines().count());
+    }
+
+    #[bench]
+    fn find_and_subtendril(b: &mut ::test::Bencher) {
+        let t = chunk();
+        b.iter(|| {
+            let mut rest = t.clone();
+            let mut n = 0;
+            while let Some(i) = rest.find('\n') {
+                let _line = rest.subtendril(0, i as u32);
+                rest.pop_front(i as u32 + 1);
+                n += 1;
+            }
+            n
+        });
+    }
+}
+
+#[cfg(unix)]
+mod write_many {
+    use std::fs::File;
+    use std::io::Write;
+    use tendril::{write_tendrils, SliceExt, StrTendril};
+
+    /// A response as a serializer might build it: many small pieces and a
+    /// few long ones.
+    fn pieces() -> Vec<StrTendril> {
+        (0..3000)
+            .map(|i| {
+                if i % 100 == 0 {
+                    "a long run of text from the document "
+                        .repeat(4)
+                        .to_tendril()
+                } else {
+                    format!("<td>{}</td>", i).to_tendril()
+                }
+            })
+            .collect()
+    }
+
+    #[bench]
+    fn write_each(b: &mut ::test::Bencher) {
+        let pieces = pieces();
+        let mut null = File::create("/dev/null").unwrap();
+        b.iter(|| {
+            for t in &pieces {
+                null.write_all(t.as_bytes()).unwrap();
+            }
+        });
+    }
+
+    #[bench]
+    fn vectored(b: &mut ::test::Bencher) {
+        let pieces = pieces();
+        let mut null = File::create("/dev/null").unwrap();
+        b.iter(|| write_tendrils(&mut null, &pieces).unwrap());
+    }
 }
@@ -6,57 +6,90 @@
 
 //! Provides an unsafe owned buffer type, used in implementing `Tendril`.
 
-use std::{mem, ptr, slice, u32};
+use std::alloc::{handle_alloc_error, Layout};
+use std::marker::PhantomData;
+use std::{cmp, mem, ptr, slice, u32};
 
+use tendril::{Allocator, Global};
 use OFLOW;
 
 pub const MIN_CAP: u32 = 16;
 
 pub const MAX_LEN: usize = u32::MAX as usize;
 
+/// Buffers up to this size, header included, grow to the next power of two.
+/// Larger ones grow by half, to a whole number of pages.
+pub const DOUBLING_LIMIT: usize = 1 << 20;
+
+pub const PAGE_SIZE: usize = 4096;
+
 /// A buffer points to a header of type `H`, which is followed by `MIN_CAP` or more
-/// bytes of storage.
-pub struct Buf32<H> {
+/// bytes of storage. The memory comes from the allocator `Al`.
+pub struct Buf32<H, Al = Global> {
     pub ptr: *mut H,
     pub len: u32,
     pub cap: u32,
+    pub marker: PhantomData<Al>,
 }
 
+/// The layout of a buffer with capacity `cap`.
 #[inline(always)]
-fn bytes_to_vec_capacity<H>(x: u32) -> usize {
+fn layout<H>(cap: u32) -> Layout {
+    let size = (cap as usize)
+        .checked_add(mem::size_of::<H>())
+        .expect(OFLOW);
+    Layout::from_size_align(size, mem::align_of::<H>()).expect(OFLOW)
+}
+
+/// The total size to allocate when growing a buffer from `cap` to at least
+/// `new_cap`.
+///
+/// Small buffers are sized so that header and data together fill a power
+/// of two, which is a size class in common allocators. Rounding only the
+/// data would spill the header into the next class.
+#[inline]
+fn grown_size<H>(cap: u32, new_cap: u32) -> usize {
     let header = mem::size_of::<H>();
-    debug_assert!(header > 0);
-    let x = (x as usize).checked_add(header).expect(OFLOW);
-    // Integer ceil http://stackoverflow.com/a/2745086/1162888
-    1 + ((x - 1) / header)
+    let needed = (new_cap as usize).checked_add(header).expect(OFLOW);
+    let size = if needed <= DOUBLING_LIMIT {
+        needed.next_power_of_two()
+    } else {
+        let old = cap as usize + header;
+        let size = cmp::max(needed, old.saturating_add(old / 2));
+        size.checked_add(PAGE_SIZE - 1).expect(OFLOW) & !(PAGE_SIZE - 1)
+    };
+    cmp::min(size, MAX_LEN.saturating_add(header))
 }
 
-impl<H> Buf32<H> {
+impl<H, Al> Buf32<H, Al>
+where
+    Al: Allocator,
+{
     #[inline]
-    pub unsafe fn with_capacity(mut cap: u32, h: H) -> Buf32<H> {
+    pub unsafe fn with_capacity(mut cap: u32, h: H) -> Buf32<H, Al> {
         if cap < MIN_CAP {
             cap = MIN_CAP;
         }
 
-        let mut vec = Vec::<H>::with_capacity(bytes_to_vec_capacity::<H>(cap));
-        let ptr = vec.as_mut_ptr();
-        mem::forget(vec);
-        ptr::write(ptr, h);
+        let layout = layout::<H>(cap);
+        let ptr = Al::alloc(layout);
+        if ptr.is_null() {
+            handle_alloc_error(layout);
+        }
+        ptr::write(ptr as *mut H, h);
 
         Buf32 {
-            ptr: ptr,
+            ptr: ptr as *mut H,
             len: 0,
-            cap: cap,
+            cap: usable_cap::<H, Al>(ptr, layout),
+            marker: PhantomData,
         }
     }
 
     #[inline]
     pub unsafe fn destroy(self) {
-        mem::drop(Vec::from_raw_parts(
-            self.ptr,
-            1,
-            bytes_to_vec_capacity::<H>(self.cap),
-        ));
+        ptr::drop_in_place(self.ptr);
+        Al::dealloc(self.ptr as *mut u8, layout::<H>(self.cap));
     }
 
     #[inline(always)]
@@ -74,33 +107,48 @@ impl<H> Buf32<H> {
         slice::from_raw_parts_mut(self.data_ptr(), self.len as usize)
     }
 
-    /// Grow the capacity to at least `new_cap`.
+    /// Grow the capacity to at least `new_cap`, and perhaps more; see
+    /// `grown_size`. Spare bytes reported by the allocator count towards
+    /// the capacity.
     ///
-    /// This will panic if the capacity calculation overflows `u32`.
+    /// This will panic if the capacity calculation overflows `usize`.
     #[inline]
     pub unsafe fn grow(&mut self, new_cap: u32) {
         if new_cap <= self.cap {
             return;
         }
 
-        let new_cap = new_cap.checked_next_power_of_two().expect(OFLOW);
-        let mut vec = Vec::from_raw_parts(self.ptr, 0, bytes_to_vec_capacity::<H>(self.cap));
-        vec.reserve_exact(bytes_to_vec_capacity::<H>(new_cap));
-        self.ptr = vec.as_mut_ptr();
-        self.cap = new_cap;
-        mem::forget(vec);
+        let size = grown_size::<H>(self.cap, new_cap);
+        let new_layout = Layout::from_size_align(size, mem::align_of::<H>()).expect(OFLOW);
+        let ptr = Al::realloc(self.ptr as *mut u8, layout::<H>(self.cap), size);
+        if ptr.is_null() {
+            handle_alloc_error(new_layout);
+        }
+        self.ptr = ptr as *mut H;
+        self.cap = usable_cap::<H, Al>(ptr, new_layout);
     }
 }
 
+/// The capacity of a buffer just allocated with `layout`.
+#[inline(always)]
+unsafe fn usable_cap<H, Al>(ptr: *mut u8, layout: Layout) -> u32
+where
+    Al: Allocator,
+{
+    let usable = cmp::max(Al::usable_size(ptr, layout), layout.size());
+    cmp::min(usable - mem::size_of::<H>(), MAX_LEN) as u32
+}
+
 #[cfg(test)]
 mod test {
-    use super::Buf32;
-    use std::ptr;
+    use super::{grown_size, Buf32};
+    use std::{ptr, u32};
+    use tendril::Global;
 
     #[test]
     fn smoke_test() {
         unsafe {
-            let mut b = Buf32::with_capacity(0, 0u8);
+            let mut b: Buf32<u8, Global> = Buf32::with_capacity(0, 0u8);
             assert_eq!(b"", b.data());
 
             b.grow(5);
@@ -117,4 +165,48 @@ mod test {
             b.destroy();
         }
     }
+
+    #[test]
+    fn growth() {
+        // With an 8-byte header, small buffers fill a power of two.
+        assert_eq!(64, grown_size::<u64>(16, 40));
+        assert_eq!(64, grown_size::<u64>(16, 56));
+        assert_eq!(128, grown_size::<u64>(56, 57));
+
+        // Large buffers grow by half, in whole pages.
+        let mib: u32 = 1 << 20;
+        let grown = |cap: u32, new_cap: u32| grown_size::<u64>(cap, new_cap) as u32;
+        assert_eq!(3 * mib / 2, grown(mib - 8, mib));
+        assert_eq!(513 * mib / 2 * 3, grown(513 * mib - 8, 513 * mib));
+        assert_eq!(5 * mib, grown(mib - 8, 5 * mib - 1000));
+
+        // Until the maximum length.
+        assert_eq!(
+            u32::MAX as usize + 8,
+            grown_size::<u64>(3 << 30, (3 << 30) + 1)
+        );
+
+        unsafe {
+            let mut b: Buf32<u64, Global> = Buf32::with_capacity(0, 0);
+            b.grow(100);
+            assert_eq!(120, b.cap);
+            b.destroy();
+        }
+    }
+
+    #[test]
+    fn huge() {
+        unsafe {
+            let mut b: Buf32<u64, Global> = Buf32::with_capacity(0, 0);
+            b.grow(100 << 20);
+            ptr::copy_nonoverlapping(b"Hello".as_ptr(), b.data_ptr(), 5);
+            *b.data_ptr().offset((100 << 20) - 1) = b'!';
+            b.grow(200 << 20);
+            assert!(b.cap >= 200 << 20);
+            b.len = 5;
+            assert_eq!(b"Hello", b.data());
+            assert_eq!(b'!', *b.data_ptr().offset((100 << 20) - 1));
+            b.destroy();
+        }
+    }
 }
@@ -0,0 +1,162 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Provides an unsafe owned buffer type with 64-bit capacity, used in
+//! implementing `LargeTendril`.
+
+use std::alloc::{handle_alloc_error, Layout};
+use std::marker::PhantomData;
+use std::{cmp, mem, ptr, usize};
+
+use buf32::{DOUBLING_LIMIT, PAGE_SIZE};
+use tendril::{Allocator, Global};
+use OFLOW;
+
+pub const MIN_CAP: u64 = 16;
+
+/// A buffer points to a header of type `H`, which is followed by `MIN_CAP` or more
+/// bytes of storage. The memory comes from the allocator `Al`.
+pub struct Buf64<H, Al = Global> {
+    pub ptr: *mut H,
+    pub cap: u64,
+    pub marker: PhantomData<Al>,
+}
+
+/// The size of a buffer with capacity `cap`, header included.
+#[inline(always)]
+fn size<H>(cap: u64) -> usize {
+    if cap > usize::MAX as u64 {
+        panic!("{}", OFLOW);
+    }
+    (cap as usize)
+        .checked_add(mem::size_of::<H>())
+        .expect(OFLOW)
+}
+
+/// The layout of a buffer with capacity `cap`.
+#[inline(always)]
+fn layout<H>(cap: u64) -> Layout {
+    Layout::from_size_align(size::<H>(cap), mem::align_of::<H>()).expect(OFLOW)
+}
+
+/// The total size to allocate when growing a buffer from `cap` to at least
+/// `new_cap`. As for `Buf32`, small buffers fill a power of two, and larger
+/// ones grow by half, to a whole number of pages.
+#[inline]
+fn grown_size<H>(cap: u64, new_cap: u64) -> usize {
+    let needed = size::<H>(new_cap);
+    if needed <= DOUBLING_LIMIT {
+        return needed.next_power_of_two();
+    }
+    let old = size::<H>(cap);
+    let size = cmp::max(needed, old.saturating_add(old / 2));
+    size.checked_add(PAGE_SIZE - 1).expect(OFLOW) & !(PAGE_SIZE - 1)
+}
+
+impl<H, Al> Buf64<H, Al>
+where
+    Al: Allocator,
+{
+    #[inline]
+    pub unsafe fn with_capacity(mut cap: u64, h: H) -> Buf64<H, Al> {
+        if cap < MIN_CAP {
+            cap = MIN_CAP;
+        }
+
+        let layout = layout::<H>(cap);
+        let ptr = Al::alloc(layout);
+        if ptr.is_null() {
+            handle_alloc_error(layout);
+        }
+        ptr::write(ptr as *mut H, h);
+
+        Buf64 {
+            ptr: ptr as *mut H,
+            cap: usable_cap::<H, Al>(ptr, layout),
+            marker: PhantomData,
+        }
+    }
+
+    #[inline]
+    pub unsafe fn destroy(self) {
+        ptr::drop_in_place(self.ptr);
+        Al::dealloc(self.ptr as *mut u8, layout::<H>(self.cap));
+    }
+
+    #[inline(always)]
+    pub unsafe fn data_ptr(&self) -> *mut u8 {
+        (self.ptr as *mut u8).offset(mem::size_of::<H>() as isize)
+    }
+
+    /// Grow the capacity to at least `new_cap`, and perhaps more; see
+    /// `grown_size`. Spare bytes reported by the allocator count towards
+    /// the capacity.
+    ///
+    /// This will panic if the capacity calculation overflows `usize`.
+    #[inline]
+    pub unsafe fn grow(&mut self, new_cap: u64) {
+        if new_cap <= self.cap {
+            return;
+        }
+
+        let size = grown_size::<H>(self.cap, new_cap);
+        let new_layout = Layout::from_size_align(size, mem::align_of::<H>()).expect(OFLOW);
+        let ptr = Al::realloc(self.ptr as *mut u8, layout::<H>(self.cap), size);
+        if ptr.is_null() {
+            handle_alloc_error(new_layout);
+        }
+        self.ptr = ptr as *mut H;
+        self.cap = usable_cap::<H, Al>(ptr, new_layout);
+    }
+}
+
+/// The capacity of a buffer just allocated with `layout`.
+#[inline(always)]
+unsafe fn usable_cap<H, Al>(ptr: *mut u8, layout: Layout) -> u64
+where
+    Al: Allocator,
+{
+    let usable = cmp::max(Al::usable_size(ptr, layout), layout.size());
+    (usable - mem::size_of::<H>()) as u64
+}
+
+#[cfg(test)]
+mod test {
+    use super::{grown_size, Buf64};
+    use std::{ptr, slice};
+    use tendril::Global;
+
+    #[test]
+    fn smoke_test() {
+        unsafe {
+            let mut b: Buf64<u64, Global> = Buf64::with_capacity(0, 0u64);
+            assert_eq!(16, b.cap);
+
+            b.grow(5);
+            ptr::copy_nonoverlapping(b"Hello".as_ptr(), b.data_ptr(), 5);
+            assert_eq!(b"Hello", slice::from_raw_parts(b.data_ptr(), 5));
+
+            b.grow(1337);
+            assert!(b.cap >= 1337);
+            assert_eq!(b"Hello", slice::from_raw_parts(b.data_ptr(), 5));
+
+            b.destroy();
+        }
+    }
+
+    #[test]
+    fn growth() {
+        assert_eq!(2048, grown_size::<u64>(16, 1337));
+
+        // Large buffers grow by half, in whole pages, past 4 GB too.
+        if cfg!(target_pointer_width = "64") {
+            let gib: u64 = 1 << 30;
+            let grown = |cap: u64, new_cap: u64| grown_size::<u64>(cap, new_cap) as u64;
+            assert_eq!(6 * gib, grown(4 * gib - 8, 4 * gib));
+            assert_eq!(10 * gib, grown(4 * gib - 8, 10 * gib - 1000));
+        }
+    }
+}
@@ -0,0 +1,987 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! A persistent rope of tendrils, built on a 2-3 finger tree.
+//!
+//! See Hinze and Paterson, "Finger trees: a simple general-purpose data
+//! structure" (2006). Every version of a `PersistentRope` shares structure
+//! with the versions it was derived from. Cloning is O(1), pushing onto
+//! either end is O(1) amortized, and splitting or concatenating is
+//! O(log n) in the number of chunks.
+//!
+//! Internal nodes cache a `Measure` of the text below them: the byte
+//! length, the number of characters and the number of newlines.
+
+use std::cmp;
+use std::fmt as strfmt;
+use std::iter::FromIterator;
+use std::ops::Add;
+use std::rc::Rc;
+
+use fmt;
+use tendril::{Atomicity, NonAtomic, SubtendrilError, Tendril};
+
+/// Summary of a stretch of text, cached at every node of the tree.
+#[derive(Copy, Clone, Default, Debug, PartialEq, Eq)]
+pub struct Measure {
+    /// Length in bytes.
+    pub bytes: u64,
+    /// Number of characters, for UTF-8, WTF-8 or ASCII text.
+    pub chars: u64,
+    /// Number of `'\n'` bytes.
+    pub newlines: u64,
+}
+
+impl Add for Measure {
+    type Output = Measure;
+
+    #[inline]
+    fn add(self, other: Measure) -> Measure {
+        Measure {
+            bytes: self.bytes + other.bytes,
+            chars: self.chars + other.chars,
+            newlines: self.newlines + other.newlines,
+        }
+    }
+}
+
+struct Node<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    measure: Measure,
+    kind: Kind<F, A>,
+}
+
+enum Kind<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    Leaf(Tendril<F, A>),
+    /// Two or three children, all at the same depth.
+    Branch(Vec<Elem<F, A>>),
+}
+
+// Rust can't express the nested type `FingerTree<Node<a>>` of the paper
+// without infinite monomorphization, so every level of the tree holds the
+// same element type, and leaves only ever appear at the top level.
+type Elem<F, A> = Rc<Node<F, A>>;
+
+enum Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    Empty,
+    Single(Elem<F, A>),
+    Deep(Rc<Deep<F, A>>),
+}
+
+struct Deep<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    measure: Measure,
+    /// One to four elements.
+    prefix: Vec<Elem<F, A>>,
+    middle: Tree<F, A>,
+    /// One to four elements.
+    suffix: Vec<Elem<F, A>>,
+}
+
+impl<F, A> Clone for Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn clone(&self) -> Tree<F, A> {
+        match *self {
+            Tree::Empty => Tree::Empty,
+            Tree::Single(ref x) => Tree::Single(x.clone()),
+            Tree::Deep(ref d) => Tree::Deep(d.clone()),
+        }
+    }
+}
+
+impl<F, A> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn measure(&self) -> Measure {
+        match *self {
+            Tree::Empty => Measure::default(),
+            Tree::Single(ref x) => x.measure,
+            Tree::Deep(ref d) => d.measure,
+        }
+    }
+}
+
+#[inline]
+fn measure_digit<F, A>(d: &[Elem<F, A>]) -> Measure
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    d.iter().fold(Measure::default(), |m, x| m + x.measure)
+}
+
+#[inline]
+fn children<F, A>(x: &Elem<F, A>) -> &[Elem<F, A>]
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match x.kind {
+        Kind::Branch(ref c) => c,
+        Kind::Leaf(_) => panic!("tendril: finger tree leaf below top level"),
+    }
+}
+
+#[inline]
+fn branch<F, A>(c: &[Elem<F, A>]) -> Elem<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    debug_assert!(c.len() == 2 || c.len() == 3);
+    Rc::new(Node {
+        measure: measure_digit(c),
+        kind: Kind::Branch(c.to_vec()),
+    })
+}
+
+#[inline]
+fn deep<F, A>(prefix: Vec<Elem<F, A>>, middle: Tree<F, A>, suffix: Vec<Elem<F, A>>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    debug_assert!(prefix.len() >= 1 && prefix.len() <= 4);
+    debug_assert!(suffix.len() >= 1 && suffix.len() <= 4);
+    Tree::Deep(Rc::new(Deep {
+        measure: measure_digit(&prefix) + middle.measure() + measure_digit(&suffix),
+        prefix: prefix,
+        middle: middle,
+        suffix: suffix,
+    }))
+}
+
+fn push_front<F, A>(t: &Tree<F, A>, x: Elem<F, A>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match *t {
+        Tree::Empty => Tree::Single(x),
+        Tree::Single(ref y) => deep(vec![x], Tree::Empty, vec![y.clone()]),
+        Tree::Deep(ref d) => {
+            if d.prefix.len() == 4 {
+                let middle = push_front(&d.middle, branch(&d.prefix[1..]));
+                deep(vec![x, d.prefix[0].clone()], middle, d.suffix.clone())
+            } else {
+                let mut prefix = Vec::with_capacity(d.prefix.len() + 1);
+                prefix.push(x);
+                prefix.extend(d.prefix.iter().cloned());
+                deep(prefix, d.middle.clone(), d.suffix.clone())
+            }
+        }
+    }
+}
+
+fn push_back<F, A>(t: &Tree<F, A>, x: Elem<F, A>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match *t {
+        Tree::Empty => Tree::Single(x),
+        Tree::Single(ref y) => deep(vec![y.clone()], Tree::Empty, vec![x]),
+        Tree::Deep(ref d) => {
+            if d.suffix.len() == 4 {
+                let middle = push_back(&d.middle, branch(&d.suffix[..3]));
+                deep(d.prefix.clone(), middle, vec![d.suffix[3].clone(), x])
+            } else {
+                let mut suffix = Vec::with_capacity(d.suffix.len() + 1);
+                suffix.extend(d.suffix.iter().cloned());
+                suffix.push(x);
+                deep(d.prefix.clone(), d.middle.clone(), suffix)
+            }
+        }
+    }
+}
+
+fn digit_to_tree<F, A>(d: &[Elem<F, A>]) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    d.iter().fold(Tree::Empty, |t, x| push_back(&t, x.clone()))
+}
+
+fn view_front<F, A>(t: &Tree<F, A>) -> Option<(Elem<F, A>, Tree<F, A>)>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match *t {
+        Tree::Empty => None,
+        Tree::Single(ref x) => Some((x.clone(), Tree::Empty)),
+        Tree::Deep(ref d) => Some((
+            d.prefix[0].clone(),
+            deep_l(&d.prefix[1..], &d.middle, &d.suffix),
+        )),
+    }
+}
+
+fn view_back<F, A>(t: &Tree<F, A>) -> Option<(Tree<F, A>, Elem<F, A>)>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match *t {
+        Tree::Empty => None,
+        Tree::Single(ref x) => Some((Tree::Empty, x.clone())),
+        Tree::Deep(ref d) => {
+            let n = d.suffix.len();
+            Some((
+                deep_r(&d.prefix, &d.middle, &d.suffix[..n - 1]),
+                d.suffix[n - 1].clone(),
+            ))
+        }
+    }
+}
+
+/// Build a deep tree whose prefix may be empty.
+fn deep_l<F, A>(prefix: &[Elem<F, A>], middle: &Tree<F, A>, suffix: &[Elem<F, A>]) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    if !prefix.is_empty() {
+        return deep(prefix.to_vec(), middle.clone(), suffix.to_vec());
+    }
+    match view_front(middle) {
+        None => digit_to_tree(suffix),
+        Some((x, middle)) => deep(children(&x).to_vec(), middle, suffix.to_vec()),
+    }
+}
+
+/// Build a deep tree whose suffix may be empty.
+fn deep_r<F, A>(prefix: &[Elem<F, A>], middle: &Tree<F, A>, suffix: &[Elem<F, A>]) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    if !suffix.is_empty() {
+        return deep(prefix.to_vec(), middle.clone(), suffix.to_vec());
+    }
+    match view_back(middle) {
+        None => digit_to_tree(prefix),
+        Some((middle, x)) => deep(prefix.to_vec(), middle, children(&x).to_vec()),
+    }
+}
+
+/// Group two or more elements into 2- and 3-branches.
+fn nodes<F, A>(xs: &[Elem<F, A>]) -> Vec<Elem<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let mut out = Vec::with_capacity(xs.len() / 2);
+    let mut rest = xs;
+    loop {
+        match rest.len() {
+            2 | 3 => {
+                out.push(branch(rest));
+                return out;
+            }
+            4 => {
+                out.push(branch(&rest[..2]));
+                out.push(branch(&rest[2..]));
+                return out;
+            }
+            _ => {
+                out.push(branch(&rest[..3]));
+                rest = &rest[3..];
+            }
+        }
+    }
+}
+
+fn app3<F, A>(t1: &Tree<F, A>, xs: &[Elem<F, A>], t2: &Tree<F, A>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match (t1, t2) {
+        (&Tree::Empty, _) => xs
+            .iter()
+            .rev()
+            .fold(t2.clone(), |t, x| push_front(&t, x.clone())),
+        (_, &Tree::Empty) => xs.iter().fold(t1.clone(), |t, x| push_back(&t, x.clone())),
+        (&Tree::Single(ref x), _) => push_front(&app3(&Tree::Empty, xs, t2), x.clone()),
+        (_, &Tree::Single(ref x)) => push_back(&app3(t1, xs, &Tree::Empty), x.clone()),
+        (&Tree::Deep(ref d1), &Tree::Deep(ref d2)) => {
+            let mut mid = Vec::with_capacity(d1.suffix.len() + xs.len() + d2.prefix.len());
+            mid.extend(d1.suffix.iter().cloned());
+            mid.extend(xs.iter().cloned());
+            mid.extend(d2.prefix.iter().cloned());
+            let middle = app3(&d1.middle, &nodes(&mid), &d2.middle);
+            deep(d1.prefix.clone(), middle, d2.suffix.clone())
+        }
+    }
+}
+
+type Split<F, A> = (Vec<Elem<F, A>>, Elem<F, A>, Vec<Elem<F, A>>);
+
+/// Find the first element at which `pred` becomes true.
+fn split_digit<F, A, P>(pred: &P, mut acc: Measure, d: &[Elem<F, A>]) -> Split<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    P: Fn(Measure) -> bool,
+{
+    let last = d.len() - 1;
+    for (i, x) in d[..last].iter().enumerate() {
+        acc = acc + x.measure;
+        if pred(acc) {
+            return (d[..i].to_vec(), x.clone(), d[i + 1..].to_vec());
+        }
+    }
+    (d[..last].to_vec(), d[last].clone(), vec![])
+}
+
+/// Split a non-empty tree around the first element at which `pred`,
+/// applied to the measure of everything up to and including that
+/// element (plus `acc`), becomes true.
+fn split_tree<F, A, P>(
+    pred: &P,
+    acc: Measure,
+    t: &Tree<F, A>,
+) -> (Tree<F, A>, Elem<F, A>, Tree<F, A>)
+where
+    F: fmt::Format,
+    A: Atomicity,
+    P: Fn(Measure) -> bool,
+{
+    match *t {
+        Tree::Empty => panic!("tendril: split of empty finger tree"),
+        Tree::Single(ref x) => (Tree::Empty, x.clone(), Tree::Empty),
+        Tree::Deep(ref d) => {
+            let v_prefix = acc + measure_digit(&d.prefix);
+            if pred(v_prefix) {
+                let (l, x, r) = split_digit(pred, acc, &d.prefix);
+                return (digit_to_tree(&l), x, deep_l(&r, &d.middle, &d.suffix));
+            }
+            let v_middle = v_prefix + d.middle.measure();
+            if pred(v_middle) {
+                let (ml, xs, mr) = split_tree(pred, v_prefix, &d.middle);
+                let (l, x, r) = split_digit(pred, v_prefix + ml.measure(), children(&xs));
+                return (deep_r(&d.prefix, &ml, &l), x, deep_l(&r, &mr, &d.suffix));
+            }
+            let (l, x, r) = split_digit(pred, v_middle, &d.suffix);
+            (deep_r(&d.prefix, &d.middle, &l), x, digit_to_tree(&r))
+        }
+    }
+}
+
+/// A persistent rope of `Tendril` chunks.
+///
+/// Cloning a `PersistentRope` is O(1), and every edit leaves previous
+/// clones untouched, so keeping old versions around (e.g. for undo) costs
+/// only the tree nodes which differ between them. Chunks are shared
+/// tendrils; their bytes are never copied.
+///
+/// Tree nodes are reference-counted with `Rc`, so a `PersistentRope` is
+/// never `Send`, whatever its atomicity.
+pub struct PersistentRope<F, A = NonAtomic>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    tree: Tree<F, A>,
+}
+
+impl<F, A> PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Create a new, empty `PersistentRope`.
+    #[inline]
+    pub fn new() -> PersistentRope<F, A> {
+        PersistentRope { tree: Tree::Empty }
+    }
+
+    /// Get the cached measure of the whole rope.
+    #[inline]
+    pub fn measure(&self) -> Measure {
+        self.tree.measure()
+    }
+
+    /// Get the length of the rope in bytes.
+    #[inline]
+    pub fn len(&self) -> u64 {
+        self.measure().bytes
+    }
+
+    /// Get the number of characters in the rope.
+    #[inline]
+    pub fn char_count(&self) -> u64 {
+        self.measure().chars
+    }
+
+    /// Get the number of newlines in the rope.
+    #[inline]
+    pub fn newline_count(&self) -> u64 {
+        self.measure().newlines
+    }
+
+    /// Is the rope empty?
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        match self.tree {
+            Tree::Empty => true,
+            _ => false,
+        }
+    }
+
+    /// Concatenate a copy of `other` onto the end of this rope.
+    ///
+    /// `other` is left as it was; both ropes share its nodes.
+    #[inline]
+    pub fn append(&mut self, other: &PersistentRope<F, A>) {
+        self.tree = app3(&self.tree, &[], &other.tree);
+    }
+
+    /// Try to split the rope in two at the given byte offset. Returns
+    /// everything after `at`, leaving everything before it in `self`.
+    ///
+    /// The function will return `Err` if `at` is out of bounds, or if the
+    /// chunk which contains `at` cannot be split there in this format.
+    pub fn try_split_off(&mut self, at: u64) -> Result<PersistentRope<F, A>, SubtendrilError> {
+        if at > self.len() {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        if at == self.len() {
+            return Ok(PersistentRope::new());
+        }
+
+        let (left, x, right) =
+            split_tree(&|m: Measure| m.bytes > at, Measure::default(), &self.tree);
+        let start = left.measure().bytes;
+        if start == at {
+            self.tree = left;
+            return Ok(PersistentRope {
+                tree: push_front(&right, x),
+            });
+        }
+
+        let chunk = leaf_chunk(&x);
+        let off = (at - start) as u32;
+        let front = chunk.try_subtendril(0, off)?;
+        let back = chunk.try_subtendril(off, chunk.len32() - off)?;
+        self.tree = push_back(
+            &left,
+            Rc::new(Node {
+                measure: x.measure_prefix(&front),
+                kind: Kind::Leaf(front),
+            }),
+        );
+        let back = Rc::new(Node {
+            measure: x.measure_suffix(&back),
+            kind: Kind::Leaf(back),
+        });
+        Ok(PersistentRope {
+            tree: push_front(&right, back),
+        })
+    }
+
+    /// Split the rope in two at the given byte offset.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn split_off(&mut self, at: u64) -> PersistentRope<F, A> {
+        self.try_split_off(at).unwrap()
+    }
+
+    /// Try to remove `length` bytes starting at `offset`.
+    pub fn try_remove(&mut self, offset: u64, length: u64) -> Result<(), SubtendrilError> {
+        let end = offset
+            .checked_add(length)
+            .ok_or(SubtendrilError::OutOfBounds)?;
+        let mut front = self.clone();
+        let mut rest = front.try_split_off(offset)?;
+        let back = rest.try_split_off(end - offset)?;
+        front.append(&back);
+        *self = front;
+        Ok(())
+    }
+
+    /// Remove `length` bytes starting at `offset`.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn remove(&mut self, offset: u64, length: u64) {
+        self.try_remove(offset, length).unwrap()
+    }
+
+    /// Find the byte offset at which line `n` starts, counting from zero.
+    ///
+    /// Returns `None` if the rope has fewer than `n` newlines.
+    pub fn line_start(&self, n: u64) -> Option<u64> {
+        if n == 0 {
+            return Some(0);
+        }
+        if n > self.newline_count() {
+            return None;
+        }
+
+        let (left, x, _) = split_tree(
+            &|m: Measure| m.newlines >= n,
+            Measure::default(),
+            &self.tree,
+        );
+        let before = left.measure();
+        let chunk = leaf_chunk(&x);
+        let mut remaining = n - before.newlines;
+        for (i, &b) in chunk.as_bytes().iter().enumerate() {
+            if b == b'\n' {
+                remaining -= 1;
+                if remaining == 0 {
+                    return Some(before.bytes + i as u64 + 1);
+                }
+            }
+        }
+        unreachable!()
+    }
+
+    /// Iterate over the chunks of the rope, in order.
+    #[inline]
+    pub fn chunks<'a>(&'a self) -> Chunks<'a, F, A> {
+        Chunks {
+            stack: vec![Work::Tree(&self.tree)],
+        }
+    }
+
+    /// Concatenate the chunks into a single `Tendril`.
+    ///
+    /// This is free for a rope of one chunk. Panics if the result would
+    /// be longer than 4 GB.
+    pub fn to_tendril(&self) -> Tendril<F, A> {
+        let mut chunks = self.chunks();
+        let mut t = match chunks.next() {
+            None => return Tendril::new(),
+            Some(t) => t.clone(),
+        };
+        for c in chunks {
+            t.push_tendril(c);
+        }
+        t
+    }
+}
+
+impl<F, A> Node<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Measure a prefix of this leaf's chunk, using the cached measure of
+    /// the whole chunk to avoid scanning more than half of it.
+    fn measure_prefix(&self, front: &Tendril<F, A>) -> Measure {
+        let whole = leaf_chunk(self);
+        if front.len32() <= whole.len32() / 2 {
+            measure_bytes::<F>(front.as_bytes())
+        } else {
+            let tail = &whole.as_bytes()[front.len32() as usize..];
+            subtract(self.measure, measure_bytes::<F>(tail))
+        }
+    }
+
+    /// Likewise for a suffix.
+    fn measure_suffix(&self, back: &Tendril<F, A>) -> Measure {
+        let whole = leaf_chunk(self);
+        if back.len32() <= whole.len32() / 2 {
+            measure_bytes::<F>(back.as_bytes())
+        } else {
+            let head = &whole.as_bytes()[..(whole.len32() - back.len32()) as usize];
+            subtract(self.measure, measure_bytes::<F>(head))
+        }
+    }
+}
+
+#[inline]
+fn leaf_chunk<F, A>(x: &Node<F, A>) -> &Tendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match x.kind {
+        Kind::Leaf(ref t) => t,
+        Kind::Branch(_) => panic!("tendril: finger tree branch at top level"),
+    }
+}
+
+#[inline]
+fn subtract(a: Measure, b: Measure) -> Measure {
+    Measure {
+        bytes: a.bytes - b.bytes,
+        chars: a.chars - b.chars,
+        newlines: a.newlines - b.newlines,
+    }
+}
+
+/// Measure some bytes.
+///
+/// Characters are counted as bytes which are not UTF-8 continuation bytes.
+/// This is exact for the UTF-8, WTF-8 and ASCII formats.
+#[inline]
+fn measure_bytes<F>(buf: &[u8]) -> Measure
+where
+    F: fmt::Format,
+{
+    let mut m = Measure {
+        bytes: buf.len() as u64,
+        chars: 0,
+        newlines: 0,
+    };
+    for &b in buf {
+        m.chars += ((b as i8) >= -0x40) as u64;
+        m.newlines += (b == b'\n') as u64;
+    }
+    m
+}
+
+impl<F, A> PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn leaf(t: Tendril<F, A>) -> Elem<F, A> {
+        Rc::new(Node {
+            measure: measure_bytes::<F>(t.as_bytes()),
+            kind: Kind::Leaf(t),
+        })
+    }
+
+    /// Append a tendril as the last chunk, in O(1) amortized time.
+    #[inline]
+    pub fn push_back(&mut self, t: Tendril<F, A>) {
+        if t.len32() == 0 {
+            return;
+        }
+        self.tree = push_back(&self.tree, Self::leaf(t));
+    }
+
+    /// Prepend a tendril as the first chunk, in O(1) amortized time.
+    #[inline]
+    pub fn push_front(&mut self, t: Tendril<F, A>) {
+        if t.len32() == 0 {
+            return;
+        }
+        self.tree = push_front(&self.tree, Self::leaf(t));
+    }
+
+    /// Try to insert a tendril at the given byte offset.
+    pub fn try_insert(&mut self, at: u64, t: Tendril<F, A>) -> Result<(), SubtendrilError> {
+        let mut front = self.clone();
+        let back = front.try_split_off(at)?;
+        front.push_back(t);
+        front.append(&back);
+        *self = front;
+        Ok(())
+    }
+
+    /// Insert a tendril at the given byte offset.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn insert(&mut self, at: u64, t: Tendril<F, A>) {
+        self.try_insert(at, t).unwrap()
+    }
+}
+
+enum Work<'a, F, A>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+{
+    Tree(&'a Tree<F, A>),
+    Elem(&'a Elem<F, A>),
+}
+
+/// Iterator over the chunks of a `PersistentRope`.
+pub struct Chunks<'a, F, A>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+{
+    stack: Vec<Work<'a, F, A>>,
+}
+
+impl<'a, F, A> Iterator for Chunks<'a, F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    type Item = &'a Tendril<F, A>;
+
+    fn next(&mut self) -> Option<&'a Tendril<F, A>> {
+        loop {
+            match unwrap_or_return!(self.stack.pop(), None) {
+                Work::Elem(x) => match x.kind {
+                    Kind::Leaf(ref t) => return Some(t),
+                    Kind::Branch(ref c) => self.stack.extend(c.iter().rev().map(Work::Elem)),
+                },
+                Work::Tree(&Tree::Empty) => {}
+                Work::Tree(&Tree::Single(ref x)) => self.stack.push(Work::Elem(x)),
+                Work::Tree(&Tree::Deep(ref d)) => {
+                    self.stack.extend(d.suffix.iter().rev().map(Work::Elem));
+                    self.stack.push(Work::Tree(&d.middle));
+                    self.stack.extend(d.prefix.iter().rev().map(Work::Elem));
+                }
+            }
+        }
+    }
+}
+
+impl<F, A> Clone for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Make another version of this rope, in O(1).
+    #[inline]
+    fn clone(&self) -> PersistentRope<F, A> {
+        PersistentRope {
+            tree: self.tree.clone(),
+        }
+    }
+}
+
+impl<F, A> Default for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn default() -> PersistentRope<F, A> {
+        PersistentRope::new()
+    }
+}
+
+impl<F, A> From<Tendril<F, A>> for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn from(t: Tendril<F, A>) -> PersistentRope<F, A> {
+        let mut rope = PersistentRope::new();
+        rope.push_back(t);
+        rope
+    }
+}
+
+impl<F, A> Extend<Tendril<F, A>> for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn extend<I>(&mut self, iterable: I)
+    where
+        I: IntoIterator<Item = Tendril<F, A>>,
+    {
+        for t in iterable {
+            self.push_back(t);
+        }
+    }
+}
+
+impl<F, A> FromIterator<Tendril<F, A>> for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn from_iter<I>(iterable: I) -> PersistentRope<F, A>
+    where
+        I: IntoIterator<Item = Tendril<F, A>>,
+    {
+        let mut rope = PersistentRope::new();
+        rope.extend(iterable);
+        rope
+    }
+}
+
+impl<F, A> PartialEq for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Compare contents, regardless of how they are split into chunks.
+    fn eq(&self, other: &PersistentRope<F, A>) -> bool {
+        if self.measure() != other.measure() {
+            return false;
+        }
+        let mut lhs = self.chunks().map(|t| t.as_bytes());
+        let mut rhs = other.chunks().map(|t| t.as_bytes());
+        let (mut a, mut b): (&[u8], &[u8]) = (&[], &[]);
+        loop {
+            if a.is_empty() {
+                a = match lhs.next() {
+                    Some(t) => &**t,
+                    None => return b.is_empty() && rhs.next().is_none(),
+                };
+            }
+            if b.is_empty() {
+                b = match rhs.next() {
+                    Some(t) => &**t,
+                    None => return false,
+                };
+            }
+            let n = cmp::min(a.len(), b.len());
+            if a[..n] != b[..n] {
+                return false;
+            }
+            a = &a[n..];
+            b = &b[n..];
+        }
+    }
+}
+
+impl<F, A> Eq for PersistentRope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+}
+
+impl<F, A> strfmt::Debug for PersistentRope<F, A>
+where
+    F: fmt::SliceFormat + Default + strfmt::Debug,
+    <F as fmt::SliceFormat>::Slice: strfmt::Debug,
+    A: Atomicity,
+{
+    fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
+        write!(f, "PersistentRope<{:?}>(", <F as Default>::default())?;
+        f.debug_list()
+            .entries(self.chunks().map(|t| &**t))
+            .finish()?;
+        write!(f, ")")
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{Measure, PersistentRope};
+    use fmt;
+    use tendril::{SliceExt, StrTendril, SubtendrilError};
+
+    type StrRope = PersistentRope<fmt::UTF8>;
+
+    fn contents(r: &StrRope) -> String {
+        r.chunks().map(|t| &**t).collect()
+    }
+
+    #[test]
+    fn smoke_test() {
+        let mut r = StrRope::new();
+        r.push_back("őő\n".to_tendril());
+        r.push_back("world\n".to_tendril());
+        r.push_front("\u{a66e}\n".to_tendril());
+        assert_eq!("\u{a66e}\nőő\nworld\n", &*contents(&r));
+        assert_eq!(
+            Measure {
+                bytes: 15,
+                chars: 11,
+                newlines: 3,
+            },
+            r.measure()
+        );
+    }
+
+    #[test]
+    fn versions_are_independent() {
+        let mut v1 = StrRope::new();
+        for i in 0..100 {
+            v1.push_back(StrTendril::from(format!("{},", i)));
+        }
+        let mut v2 = v1.clone();
+        v2.insert(4, "inserted".to_tendril());
+        v2.remove(0, 2);
+        let v3 = v2.split_off(50);
+
+        assert!(contents(&v1).starts_with("0,1,2,3,"));
+        assert!(contents(&v2).starts_with("1,inserted2,3,"));
+        assert_eq!(50, v2.len());
+        assert_eq!(v1.len() + 8 - 2 - 50, v3.len());
+
+        let mut joined = v2.clone();
+        joined.append(&v3);
+        assert_eq!(contents(&v2) + &*contents(&v3), contents(&joined));
+    }
+
+    #[test]
+    fn split_everywhere() {
+        let text = "Days turn to nights\nturn to paper\ninto rocks into plastic\n";
+        let r: StrRope = text
+            .split(' ')
+            .map(|w| StrTendril::from(format!("{} ", w)))
+            .collect();
+        let whole = contents(&r);
+        for at in 0..r.len() + 1 {
+            let mut front = r.clone();
+            let back = front.split_off(at);
+            assert_eq!(&whole[..at as usize], &*contents(&front));
+            assert_eq!(&whole[at as usize..], &*contents(&back));
+            assert_eq!(
+                whole[..at as usize].matches('\n').count() as u64,
+                front.newline_count()
+            );
+            front.append(&back);
+            assert_eq!(r, front);
+        }
+    }
+
+    #[test]
+    fn boundaries() {
+        let mut r = StrRope::from("\u{a66e}\u{a66e}".to_tendril());
+        assert_eq!(
+            Err(SubtendrilError::ValidationFailed),
+            r.try_split_off(2).map(|_| ())
+        );
+        assert_eq!(Err(SubtendrilError::OutOfBounds), r.try_remove(3, 4));
+        let back = r.split_off(3);
+        assert_eq!(1, r.char_count());
+        assert_eq!(1, back.char_count());
+    }
+
+    #[test]
+    fn line_start() {
+        let r: StrRope = vec![
+            "ab\ncd".to_tendril(),
+            "\n\nef".to_tendril(),
+            "g\n".to_tendril(),
+        ]
+        .into_iter()
+        .collect();
+        assert_eq!(Some(0), r.line_start(0));
+        assert_eq!(Some(3), r.line_start(1));
+        assert_eq!(Some(6), r.line_start(2));
+        assert_eq!(Some(7), r.line_start(3));
+        assert_eq!(Some(11), r.line_start(4));
+        assert_eq!(None, r.line_start(5));
+    }
+}
@@ -119,6 +119,20 @@ pub unsafe trait Format {
         <Self as Format>::validate(buf)
     }
 
+    /// Check whether the byte at index `i` is a character by itself, so
+    /// that the buffer can be cut on both sides of it.
+    ///
+    /// You may assume the buffer is valid and `i` is in bounds.
+    ///
+    /// The default checks only that byte, with `validate_subseq`, so that
+    /// splitting on it stays a single pass. A format in which that byte can
+    /// also sit inside a longer character, as in `UTF8` and `WTF8`, must
+    /// override this.
+    #[inline]
+    fn validate_delimiter(buf: &[u8], i: usize) -> bool {
+        <Self as Format>::validate_subseq(&buf[i..i + 1])
+    }
+
     /// Compute any fixup needed when concatenating buffers.
     ///
     /// The default is to do nothing.
@@ -258,6 +272,7 @@ unsafe impl Format for ASCII {
 
 unsafe impl SubsetOf<UTF8> for ASCII {}
 unsafe impl SubsetOf<Latin1> for ASCII {}
+unsafe impl SubsetOf<WTF8> for ASCII {}
 
 unsafe impl<'a> CharFormat<'a> for ASCII {
     type Iter = imp::SingleByteCharIndices<'a>;
@@ -323,6 +338,11 @@ unsafe impl Format for UTF8 {
     fn validate_subseq(buf: &[u8]) -> bool {
         <Self as Format>::validate_prefix(buf) && <Self as Format>::validate_suffix(buf)
     }
+
+    #[inline(always)]
+    fn validate_delimiter(buf: &[u8], i: usize) -> bool {
+        buf[i] < 0x80
+    }
 }
 
 unsafe impl SubsetOf<WTF8> for UTF8 {}
@@ -428,6 +448,11 @@ unsafe impl Format for WTF8 {
         <Self as Format>::validate_prefix(buf) && <Self as Format>::validate_suffix(buf)
     }
 
+    #[inline(always)]
+    fn validate_delimiter(buf: &[u8], i: usize) -> bool {
+        buf[i] < 0x80
+    }
+
     #[inline]
     unsafe fn fixup(lhs: &[u8], rhs: &[u8]) -> imp::Fixup {
         const ERR: &'static str = "WTF8: internal error";
@@ -0,0 +1,236 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Interning tendrils, so that equal strings share one buffer.
+
+use std::borrow::Borrow;
+use std::collections::HashSet;
+use std::sync::Mutex;
+
+use fmt::{self, Slice};
+use tendril::{Arena, Atomic, Atomicity, NonAtomic, Tendril};
+
+/// A table of canonical tendrils, one for each distinct string.
+///
+/// Interning a string returns the canonical `Tendril` with those contents,
+/// copying them into the interner the first time. Strings short enough to
+/// be stored in-line are copied each time, which costs no allocation.
+///
+/// Two tendrils from the same interner are equal exactly when `ptr_eq`
+/// holds, which compares a buffer and offset, or at most 16 bytes in-line,
+/// rather than the contents.
+///
+/// Canonical buffers live in an `Arena`, and are released when the
+/// interner and every `Tendril` it returned are gone.
+///
+/// See `SyncInterner` to share an interner between threads.
+pub struct Interner<F, A = NonAtomic>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    set: HashSet<Tendril<F, A>>,
+    arena: Arena<A>,
+}
+
+impl<F, A> Interner<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    /// Create a new, empty `Interner`.
+    #[inline]
+    pub fn new() -> Interner<F, A> {
+        Interner {
+            set: HashSet::new(),
+            arena: Arena::new(),
+        }
+    }
+
+    /// Get the canonical `Tendril` for a slice.
+    #[inline]
+    pub fn intern(&mut self, x: &F::Slice) -> Tendril<F, A> {
+        unsafe { self.intern_bytes(x.as_bytes()) }
+    }
+
+    /// Get the canonical `Tendril` with the same contents as a `Tendril`.
+    ///
+    /// The contents are copied the first time, so that the canonical
+    /// `Tendril` does not keep the rest of `t`'s buffer alive.
+    #[inline]
+    pub fn intern_tendril(&mut self, t: &Tendril<F, A>) -> Tendril<F, A> {
+        unsafe { self.intern_bytes(t.borrow()) }
+    }
+
+    /// Get the canonical `Tendril` for a slice, if it has been interned.
+    #[inline]
+    pub fn get(&self, x: &F::Slice) -> Option<Tendril<F, A>> {
+        self.set.get(x.as_bytes()).cloned()
+    }
+
+    /// The number of distinct strings interned.
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.set.len()
+    }
+
+    /// Has nothing been interned yet?
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.set.is_empty()
+    }
+
+    unsafe fn intern_bytes(&mut self, x: &[u8]) -> Tendril<F, A> {
+        if let Some(t) = self.set.get(x) {
+            return t.clone();
+        }
+        let t: Tendril<F, A> = self.arena.alloc_bytes_without_validating(x);
+        self.set.insert(t.clone());
+        t
+    }
+}
+
+impl<F, A> Default for Interner<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    #[inline]
+    fn default() -> Interner<F, A> {
+        Interner::new()
+    }
+}
+
+/// An `Interner` which can be shared between threads, and returns
+/// `Tendril<F, Atomic>`.
+///
+/// Each call takes a lock. A thread which interns many strings may be
+/// better served by an `Interner` of its own.
+pub struct SyncInterner<F>
+where
+    F: fmt::Format,
+{
+    inner: Mutex<Interner<F, Atomic>>,
+}
+
+impl<F> SyncInterner<F>
+where
+    F: fmt::SliceFormat,
+{
+    /// Create a new, empty `SyncInterner`.
+    #[inline]
+    pub fn new() -> SyncInterner<F> {
+        SyncInterner {
+            inner: Mutex::new(Interner::new()),
+        }
+    }
+
+    /// Get the canonical `Tendril` for a slice.
+    #[inline]
+    pub fn intern(&self, x: &F::Slice) -> Tendril<F, Atomic> {
+        self.inner.lock().unwrap().intern(x)
+    }
+
+    /// Get the canonical `Tendril` with the same contents as a `Tendril`.
+    #[inline]
+    pub fn intern_tendril(&self, t: &Tendril<F, Atomic>) -> Tendril<F, Atomic> {
+        self.inner.lock().unwrap().intern_tendril(t)
+    }
+
+    /// Get the canonical `Tendril` for a slice, if it has been interned.
+    #[inline]
+    pub fn get(&self, x: &F::Slice) -> Option<Tendril<F, Atomic>> {
+        self.inner.lock().unwrap().get(x)
+    }
+
+    /// The number of distinct strings interned.
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.inner.lock().unwrap().len()
+    }
+
+    /// Has nothing been interned yet?
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.inner.lock().unwrap().is_empty()
+    }
+}
+
+impl<F> Default for SyncInterner<F>
+where
+    F: fmt::SliceFormat,
+{
+    #[inline]
+    fn default() -> SyncInterner<F> {
+        SyncInterner::new()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{Interner, SyncInterner};
+    use fmt;
+    use std::sync::Arc;
+    use std::thread;
+    use tendril::{SliceExt, StrTendril};
+
+    fn assert_send_sync<T: Send + Sync>() {}
+
+    #[test]
+    fn intern() {
+        let mut interner: Interner<fmt::UTF8> = Interner::new();
+        assert!(interner.is_empty());
+        assert!(interner.get("blockquote").is_none());
+
+        let a = interner.intern("blockquote");
+        let b = interner.intern("blockquote");
+        assert!(a.ptr_eq(&b));
+        assert!(a.is_shared_with(&b));
+
+        let input: StrTendril = "<blockquote class=blockquote>".to_tendril();
+        let c = interner.intern_tendril(&input.subtendril(1, 10));
+        let d = interner.intern_tendril(&input.subtendril(18, 10));
+        assert!(a.ptr_eq(&c) && a.ptr_eq(&d));
+        assert!(!c.is_shared_with(&input));
+
+        let short = interner.intern("div");
+        assert!(short.ptr_eq(&interner.intern_tendril(&"div".to_tendril())));
+        assert!(!short.ptr_eq(&interner.intern("dl")));
+        assert!(!a.ptr_eq(&interner.intern("blockquotes")));
+        assert!(!a.ptr_eq(&input.subtendril(1, 10)));
+
+        assert_eq!(4, interner.len());
+        assert!(a.ptr_eq(&interner.get("blockquote").unwrap()));
+
+        drop(interner);
+        assert_eq!("blockquote", &*d);
+    }
+
+    #[test]
+    fn sync_interner() {
+        assert_send_sync::<SyncInterner<fmt::UTF8>>();
+
+        let interner: Arc<SyncInterner<fmt::UTF8>> = Arc::new(SyncInterner::new());
+        let threads: Vec<_> = (0..4)
+            .map(|_| {
+                let interner = interner.clone();
+                thread::spawn(move || {
+                    (0..100)
+                        .map(|i| interner.intern(&*format!("attribute-{}", i % 10)))
+                        .collect::<Vec<_>>()
+                })
+            })
+            .collect();
+        let results: Vec<_> = threads.into_iter().map(|t| t.join().unwrap()).collect();
+
+        assert_eq!(10, interner.len());
+        for result in &results {
+            for (i, t) in result.iter().enumerate() {
+                assert!(t.ptr_eq(&results[0][i % 10]));
+            }
+        }
+    }
+}
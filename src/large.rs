@@ -0,0 +1,1222 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! `LargeTendril`, a tendril with 64-bit length.
+//!
+//! This is a submodule of `tendril` so that it can share buffers with
+//! `Tendril` directly.
+
+use std::borrow::Borrow;
+use std::cell::{Cell, UnsafeCell};
+use std::cmp::{self, Ordering};
+use std::fmt as strfmt;
+use std::marker::PhantomData;
+use std::num::NonZeroUsize;
+use std::ops::{Deref, DerefMut};
+use std::sync::atomic::Ordering as AtomicOrdering;
+use std::{hash, io, mem, ptr, slice, u32};
+
+use buf32::Buf32;
+use buf64::Buf64;
+use fmt::imp::Fixup;
+use fmt::{self, Slice};
+use stream::TendrilSink;
+use util::{copy_and_advance, copy_lifetime, copy_lifetime_mut, unsafe_slice, unsafe_slice_mut};
+use OFLOW;
+
+use super::{Atomicity, Header, Heap, NonAtomic, SubtendrilError, Tendril, MAX_INLINE_TAG};
+
+const MAX_INLINE_LEN: usize = 16;
+const EMPTY_TAG: usize = 0x1F;
+const LARGE_MAX_INLINE_TAG: usize = 0x1F;
+
+/// Tag bit for a buffer with a `Header64` rather than a `Header`.
+const LARGE_HEADER: usize = 2;
+
+/// Buffers up to this size use the same header as `Tendril`, so they can be
+/// handed back and forth for free. Beyond it, `Buf32` can't double the
+/// capacity any further.
+const MAX_SMALL_CAP: u64 = 1 << 31;
+
+/// The largest chunk `feed` will copy into a single `Tendril`.
+const FEED_CHUNK: u64 = 1 << 30;
+
+#[inline(always)]
+fn inline_tag(len: u64) -> NonZeroUsize {
+    debug_assert!(len <= MAX_INLINE_LEN as u64);
+    unsafe { NonZeroUsize::new_unchecked(if len == 0 { EMPTY_TAG } else { len as usize }) }
+}
+
+struct Header64<A: Atomicity> {
+    refcount: A,
+    cap: u64,
+}
+
+/// A `Tendril` with 64-bit length and offsets, for buffers larger than
+/// 4 GB.
+///
+/// `LargeTendril` supports sharing, slicing and formats just like `Tendril`.
+/// It is 24 bytes rather than 16, and stores up to 16 bytes inline.
+///
+/// Buffers up to 2 GB are laid out exactly as for `Tendril`. Converting a
+/// `Tendril` into a `LargeTendril` is free, unless it carries metadata, and
+/// so is the reverse for such buffers.
+#[repr(C)]
+pub struct LargeTendril<F, A = NonAtomic>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    ptr: Cell<NonZeroUsize>,
+    buf: UnsafeCell<LargeBuffer>,
+    marker: PhantomData<*mut F>,
+    refcount_marker: PhantomData<A>,
+}
+
+#[repr(C)]
+union LargeBuffer {
+    heap: LargeHeap,
+    inline: [u8; MAX_INLINE_LEN],
+}
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+struct LargeHeap {
+    len: u64,
+    aux: u64,
+}
+
+unsafe impl<F, A> Send for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity + Sync,
+{
+}
+
+/// An owned heap buffer of either kind.
+enum RawBuf<A>
+where
+    A: Atomicity,
+{
+    Small(Buf32<Header<A>>),
+    Large(Buf64<Header64<A>>),
+}
+
+impl<A> RawBuf<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    unsafe fn with_capacity(cap: u64) -> RawBuf<A> {
+        if cap <= MAX_SMALL_CAP {
+            RawBuf::Small(Buf32::with_capacity(cap as u32, Header::new()))
+        } else {
+            RawBuf::Large(Buf64::with_capacity(
+                cap,
+                Header64 {
+                    refcount: A::new(),
+                    cap: 0,
+                },
+            ))
+        }
+    }
+
+    #[inline]
+    fn tagged_ptr(&self) -> usize {
+        match *self {
+            RawBuf::Small(ref b) => b.ptr as usize,
+            RawBuf::Large(ref b) => b.ptr as usize | LARGE_HEADER,
+        }
+    }
+
+    #[inline]
+    fn cap(&self) -> u64 {
+        match *self {
+            RawBuf::Small(ref b) => b.cap as u64,
+            RawBuf::Large(ref b) => b.cap,
+        }
+    }
+
+    #[inline]
+    unsafe fn data_ptr(&self) -> *mut u8 {
+        match *self {
+            RawBuf::Small(ref b) => b.data_ptr(),
+            RawBuf::Large(ref b) => b.data_ptr(),
+        }
+    }
+
+    #[inline]
+    unsafe fn destroy(self) {
+        match self {
+            RawBuf::Small(b) => b.destroy(),
+            RawBuf::Large(b) => b.destroy(),
+        }
+    }
+}
+
+impl<F, A> Clone for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn clone(&self) -> LargeTendril<F, A> {
+        unsafe {
+            if self.ptr.get().get() > LARGE_MAX_INLINE_TAG {
+                self.make_buf_shared();
+                self.refcount().increment();
+            }
+
+            ptr::read(self)
+        }
+    }
+}
+
+impl<F, A> Drop for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn drop(&mut self) {
+        unsafe {
+            let p = self.ptr.get().get();
+            if p <= LARGE_MAX_INLINE_TAG {
+                return;
+            }
+
+            let (buf, shared, _) = self.assume_buf();
+            if shared {
+                if self.refcount().decrement() == 1 {
+                    A::fence_acquire();
+                    buf.destroy();
+                }
+            } else {
+                buf.destroy();
+            }
+        }
+    }
+}
+
+impl<F, A> LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Create a new, empty `LargeTendril` in any format.
+    #[inline(always)]
+    pub fn new() -> LargeTendril<F, A> {
+        unsafe { LargeTendril::inline(&[]) }
+    }
+
+    /// Create a new, empty `LargeTendril` with a specified capacity.
+    #[inline]
+    pub fn with_capacity(capacity: u64) -> LargeTendril<F, A> {
+        let mut t: LargeTendril<F, A> = LargeTendril::new();
+        if capacity > MAX_INLINE_LEN as u64 {
+            unsafe {
+                t.make_owned_with_capacity(capacity);
+            }
+        }
+        t
+    }
+
+    /// Reserve space for additional bytes.
+    ///
+    /// This is only a suggestion. There are cases where `LargeTendril` will
+    /// decline to allocate until the buffer is actually modified.
+    #[inline]
+    pub fn reserve(&mut self, additional: u64) {
+        if !self.is_shared() {
+            let new_len = self.len64().checked_add(additional).expect(OFLOW);
+            if new_len > MAX_INLINE_LEN as u64 {
+                unsafe {
+                    self.make_owned_with_capacity(new_len);
+                }
+            }
+        }
+    }
+
+    /// Get the length of the `LargeTendril`.
+    #[inline(always)]
+    pub fn len64(&self) -> u64 {
+        match self.ptr.get().get() {
+            EMPTY_TAG => 0,
+            n if n <= MAX_INLINE_LEN => n as u64,
+            _ => unsafe { self.raw_len() },
+        }
+    }
+
+    /// Is the backing buffer shared?
+    #[inline]
+    pub fn is_shared(&self) -> bool {
+        let n = self.ptr.get().get();
+
+        (n > LARGE_MAX_INLINE_TAG) && ((n & 1) == 1)
+    }
+
+    /// Is the backing buffer shared with this other `LargeTendril`?
+    #[inline]
+    pub fn is_shared_with(&self, other: &LargeTendril<F, A>) -> bool {
+        let n = self.ptr.get().get();
+
+        (n > LARGE_MAX_INLINE_TAG) && (n == other.ptr.get().get())
+    }
+
+    /// Truncate to length 0 without discarding any owned storage.
+    #[inline]
+    pub fn clear(&mut self) {
+        if self.ptr.get().get() <= LARGE_MAX_INLINE_TAG {
+            self.ptr.set(inline_tag(0));
+        } else if self.is_shared() {
+            *self = LargeTendril::new();
+        } else {
+            unsafe { self.set_len(0) };
+        }
+    }
+
+    /// Build a `LargeTendril` by copying a byte slice, if it conforms to
+    /// the format.
+    #[inline]
+    pub fn try_from_byte_slice(x: &[u8]) -> Result<LargeTendril<F, A>, ()> {
+        match F::validate(x) {
+            true => Ok(unsafe { LargeTendril::from_byte_slice_without_validating(x) }),
+            false => Err(()),
+        }
+    }
+
+    /// Convert into a `Tendril`, if the length fits in 32 bits.
+    ///
+    /// This is free unless the underlying buffer is larger than 2 GB, in
+    /// which case the contents are copied.
+    pub fn try_into_tendril(self) -> Result<Tendril<F, A>, LargeTendril<F, A>> {
+        let len = self.len64();
+        if len > u32::MAX as u64 {
+            return Err(self);
+        }
+
+        unsafe {
+            let p = self.ptr.get().get();
+            if p <= LARGE_MAX_INLINE_TAG || (p & LARGE_HEADER) != 0 {
+                return Ok(Tendril::from_byte_slice_without_validating(
+                    self.as_byte_slice(),
+                ));
+            }
+
+            let heap = (*self.buf.get()).heap;
+            mem::forget(self);
+            let t: Tendril<F, A> = Tendril::new();
+            t.ptr.set(NonZeroUsize::new_unchecked(p));
+            (*t.buf.get()).heap = Heap {
+                len: heap.len as u32,
+                aux: heap.aux as u32,
+            };
+            Ok(t)
+        }
+    }
+
+    /// Pass the contents to a `TendrilSink`, as one or more `Tendril`s.
+    ///
+    /// The buffer is shared if it fits in a `Tendril`. Otherwise, it is
+    /// copied in chunks of at most 1 GB, split at format boundaries.
+    pub fn feed<S>(self, sink: &mut S)
+    where
+        S: TendrilSink<F, A>,
+    {
+        let mut rest = match self.try_into_tendril() {
+            Ok(t) => return sink.process(t),
+            Err(rest) => rest,
+        };
+
+        while rest.len64() > 0 {
+            let n;
+            {
+                let bytes = rest.as_byte_slice();
+                let mut end = cmp::min(bytes.len() as u64, FEED_CHUNK) as usize;
+                while !F::validate_prefix(&bytes[..end]) || !F::validate_suffix(&bytes[end..]) {
+                    end -= 1;
+                    assert!(end > 0, "tendril: no format boundary to split at");
+                }
+                n = end;
+                sink.process(unsafe { Tendril::from_byte_slice_without_validating(&bytes[..n]) });
+            }
+            unsafe {
+                rest.unsafe_pop_front(n as u64);
+            }
+        }
+    }
+
+    /// View as uninterpreted bytes.
+    #[inline(always)]
+    pub fn as_bytes(&self) -> &LargeTendril<fmt::Bytes, A> {
+        unsafe { mem::transmute(self) }
+    }
+
+    /// Convert into uninterpreted bytes.
+    #[inline(always)]
+    pub fn into_bytes(self) -> LargeTendril<fmt::Bytes, A> {
+        unsafe { mem::transmute(self) }
+    }
+
+    /// View as a superset format, for free.
+    #[inline(always)]
+    pub fn as_superset<Super>(&self) -> &LargeTendril<Super, A>
+    where
+        F: fmt::SubsetOf<Super>,
+        Super: fmt::Format,
+    {
+        unsafe { mem::transmute(self) }
+    }
+
+    /// Convert into a superset format, for free.
+    #[inline(always)]
+    pub fn into_superset<Super>(self) -> LargeTendril<Super, A>
+    where
+        F: fmt::SubsetOf<Super>,
+        Super: fmt::Format,
+    {
+        unsafe { mem::transmute(self) }
+    }
+
+    /// Convert into a subset format, if the `LargeTendril` conforms to that
+    /// subset.
+    #[inline]
+    pub fn try_into_subset<Sub>(self) -> Result<LargeTendril<Sub, A>, Self>
+    where
+        Sub: fmt::SubsetOf<F>,
+    {
+        match Sub::revalidate_subset(self.as_byte_slice()) {
+            true => Ok(unsafe { mem::transmute(self) }),
+            false => Err(self),
+        }
+    }
+
+    /// View as another format, if the bytes of the `LargeTendril` are valid
+    /// for that format.
+    #[inline]
+    pub fn try_reinterpret_view<Other>(&self) -> Result<&LargeTendril<Other, A>, ()>
+    where
+        Other: fmt::Format,
+    {
+        match Other::validate(self.as_byte_slice()) {
+            true => Ok(unsafe { mem::transmute(self) }),
+            false => Err(()),
+        }
+    }
+
+    /// Convert into another format, if the `LargeTendril` conforms to that
+    /// format.
+    #[inline]
+    pub fn try_reinterpret<Other>(self) -> Result<LargeTendril<Other, A>, Self>
+    where
+        Other: fmt::Format,
+    {
+        match Other::validate(self.as_byte_slice()) {
+            true => Ok(unsafe { mem::transmute(self) }),
+            false => Err(self),
+        }
+    }
+
+    /// Convert into another format, without validating.
+    #[inline(always)]
+    pub unsafe fn reinterpret_without_validating<Other>(self) -> LargeTendril<Other, A>
+    where
+        Other: fmt::Format,
+    {
+        mem::transmute(self)
+    }
+
+    /// Push some bytes onto the end, if they conform to the format.
+    #[inline]
+    pub fn try_push_bytes(&mut self, buf: &[u8]) -> Result<(), ()> {
+        match F::validate(buf) {
+            true => unsafe {
+                self.push_bytes_without_validating(buf);
+                Ok(())
+            },
+            false => Err(()),
+        }
+    }
+
+    /// Push another `LargeTendril` onto the end of this one.
+    #[inline]
+    pub fn push_tendril(&mut self, other: &LargeTendril<F, A>) {
+        let new_len = self.len64().checked_add(other.len64()).expect(OFLOW);
+
+        unsafe {
+            if self.is_shared()
+                && self.is_shared_with(other)
+                && other.aux() == self.aux() + self.raw_len()
+            {
+                self.set_len(new_len);
+                return;
+            }
+
+            self.push_bytes_without_validating(other.as_byte_slice())
+        }
+    }
+
+    /// Attempt to slice this `LargeTendril` as a new `LargeTendril`.
+    ///
+    /// This will share the buffer when possible. Mutating a shared buffer
+    /// will copy the contents.
+    #[inline]
+    pub fn try_subtendril(
+        &self,
+        offset: u64,
+        length: u64,
+    ) -> Result<LargeTendril<F, A>, SubtendrilError> {
+        let self_len = self.len64();
+        if offset > self_len || length > (self_len - offset) {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+
+        unsafe {
+            let byte_slice = unsafe_slice(self.as_byte_slice(), offset as usize, length as usize);
+            if !F::validate_subseq(byte_slice) {
+                return Err(SubtendrilError::ValidationFailed);
+            }
+
+            Ok(self.unsafe_subtendril(offset, length))
+        }
+    }
+
+    /// Slice this `LargeTendril` as a new `LargeTendril`.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn subtendril(&self, offset: u64, length: u64) -> LargeTendril<F, A> {
+        self.try_subtendril(offset, length).unwrap()
+    }
+
+    /// Try to drop `n` bytes from the front.
+    #[inline]
+    pub fn try_pop_front(&mut self, n: u64) -> Result<(), SubtendrilError> {
+        if n == 0 {
+            return Ok(());
+        }
+        let old_len = self.len64();
+        if n > old_len {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        let new_len = old_len - n;
+
+        unsafe {
+            if !F::validate_suffix(unsafe_slice(
+                self.as_byte_slice(),
+                n as usize,
+                new_len as usize,
+            )) {
+                return Err(SubtendrilError::ValidationFailed);
+            }
+
+            self.unsafe_pop_front(n);
+            Ok(())
+        }
+    }
+
+    /// Drop `n` bytes from the front.
+    ///
+    /// Panics if the bytes are not available, or the suffix fails
+    /// validation.
+    #[inline]
+    pub fn pop_front(&mut self, n: u64) {
+        self.try_pop_front(n).unwrap()
+    }
+
+    /// Try to drop `n` bytes from the back.
+    #[inline]
+    pub fn try_pop_back(&mut self, n: u64) -> Result<(), SubtendrilError> {
+        if n == 0 {
+            return Ok(());
+        }
+        let old_len = self.len64();
+        if n > old_len {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        let new_len = old_len - n;
+
+        unsafe {
+            if !F::validate_prefix(unsafe_slice(self.as_byte_slice(), 0, new_len as usize)) {
+                return Err(SubtendrilError::ValidationFailed);
+            }
+
+            self.unsafe_pop_back(n);
+            Ok(())
+        }
+    }
+
+    /// Drop `n` bytes from the back.
+    ///
+    /// Panics if the bytes are not available, or the prefix fails
+    /// validation.
+    #[inline]
+    pub fn pop_back(&mut self, n: u64) {
+        self.try_pop_back(n).unwrap()
+    }
+
+    /// Build a `LargeTendril` by copying a byte slice, without validating.
+    #[inline]
+    pub unsafe fn from_byte_slice_without_validating(x: &[u8]) -> LargeTendril<F, A> {
+        if x.len() <= MAX_INLINE_LEN {
+            LargeTendril::inline(x)
+        } else {
+            LargeTendril::owned_copy(x)
+        }
+    }
+
+    /// Push some bytes onto the end of the `LargeTendril`, without
+    /// validating.
+    pub unsafe fn push_bytes_without_validating(&mut self, buf: &[u8]) {
+        let Fixup {
+            drop_left,
+            drop_right,
+            insert_len,
+            insert_bytes,
+        } = F::fixup(self.as_byte_slice(), buf);
+
+        let adj_len = self.len64() + insert_len as u64 - drop_left as u64;
+        let new_len = adj_len.checked_add(buf.len() as u64).expect(OFLOW) - drop_right as u64;
+
+        let drop_left = drop_left as usize;
+        let drop_right = drop_right as usize;
+
+        if new_len <= MAX_INLINE_LEN as u64 {
+            let mut tmp = [0_u8; MAX_INLINE_LEN];
+            {
+                let old = self.as_byte_slice();
+                let mut dest = tmp.as_mut_ptr();
+                copy_and_advance(&mut dest, unsafe_slice(old, 0, old.len() - drop_left));
+                copy_and_advance(
+                    &mut dest,
+                    unsafe_slice(&insert_bytes, 0, insert_len as usize),
+                );
+                copy_and_advance(
+                    &mut dest,
+                    unsafe_slice(buf, drop_right, buf.len() - drop_right),
+                );
+            }
+            *self = LargeTendril::inline(&tmp[..new_len as usize]);
+        } else {
+            self.make_owned_with_capacity(new_len);
+            let mut dest = self
+                .data_ptr()
+                .offset((self.raw_len() as usize - drop_left) as isize);
+            copy_and_advance(
+                &mut dest,
+                unsafe_slice(&insert_bytes, 0, insert_len as usize),
+            );
+            copy_and_advance(
+                &mut dest,
+                unsafe_slice(buf, drop_right, buf.len() - drop_right),
+            );
+            self.set_len(new_len);
+        }
+    }
+
+    /// Slice this `LargeTendril` as a new `LargeTendril`.
+    ///
+    /// Does not check validity or bounds!
+    #[inline]
+    pub unsafe fn unsafe_subtendril(&self, offset: u64, length: u64) -> LargeTendril<F, A> {
+        if length <= MAX_INLINE_LEN as u64 {
+            LargeTendril::inline(unsafe_slice(
+                self.as_byte_slice(),
+                offset as usize,
+                length as usize,
+            ))
+        } else {
+            self.make_buf_shared();
+            self.refcount().increment();
+            let t = LargeTendril::new();
+            t.ptr.set(self.ptr.get());
+            (*t.buf.get()).heap = LargeHeap {
+                len: length,
+                aux: self.aux() + offset,
+            };
+            t
+        }
+    }
+
+    /// Drop `n` bytes from the front.
+    ///
+    /// Does not check validity or bounds!
+    #[inline]
+    pub unsafe fn unsafe_pop_front(&mut self, n: u64) {
+        let new_len = self.len64() - n;
+        if new_len <= MAX_INLINE_LEN as u64 {
+            *self = LargeTendril::inline(unsafe_slice(
+                self.as_byte_slice(),
+                n as usize,
+                new_len as usize,
+            ));
+        } else {
+            self.make_buf_shared();
+            self.set_aux(self.aux() + n);
+            let len = self.raw_len();
+            self.set_len(len - n);
+        }
+    }
+
+    /// Drop `n` bytes from the back.
+    ///
+    /// Does not check validity or bounds!
+    #[inline]
+    pub unsafe fn unsafe_pop_back(&mut self, n: u64) {
+        let new_len = self.len64() - n;
+        if new_len <= MAX_INLINE_LEN as u64 {
+            *self = LargeTendril::inline(unsafe_slice(self.as_byte_slice(), 0, new_len as usize));
+        } else {
+            self.make_buf_shared();
+            let len = self.raw_len();
+            self.set_len(len - n);
+        }
+    }
+
+    #[inline]
+    unsafe fn refcount(&self) -> &A {
+        let p = self.ptr.get().get();
+        if p & LARGE_HEADER == 0 {
+            &(*((p & !3) as *const Header<A>)).refcount
+        } else {
+            &(*((p & !3) as *const Header64<A>)).refcount
+        }
+    }
+
+    #[inline]
+    unsafe fn make_buf_shared(&self) {
+        let p = self.ptr.get().get();
+        if p & 1 == 0 {
+            // As for `Tendril`, the reference count is set afresh.
+            if p & LARGE_HEADER == 0 {
+                let header = (p & !3) as *mut Header<A>;
+                (*header).cap = self.aux() as u32;
+                (*header)
+                    .used
+                    .store(self.raw_len() as u32, AtomicOrdering::Relaxed);
+                ptr::write(&mut (*header).refcount, A::new());
+            } else {
+                let header = (p & !3) as *mut Header64<A>;
+                (*header).cap = self.aux();
+                ptr::write(&mut (*header).refcount, A::new());
+            }
+
+            self.ptr.set(NonZeroUsize::new_unchecked(p | 1));
+            self.set_aux(0);
+        }
+    }
+
+    #[inline]
+    fn make_owned(&mut self) {
+        unsafe {
+            let p = self.ptr.get().get();
+            if p <= LARGE_MAX_INLINE_TAG || (p & 1) == 1 {
+                *self = LargeTendril::owned_copy(self.as_byte_slice());
+            }
+        }
+    }
+
+    unsafe fn make_owned_with_capacity(&mut self, cap: u64) {
+        self.make_owned();
+        let (buf, _, _) = self.assume_buf();
+        let buf = match buf {
+            RawBuf::Small(mut b) => {
+                // The allocator may have given a small buffer more than
+                // `MAX_SMALL_CAP` already.
+                if cap <= MAX_SMALL_CAP || cap <= b.cap as u64 {
+                    b.grow(cap as u32);
+                    RawBuf::Small(b)
+                } else {
+                    let new = RawBuf::with_capacity(cap);
+                    ptr::copy_nonoverlapping(b.data_ptr(), new.data_ptr(), b.len as usize);
+                    b.destroy();
+                    new
+                }
+            }
+            RawBuf::Large(mut b) => {
+                b.grow(cap);
+                RawBuf::Large(b)
+            }
+        };
+        self.ptr.set(NonZeroUsize::new_unchecked(buf.tagged_ptr()));
+        self.set_aux(buf.cap());
+    }
+
+    #[inline]
+    unsafe fn assume_buf(&self) -> (RawBuf<A>, bool, u64) {
+        let p = self.ptr.get().get();
+        let shared = (p & 1) == 1;
+        let header = p & !3;
+        let (offset, len) = match shared {
+            true => (self.aux(), self.aux() + self.raw_len()),
+            false => (0, self.raw_len()),
+        };
+
+        let buf = if p & LARGE_HEADER == 0 {
+            let header = header as *mut Header<A>;
+            RawBuf::Small(Buf32 {
+                ptr: header,
+                len: len as u32,
+                cap: if shared {
+                    (*header).cap
+                } else {
+                    self.aux() as u32
+                },
+                marker: PhantomData,
+            })
+        } else {
+            let header = header as *mut Header64<A>;
+            RawBuf::Large(Buf64 {
+                ptr: header,
+                cap: if shared { (*header).cap } else { self.aux() },
+                marker: PhantomData,
+            })
+        };
+        (buf, shared, offset)
+    }
+
+    #[inline]
+    unsafe fn data_ptr(&self) -> *mut u8 {
+        self.assume_buf().0.data_ptr()
+    }
+
+    #[inline]
+    unsafe fn inline(x: &[u8]) -> LargeTendril<F, A> {
+        let len = x.len();
+        let t = LargeTendril {
+            ptr: Cell::new(inline_tag(len as u64)),
+            buf: UnsafeCell::new(LargeBuffer {
+                inline: [0; MAX_INLINE_LEN],
+            }),
+            marker: PhantomData,
+            refcount_marker: PhantomData,
+        };
+        ptr::copy_nonoverlapping(x.as_ptr(), (*t.buf.get()).inline.as_mut_ptr(), len);
+        t
+    }
+
+    #[inline]
+    unsafe fn owned_copy(x: &[u8]) -> LargeTendril<F, A> {
+        let len = x.len() as u64;
+        let b = RawBuf::<A>::with_capacity(len);
+        ptr::copy_nonoverlapping(x.as_ptr(), b.data_ptr(), x.len());
+        let t = LargeTendril::new();
+        t.ptr.set(NonZeroUsize::new_unchecked(b.tagged_ptr()));
+        (*t.buf.get()).heap = LargeHeap {
+            len: len,
+            aux: b.cap(),
+        };
+        t
+    }
+
+    #[inline]
+    fn as_byte_slice<'a>(&'a self) -> &'a [u8] {
+        unsafe {
+            match self.ptr.get().get() {
+                EMPTY_TAG => &[],
+                n if n <= MAX_INLINE_LEN => (*self.buf.get()).inline.get_unchecked(..n),
+                _ => {
+                    let (buf, _, offset) = self.assume_buf();
+                    copy_lifetime(
+                        self,
+                        slice::from_raw_parts(
+                            buf.data_ptr().offset(offset as isize),
+                            self.raw_len() as usize,
+                        ),
+                    )
+                }
+            }
+        }
+    }
+
+    #[inline]
+    fn as_mut_byte_slice<'a>(&'a mut self) -> &'a mut [u8] {
+        unsafe {
+            match self.ptr.get().get() {
+                EMPTY_TAG => &mut [],
+                n if n <= MAX_INLINE_LEN => (*self.buf.get()).inline.get_unchecked_mut(..n),
+                _ => {
+                    self.make_owned();
+                    let len = self.raw_len() as usize;
+                    let data = slice::from_raw_parts_mut(self.data_ptr(), len);
+                    copy_lifetime_mut(self, unsafe_slice_mut(data, 0, len))
+                }
+            }
+        }
+    }
+
+    #[inline(always)]
+    unsafe fn raw_len(&self) -> u64 {
+        (*self.buf.get()).heap.len
+    }
+
+    #[inline(always)]
+    unsafe fn set_len(&mut self, len: u64) {
+        (*self.buf.get()).heap.len = len;
+    }
+
+    #[inline(always)]
+    unsafe fn aux(&self) -> u64 {
+        (*self.buf.get()).heap.aux
+    }
+
+    #[inline(always)]
+    unsafe fn set_aux(&self, aux: u64) {
+        (*self.buf.get()).heap.aux = aux;
+    }
+}
+
+impl<F, A> LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    /// Build a `LargeTendril` by copying a slice.
+    #[inline]
+    pub fn from_slice(x: &F::Slice) -> LargeTendril<F, A> {
+        unsafe { LargeTendril::from_byte_slice_without_validating(x.as_bytes()) }
+    }
+
+    /// Push a slice onto the end of the `LargeTendril`.
+    #[inline]
+    pub fn push_slice(&mut self, x: &F::Slice) {
+        unsafe { self.push_bytes_without_validating(x.as_bytes()) }
+    }
+}
+
+impl<F, A> From<Tendril<F, A>> for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Convert a `Tendril`, for free unless it carries metadata.
+    #[inline]
+    fn from(t: Tendril<F, A>) -> LargeTendril<F, A> {
+        unsafe {
+            let p = t.ptr.get().get();
+            if p <= MAX_INLINE_TAG || t.is_external() || t.is_static() {
+                return LargeTendril::from_byte_slice_without_validating(t.as_byte_slice());
+            }
+
+            // `Header` is 8-aligned, which leaves the `LARGE_HEADER` bit
+            // clear.
+            debug_assert!(p & LARGE_HEADER == 0);
+            let (len, aux) = (t.raw_len(), t.aux());
+            mem::forget(t);
+            let large = LargeTendril::new();
+            large.ptr.set(NonZeroUsize::new_unchecked(p));
+            (*large.buf.get()).heap = LargeHeap {
+                len: len as u64,
+                aux: aux as u64,
+            };
+            large
+        }
+    }
+}
+
+impl<'a, F, A> From<&'a F::Slice> for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    #[inline]
+    fn from(input: &F::Slice) -> LargeTendril<F, A> {
+        LargeTendril::from_slice(input)
+    }
+}
+
+impl<F, A> Deref for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    type Target = F::Slice;
+
+    #[inline]
+    fn deref(&self) -> &F::Slice {
+        unsafe { F::Slice::from_bytes(self.as_byte_slice()) }
+    }
+}
+
+impl<F, A> DerefMut for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    #[inline]
+    fn deref_mut(&mut self) -> &mut F::Slice {
+        unsafe { F::Slice::from_mut_bytes(self.as_mut_byte_slice()) }
+    }
+}
+
+impl<F, A> Borrow<[u8]> for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    A: Atomicity,
+{
+    fn borrow(&self) -> &[u8] {
+        self.as_byte_slice()
+    }
+}
+
+impl<F, A> PartialEq for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn eq(&self, other: &Self) -> bool {
+        self.as_byte_slice() == other.as_byte_slice()
+    }
+}
+
+impl<F, A> Eq for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+}
+
+impl<F, A> PartialOrd for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    <F as fmt::SliceFormat>::Slice: PartialOrd,
+    A: Atomicity,
+{
+    #[inline]
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        PartialOrd::partial_cmp(&**self, &**other)
+    }
+}
+
+impl<F, A> Ord for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat,
+    <F as fmt::SliceFormat>::Slice: Ord,
+    A: Atomicity,
+{
+    #[inline]
+    fn cmp(&self, other: &Self) -> Ordering {
+        Ord::cmp(&**self, &**other)
+    }
+}
+
+impl<F, A> Default for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline(always)]
+    fn default() -> LargeTendril<F, A> {
+        LargeTendril::new()
+    }
+}
+
+impl<F, A> strfmt::Debug for LargeTendril<F, A>
+where
+    F: fmt::SliceFormat + Default + strfmt::Debug,
+    <F as fmt::SliceFormat>::Slice: strfmt::Debug,
+    A: Atomicity,
+{
+    #[inline]
+    fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
+        let kind = match self.ptr.get().get() {
+            p if p <= LARGE_MAX_INLINE_TAG => "inline",
+            p if p & 1 == 1 => "shared",
+            _ => "owned",
+        };
+
+        write!(
+            f,
+            "LargeTendril<{:?}>({}: ",
+            <F as Default>::default(),
+            kind
+        )?;
+        <<F as fmt::SliceFormat>::Slice as strfmt::Debug>::fmt(&**self, f)?;
+        write!(f, ")")
+    }
+}
+
+impl<F, A> hash::Hash for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn hash<H: hash::Hasher>(&self, hasher: &mut H) {
+        self.as_byte_slice().hash(hasher)
+    }
+}
+
+impl<A> io::Write for LargeTendril<fmt::Bytes, A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        self.push_slice(buf);
+        Ok(buf.len())
+    }
+
+    #[inline]
+    fn write_all(&mut self, buf: &[u8]) -> io::Result<()> {
+        self.push_slice(buf);
+        Ok(())
+    }
+
+    #[inline(always)]
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+impl<A> strfmt::Display for LargeTendril<fmt::UTF8, A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
+        <str as strfmt::Display>::fmt(&**self, f)
+    }
+}
+
+/// Collects every tendril into one `LargeTendril`. Errors are ignored.
+///
+/// The first tendril is taken over for free, so a single-tendril stream
+/// never copies.
+impl<F, A> TendrilSink<F, A> for LargeTendril<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn process(&mut self, t: Tendril<F, A>) {
+        if self.len64() == 0 {
+            *self = LargeTendril::from(t);
+        } else {
+            unsafe { self.push_bytes_without_validating(t.as_byte_slice()) }
+        }
+    }
+
+    #[inline]
+    fn error(&mut self, _desc: ::std::borrow::Cow<'static, str>) {}
+
+    type Output = LargeTendril<F, A>;
+
+    #[inline]
+    fn finish(self) -> LargeTendril<F, A> {
+        self
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::LargeTendril;
+    use fmt;
+    use std::borrow::Cow;
+    use stream::TendrilSink;
+    use tendril::{Atomic, SliceExt, StrTendril, Tendril};
+
+    type LargeStrTendril = LargeTendril<fmt::UTF8>;
+
+    #[test]
+    fn assert_sizes() {
+        use std::mem;
+        assert_eq!(
+            mem::size_of::<*const ()>() + 16,
+            mem::size_of::<LargeStrTendril>()
+        );
+    }
+
+    #[test]
+    fn smoke_test() {
+        let mut t = LargeStrTendril::from_slice("Hello");
+        assert_eq!("Hello", &*t);
+        t.push_slice(", world! This no longer fits inline.");
+        assert_eq!("Hello, world! This no longer fits inline.", &*t);
+        assert_eq!(41, t.len64());
+
+        let u = t.subtendril(7, 28);
+        assert!(t.is_shared_with(&u));
+        assert_eq!("world! This no longer fits i", &*u);
+        assert!(t.try_subtendril(7, 100).is_err());
+
+        let mut v = u.clone();
+        v.pop_front(7);
+        v.pop_back(8);
+        assert_eq!("This no longe", &*v);
+        v.push_slice("!");
+        assert!(!v.is_shared());
+        assert_eq!("This no longe!", &*v);
+        assert_eq!("world! This no longer fits i", &*u);
+    }
+
+    #[test]
+    fn utf8_boundaries() {
+        let t = LargeStrTendril::from_slice("\u{a66e}\u{a66e}\u{a66e}\u{a66e}\u{a66e}\u{a66e}");
+        assert!(t.try_subtendril(1, 17).is_err());
+        assert!(t.try_subtendril(3, 14).is_err());
+        assert_eq!("\u{a66e}\u{a66e}", &*t.subtendril(3, 6));
+    }
+
+    #[test]
+    fn convert_without_copying() {
+        let t: StrTendril = "this is a long enough string".to_tendril();
+        let p = t.as_ptr();
+        let large = LargeTendril::from(t);
+        assert_eq!(p, large.as_ptr());
+
+        let sub = large.subtendril(5, 23);
+        let small = sub.try_into_tendril().unwrap();
+        assert_eq!(unsafe { p.offset(5) }, small.as_ptr());
+        assert_eq!("is a long enough string", &*small);
+        assert!(small.is_shared());
+        drop(large);
+        assert_eq!("is a long enough string", &*small);
+
+        let inline = LargeTendril::from("x".to_tendril());
+        assert_eq!("x", &*inline.try_into_tendril().unwrap());
+    }
+
+    struct Collect(Vec<StrTendril>);
+
+    impl TendrilSink<fmt::UTF8> for Collect {
+        fn process(&mut self, t: StrTendril) {
+            self.0.push(t);
+        }
+
+        fn error(&mut self, _: Cow<'static, str>) {}
+
+        type Output = Vec<StrTendril>;
+
+        fn finish(self) -> Vec<StrTendril> {
+            self.0
+        }
+    }
+
+    #[test]
+    fn sinks() {
+        let chunks = vec!["abc", "defghijklmnopqrstuvwxyz", "", "\u{a66e}"];
+        let large = LargeStrTendril::new().from_iter(chunks.iter().map(|&s| s));
+        assert_eq!("abcdefghijklmnopqrstuvwxyz\u{a66e}", &*large);
+
+        let mut out = Collect(vec![]);
+        large.clone().feed(&mut out);
+        assert_eq!(1, out.0.len());
+        assert_eq!(&*large, &*out.0[0]);
+    }
+
+    #[test]
+    fn atomic() {
+        let t: LargeTendril<fmt::UTF8, Atomic> =
+            LargeTendril::from(Tendril::from_slice("this is a string"));
+        let u = t.clone();
+        ::std::thread::spawn(move || assert_eq!("this is a string", &*u))
+            .join()
+            .unwrap();
+        assert!(t.is_shared());
+    }
+}
@@ -16,18 +16,34 @@ extern crate test;
 #[macro_use]
 extern crate mac;
 extern crate futf;
+#[cfg(target_os = "linux")]
+extern crate libc;
 extern crate utf8;
 
 pub use fmt::Format;
+pub use interner::{Interner, SyncInterner};
+pub use simd::AsciiSet;
 pub use stream::TendrilSink;
-pub use tendril::{Atomic, Atomicity, NonAtomic, SendTendril};
-pub use tendril::{ByteTendril, ReadExt, SliceExt, StrTendril, SubtendrilError, Tendril};
+pub use tendril::{write_tendrils, Lines, SplitByte, SplitChar, TendrilWriter};
+pub use tendril::{
+    Allocator, Arena, Atomic, Atomicity, BiasedAtomic, Inline16, Inline8, InlineCapacity,
+    LargeTendril,
+};
+pub use tendril::{BlockReader, Global, NonAtomic, SendBiasedTendril, SendTendril, TendrilPool};
+pub use tendril::{
+    ByteTendril, HashedTendril, ReadExt, SliceExt, StrTendril, SubtendrilError, Tendril,
+};
 pub use utf8_decode::IncompleteUtf8;
 
+pub mod finger_tree;
 pub mod fmt;
+pub mod rope;
 pub mod stream;
 
 mod buf32;
+mod buf64;
+mod interner;
+mod simd;
 mod tendril;
 mod utf8_decode;
 mod util;
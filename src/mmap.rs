@@ -0,0 +1,218 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Tendrils on read-only memory maps of files.
+//!
+//! This is a submodule of `tendril` so that it can build external buffers.
+
+use libc;
+#[cfg(target_env = "musl")]
+use libc::{mmap, off_t};
+// `off_t` is 32 bits on 32-bit glibc and Android; musl's is always 64.
+#[cfg(not(target_env = "musl"))]
+use libc::{mmap64 as mmap, off64_t as off_t};
+use std::fs::File;
+use std::io;
+use std::os::unix::io::AsRawFd;
+use std::{cmp, ptr, u32};
+
+use fmt;
+
+use super::{Allocator, Atomicity, ExternalHeader, InlineCapacity, Tendril};
+
+/// How much of a file `map_windows` maps at once.
+#[cfg(target_pointer_width = "64")]
+const WINDOW_SIZE: u64 = 1 << 30;
+#[cfg(not(target_pointer_width = "64"))]
+const WINDOW_SIZE: u64 = 64 << 20;
+
+/// `release` for an `ExternalHeader` on a mapping. The `owner` is the start
+/// of the mapping, which may be up to a page before the bytes.
+unsafe fn release_mapped<A>(header: *mut ExternalHeader<A>)
+where
+    A: Atomicity,
+{
+    let base = (*header).owner as *mut u8;
+    let len = (*header).data as usize - base as usize + (*header).header.cap as usize;
+    libc::munmap(base as *mut libc::c_void, len);
+    drop(Box::from_raw(header));
+}
+
+/// Map `len` bytes of `file` from `offset`, which the caller has checked
+/// lie within the file, and advise the kernel how they will be read.
+///
+/// The caller must also make sure that the file is not modified while the
+/// mapping lives; see `Tendril::map_file`.
+unsafe fn map<F, A, I, Al>(
+    file: &File,
+    offset: u64,
+    len: u32,
+    advice: libc::c_int,
+) -> io::Result<Tendril<F, A, I, Al>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    if len == 0 {
+        return Ok(Tendril::new());
+    }
+    let page = libc::sysconf(libc::_SC_PAGESIZE) as u64;
+    let skip = offset % page;
+    let map_len = skip as usize + len as usize;
+    if offset - skip > off_t::max_value() as u64 {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            "offset too large to map",
+        ));
+    }
+    let base = mmap(
+        ptr::null_mut(),
+        map_len,
+        libc::PROT_READ,
+        libc::MAP_PRIVATE,
+        file.as_raw_fd(),
+        (offset - skip) as off_t,
+    );
+    if base == libc::MAP_FAILED {
+        return Err(io::Error::last_os_error());
+    }
+    if advice != libc::MADV_NORMAL {
+        libc::madvise(base, map_len, advice);
+    }
+    let data = (base as *const u8).offset(skip as isize);
+    let header = ExternalHeader::new(data, len, release_mapped::<A>, base as *mut ());
+    Ok(Tendril::external(Box::into_raw(Box::new(header))))
+}
+
+impl<F, A, I, Al> Tendril<F, A, I, Al>
+where
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Map `len` bytes of a file, starting at `offset`, read-only into
+    /// memory, and build a `Tendril` on them without copying.
+    ///
+    /// The `Tendril` is shared. Clones and subtendrils share the mapping,
+    /// which is unmapped when the last of them is dropped; mutating one
+    /// copies it. Bytes are read from the file only when first touched.
+    ///
+    /// Only available on Linux.
+    ///
+    /// This is unsafe because the bytes of the `Tendril` are those of the
+    /// file. The caller must make sure that no one, in this process or
+    /// another, writes to or truncates the file until every `Tendril` on the
+    /// mapping is dropped. A write changes bytes that may already have been
+    /// validated, for instance as UTF-8, and reading a page which is no
+    /// longer part of the file raises `SIGBUS`.
+    pub unsafe fn map_file(file: &File, offset: u64, len: u32) -> io::Result<Tendril<F, A, I, Al>> {
+        let file_len = file.metadata()?.len();
+        if offset
+            .checked_add(len as u64)
+            .map_or(true, |end| end > file_len)
+        {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "range extends past the end of the file",
+            ));
+        }
+        map(file, offset, len, libc::MADV_NORMAL)
+    }
+}
+
+/// Map the whole of `file`, as its length is now, a large window at a time,
+/// advised for reading in order. Each window is passed to `f` as a
+/// `Tendril`, and unmapped once every `Tendril` on it is dropped.
+///
+/// Returns the number of bytes mapped.
+///
+/// This is unsafe for the same reason as `Tendril::map_file`.
+pub unsafe fn map_windows<F, A, G>(file: &File, mut f: G) -> io::Result<u64>
+where
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+    G: FnMut(Tendril<F, A>),
+{
+    let file_len = file.metadata()?.len();
+    let mut offset = 0;
+    while offset < file_len {
+        let len = cmp::min(WINDOW_SIZE, file_len - offset);
+        f(map(file, offset, len as u32, libc::MADV_SEQUENTIAL)?);
+        offset += len;
+    }
+    Ok(file_len)
+}
+
+#[cfg(test)]
+mod test {
+    use super::map_windows;
+    use fmt;
+    use std::fs::{self, File};
+    use std::io::{ErrorKind, Write};
+    use std::path::PathBuf;
+    use std::{env, process};
+    use tendril::{Atomic, ByteTendril, Tendril};
+
+    /// A file in the temporary directory, removed when dropped.
+    struct TempFile(PathBuf);
+
+    impl TempFile {
+        fn new(name: &str, contents: &[u8]) -> TempFile {
+            let path = env::temp_dir().join(format!("tendril-{}-{}", process::id(), name));
+            File::create(&path).unwrap().write_all(contents).unwrap();
+            TempFile(path)
+        }
+    }
+
+    impl Drop for TempFile {
+        fn drop(&mut self) {
+            let _ = fs::remove_file(&self.0);
+        }
+    }
+
+    #[test]
+    fn map_file() {
+        let map_file = |file: &File, offset, len| unsafe { Tendril::map_file(file, offset, len) };
+        let contents: Vec<u8> = (0..10000).map(|i| (i % 251) as u8).collect();
+        let temp = TempFile::new("map_file", &contents);
+        let file = File::open(&temp.0).unwrap();
+
+        let t: ByteTendril = map_file(&file, 0, 10000).unwrap();
+        assert!(t.is_shared());
+        assert_eq!(&contents[..], &*t);
+
+        // Offsets need not be page-aligned.
+        let mut u: ByteTendril = map_file(&file, 4095, 5000).unwrap();
+        assert_eq!(&contents[4095..9095], &*u);
+        let v = u.subtendril(1000, 20);
+        drop((t, file));
+        assert_eq!(&contents[5095..5115], &*v);
+        u[0] = 0xFF;
+        assert!(!u.is_shared());
+        assert_eq!(&contents[4096..9095], &u[1..]);
+
+        let file = File::open(&temp.0).unwrap();
+        let empty: ByteTendril = map_file(&file, 10000, 0).unwrap();
+        assert_eq!(0, empty.len());
+        let err = map_file(&file, 9000, 1001).unwrap_err();
+        assert_eq!(ErrorKind::InvalidInput, err.kind());
+        assert!(map_file(&file, u64::max_value(), 1).is_err());
+    }
+
+    #[test]
+    fn windows() {
+        let temp = TempFile::new("windows", b"mapped a window at a time");
+        let file = File::open(&temp.0).unwrap();
+        let mut windows: Vec<Tendril<fmt::Bytes, Atomic>> = vec![];
+        let mapped = unsafe { map_windows(&file, |t| windows.push(t)).unwrap() };
+        assert_eq!(25, mapped);
+        assert_eq!(1, windows.len());
+        assert_eq!(b"mapped a window at a time", &*windows[0]);
+    }
+}
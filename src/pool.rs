@@ -0,0 +1,574 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! `TendrilPool`, which recycles fixed-size tendril buffers.
+//!
+//! This is a submodule of `tendril` so that it can build external buffers.
+
+use std::alloc::{self, Layout};
+use std::cell::UnsafeCell;
+use std::marker::PhantomData;
+use std::task::Poll;
+use std::{cmp, io, mem, ptr, slice, u32};
+
+use fmt;
+use OFLOW;
+
+use super::{Atomicity, ExternalHeader, Lock, NonAtomic, Tendril};
+
+/// The default size of a pool buffer, in bytes.
+const DEFAULT_BLOCK_SIZE: u32 = 4 * 1024;
+
+/// The default number of free buffers a pool keeps.
+const DEFAULT_MAX_FREE: usize = 64;
+
+/// A pool of fixed-size buffers for tendrils which are filled once, such
+/// as those read from a stream.
+///
+/// When the last `Tendril` sharing a buffer is dropped, the buffer goes back
+/// to the pool rather than to the allocator, and the next `fill` or `read`
+/// reuses it. A stream that is processed as it is read then costs a few
+/// allocations in all, rather than one per read. `TendrilSink::read_from`
+/// uses a pool this way.
+///
+/// The resulting `Tendril`s are shared; mutating one copies it out of the
+/// pool. Buffers still in use when the pool is dropped are freed as usual
+/// when their last `Tendril` is.
+///
+/// Buffers are zeroed when first allocated, so `fill` never sees
+/// uninitialized memory, but a recycled buffer holds whatever it last held.
+///
+/// With `A = Atomic`, both the pool and its tendrils can be sent between
+/// threads.
+pub struct TendrilPool<A = NonAtomic>
+where
+    A: Atomicity,
+{
+    inner: *mut PoolInner<A>,
+    marker: PhantomData<PoolInner<A>>,
+}
+
+unsafe impl<A> Send for TendrilPool<A> where A: Atomicity + Sync {}
+
+struct PoolInner<A>
+where
+    A: Atomicity,
+{
+    /// One for the `TendrilPool`, plus one for each live buffer.
+    refcount: A,
+    block_size: u32,
+    max_free: usize,
+    /// Only touched under `lock`, which is a real lock only if buffers can
+    /// be released on several threads.
+    free: UnsafeCell<Vec<*mut ExternalHeader<A>>>,
+    lock: A::Lock,
+}
+
+impl<A> PoolInner<A>
+where
+    A: Atomicity,
+{
+    #[inline(always)]
+    fn layout(&self) -> Layout {
+        let size = mem::size_of::<ExternalHeader<A>>() + self.block_size as usize;
+        Layout::from_size_align(size, mem::align_of::<ExternalHeader<A>>()).expect(OFLOW)
+    }
+
+    #[inline]
+    unsafe fn decref(inner: *mut PoolInner<A>) {
+        if (*inner).refcount.decrement() == 1 {
+            A::fence_acquire();
+            let inner = Box::from_raw(inner);
+            let layout = inner.layout();
+            for &block in (*inner.free.get()).iter() {
+                alloc::dealloc(block as *mut u8, layout);
+            }
+        }
+    }
+}
+
+/// `release` for an `ExternalHeader` in a pool.
+unsafe fn release_pooled<A>(header: *mut ExternalHeader<A>)
+where
+    A: Atomicity,
+{
+    let inner = (*header).owner as *mut PoolInner<A>;
+    ptr::drop_in_place(header);
+    (*inner).lock.with(|| {
+        let free = &mut *(*inner).free.get();
+        if free.len() < (*inner).max_free {
+            free.push(header);
+        } else {
+            alloc::dealloc(header as *mut u8, (*inner).layout());
+        }
+    });
+    PoolInner::decref(inner);
+}
+
+impl<A> TendrilPool<A>
+where
+    A: Atomicity,
+{
+    /// Create a new, empty `TendrilPool` of 4 KiB buffers.
+    #[inline]
+    pub fn new() -> TendrilPool<A> {
+        TendrilPool::with_block_size(DEFAULT_BLOCK_SIZE)
+    }
+
+    /// Create a new, empty `TendrilPool` of buffers of a given size.
+    ///
+    /// This will panic if `block_size` is zero.
+    pub fn with_block_size(block_size: u32) -> TendrilPool<A> {
+        assert!(
+            block_size > 0,
+            "TendrilPool buffers must hold at least a byte"
+        );
+        let inner = Box::new(PoolInner {
+            refcount: A::new(),
+            block_size: block_size,
+            max_free: DEFAULT_MAX_FREE,
+            free: UnsafeCell::new(vec![]),
+            lock: Default::default(),
+        });
+        TendrilPool {
+            inner: Box::into_raw(inner),
+            marker: PhantomData,
+        }
+    }
+
+    /// The size of each buffer, in bytes.
+    #[inline]
+    pub fn block_size(&self) -> u32 {
+        unsafe { (*self.inner).block_size }
+    }
+
+    /// Build a `Tendril` in a buffer from the pool.
+    ///
+    /// `fill` writes into the whole buffer, and returns how many bytes at
+    /// the start of it to keep. On error, the buffer goes back to the pool.
+    ///
+    /// This will panic if `fill` returns more than `block_size()`.
+    pub fn fill<F, E, G>(&self, fill: G) -> Result<Tendril<F, A>, E>
+    where
+        F: fmt::SliceFormat<Slice = [u8]>,
+        G: FnOnce(&mut [u8]) -> Result<usize, E>,
+    {
+        unsafe { self.fill_without_validating(fill) }
+    }
+
+    /// Build a `Tendril` in a buffer from the pool, without validating the
+    /// bytes that `fill` keeps. See `fill`.
+    pub unsafe fn fill_without_validating<F, E, G>(&self, fill: G) -> Result<Tendril<F, A>, E>
+    where
+        F: fmt::Format,
+        G: FnOnce(&mut [u8]) -> Result<usize, E>,
+    {
+        let block_size = self.block_size();
+        // If `fill` fails or panics, dropping this returns the buffer.
+        let (mut t, data) = self.block::<F>();
+        let header = t.header() as *mut ExternalHeader<A>;
+
+        let len = fill(slice::from_raw_parts_mut(data, block_size as usize))?;
+        if len > block_size as usize {
+            panic!("fill kept more bytes than the buffer holds");
+        }
+        (*header).header.cap = len as u32;
+        t.set_len(len as u32);
+        Ok(t)
+    }
+
+    /// Take a buffer from the pool, as a `Tendril` on the whole of it, and
+    /// a pointer to its bytes.
+    unsafe fn block<F>(&self) -> (Tendril<F, A>, *mut u8)
+    where
+        F: fmt::Format,
+    {
+        let inner = &*self.inner;
+        let header = self.take();
+        let data = header.offset(1) as *mut u8;
+        ptr::write(
+            header,
+            ExternalHeader::new(
+                data,
+                inner.block_size,
+                release_pooled::<A>,
+                self.inner as *mut (),
+            ),
+        );
+        inner.refcount.increment();
+        (Tendril::external(header), data)
+    }
+
+    /// Read once from `r` into a buffer from the pool, retrying if
+    /// interrupted. At the end of the input, return an empty `Tendril`.
+    #[inline]
+    pub fn read<F, R>(&self, r: &mut R) -> io::Result<Tendril<F, A>>
+    where
+        F: fmt::SliceFormat<Slice = [u8]>,
+        R: io::Read,
+    {
+        self.fill(|buf| loop {
+            match r.read(buf) {
+                Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
+                result => return result,
+            }
+        })
+    }
+
+    /// Get a free buffer, or allocate one.
+    #[inline]
+    unsafe fn take(&self) -> *mut ExternalHeader<A> {
+        let inner = &*self.inner;
+        if let Some(header) = inner.lock.with(|| (*inner.free.get()).pop()) {
+            return header;
+        }
+        let layout = inner.layout();
+        let block = alloc::alloc_zeroed(layout);
+        if block.is_null() {
+            alloc::handle_alloc_error(layout);
+        }
+        block as *mut ExternalHeader<A>
+    }
+}
+
+/// Reads a stream into buffers from a `TendrilPool`, packing several reads
+/// into each buffer.
+///
+/// `TendrilPool::read` gives every read a buffer of its own, and a read that
+/// returns less than a full buffer wastes the rest of it. A `BlockReader`
+/// instead reads into what is left of its current buffer, and returns a
+/// `Tendril` sharing it. It moves on to a new buffer once the space left is
+/// shorter than the reads so far, or than a quarter of a buffer.
+///
+/// This suits pools of large buffers, from 64 KiB to 1 MiB. A sink which
+/// keeps what it reads then costs one allocation per buffer, rather than one
+/// per read. Any one `Tendril` keeps its whole buffer from going back to the
+/// pool.
+pub struct BlockReader<'a, A = NonAtomic>
+where
+    A: Atomicity + 'a,
+{
+    pool: &'a TendrilPool<A>,
+    blocks: Blocks<A>,
+}
+
+impl<'a, A> BlockReader<'a, A>
+where
+    A: Atomicity,
+{
+    /// Create a `BlockReader` with buffers from `pool`.
+    #[inline]
+    pub fn new(pool: &'a TendrilPool<A>) -> BlockReader<'a, A> {
+        BlockReader {
+            pool: pool,
+            blocks: Blocks::new(),
+        }
+    }
+
+    /// Read once from `r` into the current buffer, or a new one, retrying
+    /// if interrupted. At the end of the input, return an empty `Tendril`.
+    pub fn read<F, R>(&mut self, r: &mut R) -> io::Result<Tendril<F, A>>
+    where
+        F: fmt::SliceFormat<Slice = [u8]>,
+        R: io::Read,
+    {
+        match self
+            .blocks
+            .read_with(self.pool, |buf| Poll::Ready(r.read(buf)))
+        {
+            Poll::Ready(result) => result,
+            Poll::Pending => unreachable!(),
+        }
+    }
+}
+
+/// The state of a `BlockReader`, apart from the pool its buffers come
+/// from, so that it can be kept alongside the pool.
+pub struct Blocks<A>
+where
+    A: Atomicity,
+{
+    /// The current buffer, whole, and its bytes. `None` before the first
+    /// read.
+    block: Option<(Tendril<fmt::Bytes, A>, *mut u8)>,
+    /// Where the space not yet read into begins.
+    offset: u32,
+    /// The longest read so far.
+    longest: u32,
+}
+
+unsafe impl<A> Send for Blocks<A> where A: Atomicity + Sync {}
+
+impl<A> Blocks<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    pub fn new() -> Blocks<A> {
+        Blocks {
+            block: None,
+            offset: 0,
+            longest: 0,
+        }
+    }
+
+    /// Read once with `read` into the current buffer, or a new one from
+    /// `pool`, retrying if interrupted. At the end of the input, return an
+    /// empty `Tendril`.
+    ///
+    /// If `read` claims more bytes than the space it was given, this fails
+    /// with `InvalidData`.
+    pub fn read_with<F, G>(
+        &mut self,
+        pool: &TendrilPool<A>,
+        mut read: G,
+    ) -> Poll<io::Result<Tendril<F, A>>>
+    where
+        F: fmt::SliceFormat<Slice = [u8]>,
+        G: FnMut(&mut [u8]) -> Poll<io::Result<usize>>,
+    {
+        let min_space = cmp::max(1, cmp::min(self.longest, pool.block_size() / 4));
+        let result = unsafe {
+            self.fill_without_validating(pool, min_space, |space| loop {
+                match read(space) {
+                    Poll::Ready(Err(ref e)) if e.kind() == io::ErrorKind::Interrupted => {}
+                    Poll::Ready(Ok(len)) if len <= space.len() => return Ok(len),
+                    Poll::Ready(Ok(_)) => {
+                        return Err(Poll::Ready(Err(io::Error::new(
+                            io::ErrorKind::InvalidData,
+                            "read more bytes than the buffer holds",
+                        ))))
+                    }
+                    Poll::Ready(Err(e)) => return Err(Poll::Ready(Err(e))),
+                    Poll::Pending => return Err(Poll::Pending),
+                }
+            })
+        };
+        match result {
+            Ok(t) => Poll::Ready(Ok(t)),
+            Err(poll) => poll,
+        }
+    }
+
+    /// Build a `Tendril` in what is left of the current buffer, or in a new
+    /// one from `pool` if less than `min_space` bytes are left, without
+    /// validating the bytes that `fill` keeps.
+    ///
+    /// `fill` writes into all the space left, and returns how many bytes at
+    /// the start of it to keep. This will panic if `fill` returns more than
+    /// that, or if `min_space` is more than `block_size()`.
+    pub unsafe fn fill_without_validating<F, E, G>(
+        &mut self,
+        pool: &TendrilPool<A>,
+        min_space: u32,
+        fill: G,
+    ) -> Result<Tendril<F, A>, E>
+    where
+        F: fmt::Format,
+        G: FnOnce(&mut [u8]) -> Result<usize, E>,
+    {
+        let block_size = pool.block_size();
+        assert!(min_space <= block_size);
+        if self.block.is_none() || block_size - self.offset < min_space {
+            self.block = Some(pool.block());
+            self.offset = 0;
+        }
+        let (ref block, data) = *self.block.as_ref().unwrap();
+
+        // Nothing else refers to the bytes after `offset` yet.
+        let space = slice::from_raw_parts_mut(
+            data.offset(self.offset as isize),
+            (block_size - self.offset) as usize,
+        );
+        let len = fill(space)?;
+        if len > space.len() {
+            panic!("fill kept more bytes than the buffer holds");
+        }
+        if len == 0 {
+            return Ok(Tendril::new());
+        }
+        let len = len as u32;
+        self.longest = cmp::max(self.longest, len);
+        let t = block.unsafe_subtendril(self.offset, len);
+        self.offset += len;
+        Ok(t.reinterpret_without_validating())
+    }
+}
+
+impl<A> Default for TendrilPool<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn default() -> TendrilPool<A> {
+        TendrilPool::new()
+    }
+}
+
+impl<A> Drop for TendrilPool<A>
+where
+    A: Atomicity,
+{
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { PoolInner::decref(self.inner) }
+    }
+}
+
+#[cfg(target_os = "linux")]
+#[path = "uring.rs"]
+mod uring;
+
+#[cfg(target_os = "linux")]
+pub use self::uring::read_files;
+
+#[cfg(test)]
+mod test {
+    use super::{BlockReader, TendrilPool};
+    use fmt;
+    use std::io;
+    use std::thread;
+    use tendril::{Atomic, ByteTendril, NonAtomic, Tendril};
+
+    #[test]
+    fn recycle() {
+        let pool: TendrilPool = TendrilPool::with_block_size(16);
+        let mut input: &[u8] = b"Hello, world! How are you today?";
+
+        let hello: ByteTendril = pool.read(&mut input).unwrap();
+        assert_eq!(b"Hello, world! Ho", &*hello);
+        assert!(hello.is_shared());
+        let addr = hello.as_ptr();
+        let mut world = hello.subtendril(7, 6);
+        assert!(!world.is_shared());
+        world.pop_back(1);
+        drop(hello);
+
+        let mut how: ByteTendril = pool.read(&mut input).unwrap();
+        assert_eq!(addr, how.as_ptr());
+        assert_eq!(b"w are you today?", &*how);
+        assert_eq!(b"world", &*world);
+
+        let end: ByteTendril = pool.read(&mut input).unwrap();
+        assert_eq!(0, end.len());
+        assert!(end.as_ptr() != addr);
+
+        how.push_slice(b"!");
+        assert!(!how.is_shared());
+        assert_eq!(b"w are you today?!", &*how);
+    }
+
+    #[test]
+    fn fill() {
+        let pool: TendrilPool<NonAtomic> = TendrilPool::new();
+        let err = pool.fill::<fmt::Bytes, _, _>(|_| Err("oops"));
+        assert_eq!(Some("oops"), err.err());
+
+        let t: ByteTendril = pool
+            .fill::<_, (), _>(|buf| {
+                assert_eq!(4096, buf.len());
+                buf[..3].copy_from_slice(b"abc");
+                Ok(3)
+            })
+            .unwrap();
+        let u = t.subtendril(1, 2);
+        drop((t, pool));
+        assert_eq!(b"bc", &*u);
+    }
+
+    #[test]
+    fn atomic() {
+        let pool: TendrilPool<Atomic> = TendrilPool::new();
+        let mut input: &[u8] = b"sent to another thread";
+        let t: Tendril<fmt::Bytes, Atomic> = pool.read(&mut input).unwrap();
+        let u = t.clone();
+        thread::spawn(move || {
+            assert_eq!(b"sent to another thread", &*u);
+            drop(pool);
+        })
+        .join()
+        .unwrap();
+        assert_eq!(b"sent to another thread", &*t);
+    }
+
+    /// Reads at most `max` bytes at a time.
+    struct Trickle<'a> {
+        input: &'a [u8],
+        max: usize,
+    }
+
+    impl<'a> io::Read for Trickle<'a> {
+        fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+            let n = self.input.len().min(self.max).min(buf.len());
+            buf[..n].copy_from_slice(&self.input[..n]);
+            self.input = &self.input[n..];
+            Ok(n)
+        }
+    }
+
+    #[test]
+    fn block_reader() {
+        let pool: TendrilPool = TendrilPool::with_block_size(64);
+        let input: Vec<u8> = (0..200).collect();
+        let mut r = Trickle {
+            input: &input,
+            max: 10,
+        };
+        let mut reader = BlockReader::new(&pool);
+        let mut pieces: Vec<ByteTendril> = vec![];
+        loop {
+            let t: ByteTendril = reader.read(&mut r).unwrap();
+            if t.len() == 0 {
+                break;
+            }
+            assert!(t.is_shared());
+            pieces.push(t);
+        }
+        assert_eq!(20, pieces.len());
+        let all: Vec<u8> = pieces.iter().flat_map(|t| t.iter().cloned()).collect();
+        assert_eq!(input, all);
+
+        // Six reads to a buffer, and then too little is left for another.
+        for (i, pair) in pieces.windows(2).enumerate() {
+            let next = pair[0].as_ptr() as usize + 10;
+            assert_eq!((i + 1) % 6 != 0, pair[1].as_ptr() as usize == next);
+        }
+
+        // Buffers go back to the pool once the reader and all their tendrils
+        // are done with them; the first is still in use.
+        let last = pieces[18].as_ptr();
+        pieces.truncate(6);
+        drop(reader);
+        let mut reader = BlockReader::new(&pool);
+        let t: ByteTendril = reader.read(&mut &b"and once more"[..]).unwrap();
+        assert_eq!(last, t.as_ptr());
+        assert_eq!(&input[..10], &*pieces[0]);
+    }
+
+    #[test]
+    fn read_error() {
+        struct Broken;
+        impl io::Read for Broken {
+            fn read(&mut self, _: &mut [u8]) -> io::Result<usize> {
+                Err(io::Error::new(io::ErrorKind::Other, "broken"))
+            }
+        }
+
+        let pool: TendrilPool = TendrilPool::new();
+        assert!(pool.read::<fmt::Bytes, _>(&mut Broken).is_err());
+
+        struct Liar;
+        impl io::Read for Liar {
+            fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+                Ok(buf.len() + 1)
+            }
+        }
+
+        let mut reader = BlockReader::new(&pool);
+        let err = reader.read::<fmt::Bytes, _>(&mut Liar).err().unwrap();
+        assert_eq!(io::ErrorKind::InvalidData, err.kind());
+    }
+}
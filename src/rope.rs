@@ -0,0 +1,739 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Ropes of tendrils.
+//!
+//! A `Rope` is a sequence of `Tendril` chunks kept in a height-balanced
+//! binary tree. Every node caches the total byte length of its subtree, so
+//! locating, splitting and concatenating are logarithmic in the number of
+//! chunks. These operations only move chunk handles around and bump
+//! refcounts; the string data itself is never copied.
+//!
+//! Unlike a `Tendril`, a `Rope` is not limited to 4 GB.
+
+use std::cmp;
+use std::fmt as strfmt;
+use std::iter::FromIterator;
+
+use fmt;
+use tendril::{Atomicity, NonAtomic, SubtendrilError, Tendril};
+
+type Tree<F, A> = Option<Box<Node<F, A>>>;
+
+struct Node<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    chunk: Tendril<F, A>,
+    left: Tree<F, A>,
+    right: Tree<F, A>,
+    height: u32,
+    len: u64,
+}
+
+/// A rope of `Tendril` chunks, with 64-bit length.
+///
+/// Chunks are never empty. Pushing an empty tendril is a no-op.
+pub struct Rope<F, A = NonAtomic>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    root: Tree<F, A>,
+}
+
+/// `Rope` of UTF-8 text.
+pub type StrRope = Rope<fmt::UTF8>;
+
+/// `Rope` of binary data.
+pub type ByteRope = Rope<fmt::Bytes>;
+
+#[inline]
+fn height<F, A>(t: &Tree<F, A>) -> u32
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    t.as_ref().map_or(0, |n| n.height)
+}
+
+#[inline]
+fn len<F, A>(t: &Tree<F, A>) -> u64
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    t.as_ref().map_or(0, |n| n.len)
+}
+
+#[inline]
+fn node<F, A>(left: Tree<F, A>, chunk: Tendril<F, A>, right: Tree<F, A>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    Box::new(Node {
+        height: 1 + cmp::max(height(&left), height(&right)),
+        len: len(&left) + chunk.len32() as u64 + len(&right),
+        chunk: chunk,
+        left: left,
+        right: right,
+    })
+}
+
+#[inline]
+fn expose<F, A>(n: Box<Node<F, A>>) -> (Tree<F, A>, Tendril<F, A>, Tree<F, A>)
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let n = *n;
+    (n.left, n.chunk, n.right)
+}
+
+fn rotate_left<F, A>(n: Box<Node<F, A>>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (l, k, r) = expose(n);
+    let (rl, rk, rr) = expose(r.expect("tendril: rope rotation without child"));
+    node(Some(node(l, k, rl)), rk, rr)
+}
+
+fn rotate_right<F, A>(n: Box<Node<F, A>>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (l, k, r) = expose(n);
+    let (ll, lk, lr) = expose(l.expect("tendril: rope rotation without child"));
+    node(ll, lk, Some(node(lr, k, r)))
+}
+
+// `join`, `split` and friends follow "Just Join for Parallel Ordered Sets"
+// (Blelloch, Ferizovic and Sun, 2016), specialized to AVL trees.
+
+fn join_right<F, A>(l: Box<Node<F, A>>, k: Tendril<F, A>, r: Tree<F, A>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (ll, lk, lr) = expose(l);
+    if height(&lr) <= height(&r) + 1 {
+        let t = node(lr, k, r);
+        if t.height <= height(&ll) + 1 {
+            node(ll, lk, Some(t))
+        } else {
+            rotate_left(node(ll, lk, Some(rotate_right(t))))
+        }
+    } else {
+        let t = join_right(lr.expect("tendril: unbalanced rope"), k, r);
+        let t_height = t.height;
+        let t = node(ll, lk, Some(t));
+        if t_height <= height(&t.left) + 1 {
+            t
+        } else {
+            rotate_left(t)
+        }
+    }
+}
+
+fn join_left<F, A>(l: Tree<F, A>, k: Tendril<F, A>, r: Box<Node<F, A>>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (rl, rk, rr) = expose(r);
+    if height(&rl) <= height(&l) + 1 {
+        let t = node(l, k, rl);
+        if t.height <= height(&rr) + 1 {
+            node(Some(t), rk, rr)
+        } else {
+            rotate_right(node(Some(rotate_left(t)), rk, rr))
+        }
+    } else {
+        let t = join_left(l, k, rl.expect("tendril: unbalanced rope"));
+        let t_height = t.height;
+        let t = node(Some(t), rk, rr);
+        if t_height <= height(&t.right) + 1 {
+            t
+        } else {
+            rotate_right(t)
+        }
+    }
+}
+
+/// Concatenate `l`, the chunk `k` and `r`.
+fn join<F, A>(l: Tree<F, A>, k: Tendril<F, A>, r: Tree<F, A>) -> Box<Node<F, A>>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (hl, hr) = (height(&l), height(&r));
+    if hl > hr + 1 {
+        join_right(l.unwrap(), k, r)
+    } else if hr > hl + 1 {
+        join_left(l, k, r.unwrap())
+    } else {
+        node(l, k, r)
+    }
+}
+
+/// Remove the last chunk of a non-empty tree.
+fn split_last<F, A>(n: Box<Node<F, A>>) -> (Tree<F, A>, Tendril<F, A>)
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (l, k, r) = expose(n);
+    match r {
+        None => (l, k),
+        Some(r) => {
+            let (r, last) = split_last(r);
+            (Some(join(l, k, r)), last)
+        }
+    }
+}
+
+/// Concatenate two trees.
+fn join2<F, A>(l: Tree<F, A>, r: Tree<F, A>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    match l {
+        None => r,
+        Some(l) => {
+            let (l, k) = split_last(l);
+            Some(join(l, k, r))
+        }
+    }
+}
+
+/// Split a tree at byte offset `at`.
+///
+/// Does not check validity or bounds!
+unsafe fn split<F, A>(t: Tree<F, A>, at: u64) -> (Tree<F, A>, Tree<F, A>)
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    let (l, k, r) = match t {
+        None => return (None, None),
+        Some(n) => expose(n),
+    };
+
+    let left_len = len(&l);
+    let chunk_len = k.len32() as u64;
+    if at <= left_len {
+        let (a, b) = split(l, at);
+        (a, Some(join(b, k, r)))
+    } else if at >= left_len + chunk_len {
+        let (a, b) = split(r, at - left_len - chunk_len);
+        (Some(join(l, k, a)), b)
+    } else {
+        let off = (at - left_len) as u32;
+        let front = k.unsafe_subtendril(0, off);
+        let back = k.unsafe_subtendril(off, chunk_len as u32 - off);
+        (Some(join(l, front, None)), Some(join(None, back, r)))
+    }
+}
+
+impl<F, A> Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Create a new, empty `Rope`.
+    #[inline]
+    pub fn new() -> Rope<F, A> {
+        Rope { root: None }
+    }
+
+    /// Get the length of the `Rope` in bytes.
+    #[inline]
+    pub fn len(&self) -> u64 {
+        len(&self.root)
+    }
+
+    /// Is the `Rope` empty?
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.root.is_none()
+    }
+
+    /// Remove all chunks.
+    #[inline]
+    pub fn clear(&mut self) {
+        self.root = None;
+    }
+
+    /// Append a tendril as the last chunk.
+    #[inline]
+    pub fn push_back(&mut self, t: Tendril<F, A>) {
+        if t.len32() == 0 {
+            return;
+        }
+        self.root = Some(join(self.root.take(), t, None));
+    }
+
+    /// Prepend a tendril as the first chunk.
+    #[inline]
+    pub fn push_front(&mut self, t: Tendril<F, A>) {
+        if t.len32() == 0 {
+            return;
+        }
+        self.root = Some(join(None, t, self.root.take()));
+    }
+
+    /// Move all chunks of `other` onto the end of this `Rope`, leaving
+    /// `other` empty.
+    #[inline]
+    pub fn append(&mut self, other: &mut Rope<F, A>) {
+        self.root = join2(self.root.take(), other.root.take());
+    }
+
+    /// Check that `at` is in bounds and falls on a boundary of the format.
+    fn check_boundary(&self, at: u64) -> Result<(), SubtendrilError> {
+        if at > self.len() {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        match self.chunk_at(at) {
+            Some((chunk, start)) if start < at => {
+                let off = (at - start) as u32;
+                let bytes = chunk.as_bytes();
+                if F::validate_prefix(&bytes[..off as usize])
+                    && F::validate_suffix(&bytes[off as usize..])
+                {
+                    Ok(())
+                } else {
+                    Err(SubtendrilError::ValidationFailed)
+                }
+            }
+            _ => Ok(()),
+        }
+    }
+
+    /// Try to split the `Rope` in two at the given byte offset. Returns
+    /// everything after `at`, leaving everything before it in `self`.
+    ///
+    /// The function will return `Err` if `at` is out of bounds, or if the
+    /// chunk which contains `at` cannot be split there in this format.
+    #[inline]
+    pub fn try_split_off(&mut self, at: u64) -> Result<Rope<F, A>, SubtendrilError> {
+        self.check_boundary(at)?;
+        let (front, back) = unsafe { split(self.root.take(), at) };
+        self.root = front;
+        Ok(Rope { root: back })
+    }
+
+    /// Split the `Rope` in two at the given byte offset.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn split_off(&mut self, at: u64) -> Rope<F, A> {
+        self.try_split_off(at).unwrap()
+    }
+
+    /// Try to insert a tendril at the given byte offset.
+    #[inline]
+    pub fn try_insert(&mut self, at: u64, t: Tendril<F, A>) -> Result<(), SubtendrilError> {
+        self.check_boundary(at)?;
+        let (front, back) = unsafe { split(self.root.take(), at) };
+        self.root = if t.len32() == 0 {
+            join2(front, back)
+        } else {
+            Some(join(front, t, back))
+        };
+        Ok(())
+    }
+
+    /// Insert a tendril at the given byte offset.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn insert(&mut self, at: u64, t: Tendril<F, A>) {
+        self.try_insert(at, t).unwrap()
+    }
+
+    /// Try to remove `length` bytes starting at `offset`.
+    #[inline]
+    pub fn try_remove(&mut self, offset: u64, length: u64) -> Result<(), SubtendrilError> {
+        let end = offset
+            .checked_add(length)
+            .ok_or(SubtendrilError::OutOfBounds)?;
+        self.check_boundary(offset)?;
+        self.check_boundary(end)?;
+        unsafe {
+            let (front, rest) = split(self.root.take(), offset);
+            let (_, back) = split(rest, length);
+            self.root = join2(front, back);
+        }
+        Ok(())
+    }
+
+    /// Remove `length` bytes starting at `offset`.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn remove(&mut self, offset: u64, length: u64) {
+        self.try_remove(offset, length).unwrap()
+    }
+
+    /// Find the chunk containing the byte at `offset`, and the offset at
+    /// which that chunk starts.
+    pub fn chunk_at(&self, mut offset: u64) -> Option<(&Tendril<F, A>, u64)> {
+        let mut start = 0;
+        let mut t = &self.root;
+        while let Some(ref n) = *t {
+            let left_len = len(&n.left);
+            if offset < left_len {
+                t = &n.left;
+            } else if offset - left_len < n.chunk.len32() as u64 {
+                return Some((&n.chunk, start + left_len));
+            } else {
+                let skip = left_len + n.chunk.len32() as u64;
+                offset -= skip;
+                start += skip;
+                t = &n.right;
+            }
+        }
+        None
+    }
+
+    /// Iterate over the chunks of the `Rope`, in order.
+    #[inline]
+    pub fn chunks<'a>(&'a self) -> Chunks<'a, F, A> {
+        let mut chunks = Chunks { stack: vec![] };
+        chunks.descend(&self.root);
+        chunks
+    }
+
+    /// Concatenate the chunks into a single `Tendril`.
+    ///
+    /// This is free for a `Rope` of one chunk. Panics if the result would
+    /// be longer than 4 GB.
+    pub fn to_tendril(&self) -> Tendril<F, A> {
+        let mut chunks = self.chunks();
+        let mut t = match chunks.next() {
+            None => return Tendril::new(),
+            Some(t) => t.clone(),
+        };
+        for c in chunks {
+            t.push_tendril(c);
+        }
+        t
+    }
+}
+
+/// Iterator over the chunks of a `Rope`.
+pub struct Chunks<'a, F, A>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+{
+    stack: Vec<&'a Node<F, A>>,
+}
+
+impl<'a, F, A> Chunks<'a, F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn descend(&mut self, mut t: &'a Tree<F, A>) {
+        while let Some(ref n) = *t {
+            self.stack.push(n);
+            t = &n.left;
+        }
+    }
+}
+
+impl<'a, F, A> Iterator for Chunks<'a, F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    type Item = &'a Tendril<F, A>;
+
+    #[inline]
+    fn next(&mut self) -> Option<&'a Tendril<F, A>> {
+        let n = unwrap_or_return!(self.stack.pop(), None);
+        self.descend(&n.right);
+        Some(&n.chunk)
+    }
+}
+
+fn clone_tree<F, A>(t: &Tree<F, A>) -> Tree<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    t.as_ref().map(|n| {
+        Box::new(Node {
+            chunk: n.chunk.clone(),
+            left: clone_tree(&n.left),
+            right: clone_tree(&n.right),
+            height: n.height,
+            len: n.len,
+        })
+    })
+}
+
+impl<F, A> Clone for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Copy the tree structure, sharing every chunk.
+    #[inline]
+    fn clone(&self) -> Rope<F, A> {
+        Rope {
+            root: clone_tree(&self.root),
+        }
+    }
+}
+
+impl<F, A> Default for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn default() -> Rope<F, A> {
+        Rope::new()
+    }
+}
+
+impl<F, A> From<Tendril<F, A>> for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn from(t: Tendril<F, A>) -> Rope<F, A> {
+        let mut rope = Rope::new();
+        rope.push_back(t);
+        rope
+    }
+}
+
+impl<F, A> Extend<Tendril<F, A>> for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn extend<I>(&mut self, iterable: I)
+    where
+        I: IntoIterator<Item = Tendril<F, A>>,
+    {
+        for t in iterable {
+            self.push_back(t);
+        }
+    }
+}
+
+impl<F, A> FromIterator<Tendril<F, A>> for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    #[inline]
+    fn from_iter<I>(iterable: I) -> Rope<F, A>
+    where
+        I: IntoIterator<Item = Tendril<F, A>>,
+    {
+        let mut rope = Rope::new();
+        rope.extend(iterable);
+        rope
+    }
+}
+
+impl<F, A> PartialEq for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// Compare contents, regardless of how they are split into chunks.
+    fn eq(&self, other: &Rope<F, A>) -> bool {
+        if self.len() != other.len() {
+            return false;
+        }
+        let mut lhs = self.chunks().map(|t| t.as_bytes());
+        let mut rhs = other.chunks().map(|t| t.as_bytes());
+        let (mut a, mut b): (&[u8], &[u8]) = (&[], &[]);
+        loop {
+            if a.is_empty() {
+                a = match lhs.next() {
+                    Some(t) => &**t,
+                    None => return b.is_empty() && rhs.next().is_none(),
+                };
+            }
+            if b.is_empty() {
+                b = match rhs.next() {
+                    Some(t) => &**t,
+                    None => return false,
+                };
+            }
+            let n = cmp::min(a.len(), b.len());
+            if a[..n] != b[..n] {
+                return false;
+            }
+            a = &a[n..];
+            b = &b[n..];
+        }
+    }
+}
+
+impl<F, A> Eq for Rope<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+}
+
+impl<F, A> strfmt::Debug for Rope<F, A>
+where
+    F: fmt::SliceFormat + Default + strfmt::Debug,
+    <F as fmt::SliceFormat>::Slice: strfmt::Debug,
+    A: Atomicity,
+{
+    fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
+        write!(f, "Rope<{:?}>(", <F as Default>::default())?;
+        f.debug_list()
+            .entries(self.chunks().map(|t| &**t))
+            .finish()?;
+        write!(f, ")")
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{height, ByteRope, Rope, StrRope};
+    use fmt;
+    use tendril::{SliceExt, StrTendril, SubtendrilError};
+
+    fn contents(r: &StrRope) -> String {
+        r.chunks().map(|t| &**t).collect()
+    }
+
+    #[test]
+    fn smoke_test() {
+        let mut r = StrRope::new();
+        assert!(r.is_empty());
+        r.push_back("Hello, ".to_tendril());
+        r.push_back("world!".to_tendril());
+        r.push_front(">> ".to_tendril());
+        r.push_back(StrTendril::new());
+        assert_eq!(16, r.len());
+        assert_eq!(3, r.chunks().count());
+        assert_eq!(">> Hello, world!", &*contents(&r));
+        assert_eq!(">> Hello, world!", &*r.to_tendril());
+    }
+
+    #[test]
+    fn split_shares_buffers() {
+        let t = "Hello, tendril world".to_tendril();
+        let mut r = Rope::from(t.clone());
+        let back = r.split_off(14);
+        assert_eq!("Hello, tendril", &*contents(&r));
+        assert_eq!(" world", &*contents(&back));
+
+        let front = r.chunks().next().unwrap();
+        assert!(front.is_shared_with(&t));
+        assert_eq!(t.as_ptr(), front.as_ptr());
+    }
+
+    #[test]
+    fn insert_and_remove() {
+        let mut r: StrRope = Rope::from("Hello world".to_tendril());
+        r.insert(5, ",".to_tendril());
+        r.insert(12, "!".to_tendril());
+        r.insert(0, "Oh, ".to_tendril());
+        assert_eq!("Oh, Hello, world!", &*contents(&r));
+
+        r.remove(4, 7);
+        assert_eq!("Oh, world!", &*contents(&r));
+        r.remove(0, r.len());
+        assert!(r.is_empty());
+    }
+
+    #[test]
+    fn boundaries() {
+        let mut r: StrRope = Rope::from("\u{a66e}\u{a66e}".to_tendril());
+        assert_eq!(
+            Err(SubtendrilError::ValidationFailed),
+            r.try_split_off(1).map(|_| ())
+        );
+        assert_eq!(Err(SubtendrilError::ValidationFailed), r.try_remove(3, 1));
+        assert_eq!(
+            Err(SubtendrilError::OutOfBounds),
+            r.try_insert(7, "x".to_tendril())
+        );
+        assert_eq!("\u{a66e}\u{a66e}", &*contents(&r));
+
+        let back = r.split_off(3);
+        assert_eq!("\u{a66e}", &*contents(&r));
+        assert_eq!("\u{a66e}", &*contents(&back));
+    }
+
+    #[test]
+    fn append_and_compare() {
+        let mut a: ByteRope = vec![b"foo".to_tendril(), b"bar".to_tendril()]
+            .into_iter()
+            .collect();
+        let mut b: Rope<fmt::Bytes> = Rope::from(b"baz".to_tendril());
+        a.append(&mut b);
+        assert!(b.is_empty());
+
+        let c: ByteRope = vec![
+            b"fo".to_tendril(),
+            b"obarba".to_tendril(),
+            b"z".to_tendril(),
+        ]
+        .into_iter()
+        .collect();
+        assert_eq!(a, c);
+        assert!(a != Rope::from(b"foobarbaZ".to_tendril()));
+        assert_eq!(b"foobarbaz", &*a.to_tendril());
+    }
+
+    #[test]
+    fn chunk_at() {
+        let r: StrRope = vec!["ab".to_tendril(), "cde".to_tendril(), "f".to_tendril()]
+            .into_iter()
+            .collect();
+        assert_eq!(Some(("ab", 0)), r.chunk_at(1).map(|(t, s)| (&**t, s)));
+        assert_eq!(Some(("cde", 2)), r.chunk_at(2).map(|(t, s)| (&**t, s)));
+        assert_eq!(Some(("f", 5)), r.chunk_at(5).map(|(t, s)| (&**t, s)));
+        assert!(r.chunk_at(6).is_none());
+    }
+
+    #[test]
+    fn stays_balanced() {
+        let mut r = StrRope::new();
+        for i in 0..1000 {
+            r.push_back(StrTendril::from(format!("{} ", i)));
+            r.push_front(StrTendril::from(format!("{} ", i)));
+        }
+        assert_eq!(2000, r.chunks().count());
+        // An AVL tree with n nodes has height below 1.45 * log2(n + 2).
+        assert!(height(&r.root) <= 16);
+
+        let mut pieces = vec![];
+        while r.len() > 100 {
+            let at = r.len() / 2;
+            let at = r.chunk_at(at).unwrap().1;
+            pieces.push(r.split_off(at));
+            assert!(height(&r.root) <= 16);
+        }
+        let total: u64 = pieces.iter().map(|p| p.len()).sum();
+        assert!(total > 0);
+    }
+}
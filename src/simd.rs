@@ -0,0 +1,430 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Vectorized kernels over byte slices.
+//!
+//! On x86 and x86-64, these use SSE2, or AVX2 where the CPU has it, as
+//! detected at run time. Elsewhere they work a word at a time.
+
+use std::{cmp, ptr};
+
+/// Slices shorter than this are not worth checking for AVX2.
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+const AVX2_MIN_LEN: usize = 64;
+
+/// The index of the first byte at which `a` and `b` differ, or `None` if
+/// they are equal. If one is a prefix of the other, this is the length of
+/// the shorter.
+#[inline]
+pub fn mismatch(a: &[u8], b: &[u8]) -> Option<usize> {
+    let len = cmp::min(a.len(), b.len());
+    let i = unsafe { mismatch_raw(a.as_ptr(), b.as_ptr(), len) };
+    if i < len || a.len() != b.len() {
+        Some(i)
+    } else {
+        None
+    }
+}
+
+/// The index of the first of `len` bytes at which `a` and `b` differ, or
+/// `len`.
+#[inline]
+unsafe fn mismatch_raw(a: *const u8, b: *const u8, len: usize) -> usize {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        if len >= AVX2_MIN_LEN && is_x86_feature_detected!("avx2") {
+            return x86::mismatch_avx2(a, b, len);
+        }
+        if is_x86_feature_detected!("sse2") {
+            return x86::mismatch_sse2(a, b, len);
+        }
+    }
+    mismatch_words(a, b, len)
+}
+
+/// `mismatch_raw` a word at a time, for any target.
+#[inline]
+unsafe fn mismatch_words(a: *const u8, b: *const u8, len: usize) -> usize {
+    let mut i = 0;
+    while i + 8 <= len {
+        let x = ptr::read_unaligned(a.add(i) as *const u64);
+        let y = ptr::read_unaligned(b.add(i) as *const u64);
+        let diff = x ^ y;
+        if diff != 0 {
+            let bits = if cfg!(target_endian = "little") {
+                diff.trailing_zeros()
+            } else {
+                diff.leading_zeros()
+            };
+            return i + (bits / 8) as usize;
+        }
+        i += 8;
+    }
+    while i < len && *a.add(i) == *b.add(i) {
+        i += 1;
+    }
+    i
+}
+
+/// The index of the first `needle` in `haystack`, or `None`.
+#[inline]
+pub fn memchr(needle: u8, haystack: &[u8]) -> Option<usize> {
+    let len = haystack.len();
+    let i = unsafe { memchr_raw(needle, haystack.as_ptr(), len) };
+    if i < len {
+        Some(i)
+    } else {
+        None
+    }
+}
+
+/// The index of the first `needle` in `len` bytes at `p`, or `len`.
+#[inline]
+unsafe fn memchr_raw(needle: u8, p: *const u8, len: usize) -> usize {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        if len >= AVX2_MIN_LEN && is_x86_feature_detected!("avx2") {
+            return x86::memchr_avx2(needle, p, len);
+        }
+        if is_x86_feature_detected!("sse2") {
+            return x86::memchr_sse2(needle, p, len);
+        }
+    }
+    memchr_words(needle, p, len)
+}
+
+/// `memchr_raw` a word at a time, for any target.
+#[inline]
+unsafe fn memchr_words(needle: u8, p: *const u8, len: usize) -> usize {
+    const LO: u64 = 0x0101_0101_0101_0101;
+    const HI: u64 = 0x8080_8080_8080_8080;
+    let repeated = LO * needle as u64;
+    let mut i = 0;
+    while i + 8 <= len {
+        let x = ptr::read_unaligned(p.add(i) as *const u64) ^ repeated;
+        // Nonzero iff some byte of `x` is zero.
+        if x.wrapping_sub(LO) & !x & HI != 0 {
+            break;
+        }
+        i += 8;
+    }
+    while i < len && *p.add(i) != needle {
+        i += 1;
+    }
+    i
+}
+
+/// A set of ASCII bytes, laid out for classifying many bytes at once, as by
+/// `Tendril::pop_front_set_run`.
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub struct AsciiSet {
+    /// Bit `hi` of entry `lo` is set if the byte `hi << 4 | lo` is in the
+    /// set.
+    table: [u8; 16],
+}
+
+impl AsciiSet {
+    /// ASCII whitespace, as for `char::is_whitespace`: tab, line feed,
+    /// vertical tab, form feed, carriage return and space.
+    pub const WHITESPACE: AsciiSet = AsciiSet {
+        table: [4, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0],
+    };
+
+    /// The empty set.
+    #[inline]
+    pub const fn new() -> AsciiSet {
+        AsciiSet { table: [0; 16] }
+    }
+
+    /// The set of the given bytes.
+    ///
+    /// Panics if any of them is not ASCII.
+    pub fn from_bytes(bytes: &[u8]) -> AsciiSet {
+        bytes.iter().fold(AsciiSet::new(), |set, &b| set.with(b))
+    }
+
+    /// This set with `b` added.
+    ///
+    /// Panics if `b` is not ASCII.
+    #[inline]
+    pub fn with(mut self, b: u8) -> AsciiSet {
+        assert!(b < 0x80, "tendril: AsciiSet byte is not ASCII");
+        self.table[(b & 0xF) as usize] |= 1 << (b >> 4);
+        self
+    }
+
+    /// Is `b` in the set? Bytes which are not ASCII never are.
+    #[inline]
+    pub fn contains(&self, b: u8) -> bool {
+        // Shifting by the high nibble of a non-ASCII byte leaves nothing.
+        (self.table[(b & 0xF) as usize] as u32 >> (b >> 4)) & 1 != 0
+    }
+}
+
+/// The index of the first byte of `haystack` which is not ASCII, or whose
+/// membership of `set` is not `member`, or the length if there is none.
+#[inline]
+pub fn ascii_run(set: &AsciiSet, member: bool, haystack: &[u8]) -> usize {
+    let len = haystack.len();
+    let p = haystack.as_ptr();
+    unsafe {
+        // Runs of text are mostly short, so look at the first few bytes
+        // before going to the trouble of loading vectors.
+        let head = cmp::min(len, 8);
+        let i = ascii_run_bytes(set, member, p, head);
+        if i < head {
+            return i;
+        }
+        head + ascii_run_raw(set, member, p.add(head), len - head)
+    }
+}
+
+/// `ascii_run` on `len` bytes at `p`.
+#[inline]
+unsafe fn ascii_run_raw(set: &AsciiSet, member: bool, p: *const u8, len: usize) -> usize {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        if len >= AVX2_MIN_LEN && is_x86_feature_detected!("avx2") {
+            return x86::ascii_run_avx2(&set.table, member, p, len);
+        }
+        if is_x86_feature_detected!("ssse3") {
+            return x86::ascii_run_ssse3(&set.table, member, p, len);
+        }
+    }
+    ascii_run_bytes(set, member, p, len)
+}
+
+/// `ascii_run` a byte at a time, for any target.
+#[inline]
+unsafe fn ascii_run_bytes(set: &AsciiSet, member: bool, p: *const u8, len: usize) -> usize {
+    let mut i = 0;
+    while i < len {
+        let b = *p.add(i);
+        if set.contains(b) != member || b >= 0x80 {
+            break;
+        }
+        i += 1;
+    }
+    i
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+mod x86 {
+    #[cfg(target_arch = "x86")]
+    use std::arch::x86::*;
+    #[cfg(target_arch = "x86_64")]
+    use std::arch::x86_64::*;
+
+    #[target_feature(enable = "sse2")]
+    pub unsafe fn mismatch_sse2(a: *const u8, b: *const u8, len: usize) -> usize {
+        let mut i = 0;
+        while i + 16 <= len {
+            let x = _mm_loadu_si128(a.add(i) as *const __m128i);
+            let y = _mm_loadu_si128(b.add(i) as *const __m128i);
+            let equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) as u32;
+            if equal != 0xFFFF {
+                return i + (!equal).trailing_zeros() as usize;
+            }
+            i += 16;
+        }
+        i + super::mismatch_words(a.add(i), b.add(i), len - i)
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn mismatch_avx2(a: *const u8, b: *const u8, len: usize) -> usize {
+        let mut i = 0;
+        while i + 32 <= len {
+            let x = _mm256_loadu_si256(a.add(i) as *const __m256i);
+            let y = _mm256_loadu_si256(b.add(i) as *const __m256i);
+            let equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) as u32;
+            if equal != 0xFFFF_FFFF {
+                return i + (!equal).trailing_zeros() as usize;
+            }
+            i += 32;
+        }
+        i + mismatch_sse2(a.add(i), b.add(i), len - i)
+    }
+
+    #[target_feature(enable = "sse2")]
+    pub unsafe fn memchr_sse2(needle: u8, p: *const u8, len: usize) -> usize {
+        let repeated = _mm_set1_epi8(needle as i8);
+        let mut i = 0;
+        while i + 16 <= len {
+            let x = _mm_loadu_si128(p.add(i) as *const __m128i);
+            let found = _mm_movemask_epi8(_mm_cmpeq_epi8(x, repeated)) as u32;
+            if found != 0 {
+                return i + found.trailing_zeros() as usize;
+            }
+            i += 16;
+        }
+        i + super::memchr_words(needle, p.add(i), len - i)
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn memchr_avx2(needle: u8, p: *const u8, len: usize) -> usize {
+        let repeated = _mm256_set1_epi8(needle as i8);
+        let mut i = 0;
+        while i + 32 <= len {
+            let x = _mm256_loadu_si256(p.add(i) as *const __m256i);
+            let found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, repeated)) as u32;
+            if found != 0 {
+                return i + found.trailing_zeros() as usize;
+            }
+            i += 32;
+        }
+        i + memchr_sse2(needle, p.add(i), len - i)
+    }
+
+    // For set membership, `pshufb` looks up the low nibble of each byte in
+    // the table, and its high nibble in `hi_bits` for the bit to test.
+    // Non-ASCII bytes have a high nibble of 8 or more, which has no bit.
+
+    #[target_feature(enable = "ssse3")]
+    pub unsafe fn ascii_run_ssse3(
+        table: &[u8; 16],
+        member: bool,
+        p: *const u8,
+        len: usize,
+    ) -> usize {
+        let lo_bits = _mm_loadu_si128(table.as_ptr() as *const __m128i);
+        let hi_bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+        let nibble = _mm_set1_epi8(0x0F);
+        let zero = _mm_setzero_si128();
+        let mut i = 0;
+        while i + 16 <= len {
+            let x = _mm_loadu_si128(p.add(i) as *const __m128i);
+            let lo = _mm_shuffle_epi8(lo_bits, _mm_and_si128(x, nibble));
+            let hi = _mm_shuffle_epi8(hi_bits, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+            let absent = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) as u32;
+            let stop = if member {
+                absent
+            } else {
+                (!absent & 0xFFFF) | _mm_movemask_epi8(x) as u32
+            };
+            if stop != 0 {
+                return i + stop.trailing_zeros() as usize;
+            }
+            i += 16;
+        }
+        let set = super::AsciiSet { table: *table };
+        i + super::ascii_run_bytes(&set, member, p.add(i), len - i)
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn ascii_run_avx2(
+        table: &[u8; 16],
+        member: bool,
+        p: *const u8,
+        len: usize,
+    ) -> usize {
+        let lo_bits =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(table.as_ptr() as *const __m128i));
+        let hi_bits = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+            1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+        ));
+        let nibble = _mm256_set1_epi8(0x0F);
+        let zero = _mm256_setzero_si256();
+        let mut i = 0;
+        while i + 32 <= len {
+            let x = _mm256_loadu_si256(p.add(i) as *const __m256i);
+            let lo = _mm256_shuffle_epi8(lo_bits, _mm256_and_si256(x, nibble));
+            let hi =
+                _mm256_shuffle_epi8(hi_bits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+            let absent =
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero)) as u32;
+            let stop = if member {
+                absent
+            } else {
+                !absent | _mm256_movemask_epi8(x) as u32
+            };
+            if stop != 0 {
+                return i + stop.trailing_zeros() as usize;
+            }
+            i += 32;
+        }
+        i + ascii_run_ssse3(table, member, p.add(i), len - i)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{ascii_run, ascii_run_bytes, AsciiSet};
+    use super::{memchr, memchr_words, mismatch, mismatch_words};
+
+    #[test]
+    fn mismatch_all_positions() {
+        let a: Vec<u8> = (0..200).map(|i| i as u8).collect();
+        assert_eq!(None, mismatch(&a, &a.clone()));
+        for i in 0..a.len() {
+            let mut b = a.clone();
+            b[i] ^= 0x80;
+            assert_eq!(Some(i), mismatch(&a, &b));
+            assert_eq!(Some(i), mismatch(&a[..i], &b));
+            assert_eq!(i, unsafe {
+                mismatch_words(a.as_ptr(), b.as_ptr(), a.len())
+            });
+        }
+        assert_eq!(Some(0), mismatch(b"", b"x"));
+        assert_eq!(None, mismatch(b"", b""));
+    }
+
+    #[test]
+    fn memchr_all_positions() {
+        let a: Vec<u8> = (0..200).map(|i| (i % 100 + 1) as u8).collect();
+        assert_eq!(None, memchr(0, &a));
+        for i in 0..a.len() {
+            let mut b = a.clone();
+            b[i] = 0;
+            assert_eq!(Some(i), memchr(0, &b));
+            assert_eq!(None, memchr(0, &b[..i]));
+            assert_eq!(i, unsafe { memchr_words(0, b.as_ptr(), b.len()) });
+            assert_eq!(Some(i % 100), memchr(a[i], &a));
+        }
+        assert_eq!(None, memchr(b'x', b""));
+    }
+
+    #[test]
+    fn ascii_set() {
+        let set = AsciiSet::from_bytes(b"\x00 ,\x7F");
+        for b in 0..=255u8 {
+            assert_eq!(b"\x00 ,\x7F".contains(&b), set.contains(b));
+            assert_eq!(
+                (b as char).is_whitespace() && b < 0x80,
+                AsciiSet::WHITESPACE.contains(b)
+            );
+        }
+        assert_eq!(
+            AsciiSet::from_bytes(b"\t\n\x0B\x0C\r "),
+            AsciiSet::WHITESPACE
+        );
+    }
+
+    #[test]
+    fn ascii_run_all_positions() {
+        let set = AsciiSet::from_bytes(b" ,");
+        let words: Vec<u8> = (0..200).map(|i| b'a' + (i % 26) as u8).collect();
+        let spaces: Vec<u8> = (0..200).map(|i| b" ,"[i % 2]).collect();
+        assert_eq!(200, ascii_run(&set, false, &words));
+        assert_eq!(200, ascii_run(&set, true, &spaces));
+        for i in 0..200 {
+            for &(a, b) in &[
+                (&words, b','),
+                (&words, 0xC3),
+                (&spaces, b'x'),
+                (&spaces, 0xA0),
+            ] {
+                let member = a[0] == b' ';
+                let mut a = a.clone();
+                a[i] = b;
+                assert_eq!(i, ascii_run(&set, member, &a));
+                assert_eq!(i, unsafe {
+                    ascii_run_bytes(&set, member, a.as_ptr(), a.len())
+                });
+                assert_eq!(i, ascii_run(&set, member, &a[..i + 1]));
+            }
+        }
+    }
+}
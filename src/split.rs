@@ -0,0 +1,231 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Iterators which split a `Tendril` into subtendrils.
+//!
+//! Each piece shares the buffer of the `Tendril` it came from, or is stored
+//! in-line if it is short, so splitting never copies the contents.
+
+use fmt;
+use simd;
+
+use super::{Allocator, Atomicity, InlineCapacity, Tendril};
+
+impl<F, A, I, Al> Tendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Iterate over the pieces of this `Tendril` separated by the byte
+    /// `delim`, like `str::split` with a single-byte pattern.
+    ///
+    /// An occurrence of `delim` which is part of a larger character of the
+    /// format does not separate pieces. For `UTF8`, that can only happen
+    /// when `delim` is not ASCII.
+    #[inline]
+    pub fn split_byte<'a>(&'a self, delim: u8) -> SplitByte<'a, F, A, I, Al> {
+        SplitByte {
+            tendril: self,
+            delim: delim,
+            start: 0,
+            finished: false,
+        }
+    }
+
+    /// Iterate over the lines of this `Tendril`, like `str::lines`.
+    ///
+    /// Lines end with `\n` or `\r\n`, which are not part of the line. A
+    /// line ending at the very end does not begin another, empty, line.
+    #[inline]
+    pub fn lines<'a>(&'a self) -> Lines<'a, F, A, I, Al> {
+        Lines {
+            inner: self.split_byte(b'\n'),
+        }
+    }
+}
+
+impl<F, A, I, Al> Tendril<F, A, I, Al>
+where
+    F: for<'a> fmt::CharFormat<'a>,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Iterate over the pieces of this `Tendril` separated by characters
+    /// which match `pred`, like `str::split` with a closure.
+    #[inline]
+    pub fn split_char<'a, P>(&'a self, pred: P) -> SplitChar<'a, F, A, I, Al, P>
+    where
+        P: FnMut(char) -> bool,
+    {
+        SplitChar {
+            tendril: self,
+            chars: unsafe { F::char_indices(self.as_byte_slice()) },
+            pred: pred,
+            start: Some(0),
+            finished: false,
+        }
+    }
+}
+
+/// An iterator over the pieces of a `Tendril` between delimiter bytes.
+///
+/// See `Tendril::split_byte`.
+pub struct SplitByte<'a, F, A, I, Al>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+{
+    tendril: &'a Tendril<F, A, I, Al>,
+    delim: u8,
+    start: u32,
+    finished: bool,
+}
+
+impl<'a, F, A, I, Al> Iterator for SplitByte<'a, F, A, I, Al>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+{
+    type Item = Tendril<F, A, I, Al>;
+
+    fn next(&mut self) -> Option<Tendril<F, A, I, Al>> {
+        if self.finished {
+            return None;
+        }
+        let bytes = self.tendril.as_byte_slice();
+        let start = self.start as usize;
+        let mut from = start;
+        let end = loop {
+            match simd::memchr(self.delim, &bytes[from..]) {
+                None => {
+                    self.finished = true;
+                    break bytes.len();
+                }
+                Some(i) => {
+                    let at = from + i;
+                    // The piece begins on a cut, so it is valid if the
+                    // delimiter is a whole character.
+                    if F::validate_delimiter(bytes, at) {
+                        self.start = at as u32 + 1;
+                        break at;
+                    }
+                    from = at + 1;
+                }
+            }
+        };
+        unsafe {
+            Some(
+                self.tendril
+                    .unsafe_subtendril(start as u32, (end - start) as u32),
+            )
+        }
+    }
+}
+
+/// An iterator over the lines of a `Tendril`.
+///
+/// See `Tendril::lines`.
+pub struct Lines<'a, F, A, I, Al>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+{
+    inner: SplitByte<'a, F, A, I, Al>,
+}
+
+impl<'a, F, A, I, Al> Iterator for Lines<'a, F, A, I, Al>
+where
+    F: fmt::Format + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+{
+    type Item = Tendril<F, A, I, Al>;
+
+    fn next(&mut self) -> Option<Tendril<F, A, I, Al>> {
+        let mut line = self.inner.next()?;
+        if self.inner.finished {
+            // Nothing follows the last line ending.
+            if line.len32() == 0 {
+                return None;
+            }
+        } else {
+            let bytes = line.as_byte_slice();
+            let len = bytes.len();
+            if len > 0 && bytes[len - 1] == b'\r' && F::validate_delimiter(bytes, len - 1) {
+                unsafe {
+                    line.unsafe_pop_back(1);
+                }
+            }
+        }
+        Some(line)
+    }
+}
+
+/// An iterator over the pieces of a `Tendril` between characters which
+/// match a predicate.
+///
+/// See `Tendril::split_char`.
+pub struct SplitChar<'a, F, A, I, Al, P>
+where
+    F: fmt::CharFormat<'a> + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+{
+    tendril: &'a Tendril<F, A, I, Al>,
+    chars: F::Iter,
+    pred: P,
+    // `None` just after a separator, until the next character shows where
+    // the following piece begins.
+    start: Option<u32>,
+    finished: bool,
+}
+
+impl<'a, F, A, I, Al, P> Iterator for SplitChar<'a, F, A, I, Al, P>
+where
+    F: fmt::CharFormat<'a> + 'a,
+    A: Atomicity + 'a,
+    I: InlineCapacity + 'a,
+    Al: Allocator + 'a,
+    P: FnMut(char) -> bool,
+{
+    type Item = Tendril<F, A, I, Al>;
+
+    fn next(&mut self) -> Option<Tendril<F, A, I, Al>> {
+        if self.finished {
+            return None;
+        }
+        let len = self.tendril.len32();
+        let (start, end) = loop {
+            match self.chars.next() {
+                None => {
+                    self.finished = true;
+                    break (self.start.unwrap_or(len), len);
+                }
+                Some((i, c)) => {
+                    let i = i as u32;
+                    let start = *self.start.get_or_insert(i);
+                    if (self.pred)(c) {
+                        self.start = None;
+                        break (start, i);
+                    }
+                }
+            }
+        };
+        // Character boundaries are always cuts.
+        unsafe { Some(self.tendril.unsafe_subtendril(start, end - start)) }
+    }
+}
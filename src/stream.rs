@@ -7,13 +7,16 @@
 //! Streams of tendrils.
 
 use fmt;
-use tendril::{Atomicity, NonAtomic, Tendril};
+use tendril::{Atomicity, BlockReader, Blocks, NonAtomic, Tendril, TendrilPool};
 
 use std::borrow::Cow;
 use std::fs::File;
+use std::future::Future;
 use std::io;
 use std::marker::PhantomData;
 use std::path::Path;
+use std::pin::Pin;
+use std::task::{Context, Poll};
 
 #[cfg(feature = "encoding")]
 use encoding;
@@ -46,6 +49,18 @@ where
     /// Indicates the end of the stream.
     fn finish(self) -> Self::Output;
 
+    /// Whether the sink is ready to process another tendril, for
+    /// `read_from_async`. If it is not, it arranges for the task in `cx` to
+    /// be woken once it is, and nothing more is read until then.
+    ///
+    /// A sink which passes tendrils on should ask the next sink. By
+    /// default, a sink is always ready.
+    #[inline]
+    fn poll_ready(&mut self, cx: &mut Context) -> Poll<()> {
+        let _ = cx;
+        Poll::Ready(())
+    }
+
     /// Process one tendril and finish.
     fn one<T>(mut self, t: T) -> Self::Output
     where
@@ -71,34 +86,80 @@ where
 
     /// Read from the given stream of bytes until exhaustion and process incrementally,
     /// then finish. Return `Err` at the first I/O error.
-    fn read_from<R>(mut self, r: &mut R) -> io::Result<Self::Output>
+    ///
+    /// The tendrils are read into buffers from a `TendrilPool`, so a sink
+    /// which drops them soon after processing lets their buffers be reused.
+    ///
+    /// These tendrils are always shared, so a sink which appends to or
+    /// otherwise mutates one copies it first. Earlier versions gave each
+    /// read an owned tendril, which could be changed in place.
+    fn read_from<R>(self, r: &mut R) -> io::Result<Self::Output>
+    where
+        Self: Sized,
+        R: io::Read,
+        F: fmt::SliceFormat<Slice = [u8]>,
+    {
+        self.read_from_pool(r, &TendrilPool::new())
+    }
+
+    /// Like `read_from`, but with buffers from a given `TendrilPool`, which
+    /// can be shared between streams.
+    ///
+    /// Reads which return less than a full buffer share one, as with a
+    /// `BlockReader`.
+    fn read_from_pool<R>(mut self, r: &mut R, pool: &TendrilPool<A>) -> io::Result<Self::Output>
     where
         Self: Sized,
         R: io::Read,
         F: fmt::SliceFormat<Slice = [u8]>,
     {
-        const BUFFER_SIZE: u32 = 4 * 1024;
+        let mut reader = BlockReader::new(pool);
         loop {
-            let mut tendril = Tendril::<F, A>::new();
-            // FIXME: this exposes uninitialized bytes to a generic R type
-            // this is fine for R=File which never reads these bytes,
-            // but user-defined types might.
-            // The standard library pushes zeros to `Vec<u8>` for that reason.
-            unsafe {
-                tendril.push_uninitialized(BUFFER_SIZE);
-            }
-            loop {
-                match r.read(&mut tendril) {
-                    Ok(0) => return Ok(self.finish()),
-                    Ok(n) => {
-                        tendril.pop_back(BUFFER_SIZE - n as u32);
-                        self.process(tendril);
-                        break;
-                    }
-                    Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
-                    Err(e) => return Err(e),
-                }
+            let tendril: Tendril<F, A> = reader.read(r)?;
+            if tendril.len() == 0 {
+                return Ok(self.finish());
             }
+            self.process(tendril);
+        }
+    }
+
+    /// Like `read_from`, but read into buffers of `block_size` bytes, each
+    /// shared by the tendrils of several reads. See `BlockReader`.
+    ///
+    /// With blocks of 64 KiB to 1 MiB, a sink which keeps the tendrils it is
+    /// given, or a source which returns short reads, such as a socket,
+    /// costs far fewer allocations than with `read_from`. The price is that
+    /// a block stays alive as long as any of its tendrils does.
+    ///
+    /// This will panic if `block_size` is zero.
+    fn read_from_blocks<R>(self, r: &mut R, block_size: u32) -> io::Result<Self::Output>
+    where
+        Self: Sized,
+        R: io::Read,
+        F: fmt::SliceFormat<Slice = [u8]>,
+    {
+        self.read_from_pool(r, &TendrilPool::with_block_size(block_size))
+    }
+
+    /// Like `read_from`, but from a `PollRead` source, such as a socket, as a
+    /// `Future` which resolves once the input ends and the sink finishes.
+    ///
+    /// The bytes are read straight into pool buffers, packing several reads
+    /// into each as a `BlockReader` does, and go to the sink as tendrils on
+    /// those buffers. Nothing more is read while the sink is not ready; see
+    /// `poll_ready`.
+    fn read_from_async<R>(self, r: R) -> ReadFromAsync<Self, R, F, A>
+    where
+        Self: Sized,
+        R: PollRead + Unpin,
+        F: fmt::SliceFormat<Slice = [u8]>,
+    {
+        ReadFromAsync {
+            sink: Some(self),
+            reader: r,
+            pool: TendrilPool::new(),
+            blocks: Blocks::new(),
+            marker: PhantomData,
         }
     }
 
@@ -112,14 +173,228 @@ where
     {
         self.read_from(&mut File::open(path)?)
     }
+
+    /// Like `from_file`, but map the file into memory rather than read it,
+    /// and process subtendrils of the mapping, which are not copied.
+    ///
+    /// The mapping is advised for reading in order, and each part of it is
+    /// unmapped once the sink drops every `Tendril` on that part. Anything
+    /// appended to the file after it is mapped is read as usual.
+    ///
+    /// On platforms other than Linux, this is the same as `from_file`.
+    ///
+    /// This is unsafe because the tendrils are on the bytes of the file, as
+    /// with `Tendril::map_file`. The caller must make sure that no one writes
+    /// to or truncates the file until the sink has dropped every `Tendril` it
+    /// was given. A decoder may otherwise hand on bytes it has validated,
+    /// which then change under it, or reading one may raise `SIGBUS`.
+    #[cfg_attr(not(target_os = "linux"), allow(unused_mut))]
+    unsafe fn from_file_mapped<P>(mut self, path: P) -> io::Result<Self::Output>
+    where
+        Self: Sized,
+        P: AsRef<Path>,
+        F: fmt::SliceFormat<Slice = [u8]>,
+    {
+        let mut file = File::open(path)?;
+        #[cfg(target_os = "linux")]
+        {
+            let mapped = ::tendril::map_windows(&file, |window: Tendril<F, A>| {
+                let mut offset = 0;
+                while offset < window.len32() {
+                    let len = ::std::cmp::min(MAPPED_CHUNK_SIZE, window.len32() - offset);
+                    self.process(window.subtendril(offset, len));
+                    offset += len;
+                }
+            })?;
+            if mapped > 0 {
+                io::Seek::seek(&mut file, io::SeekFrom::Start(mapped))?;
+            }
+        }
+        self.read_from(&mut file)
+    }
+}
+
+/// A source of bytes which can be read without blocking, like `AsyncRead`
+/// in the futures crate.
+///
+/// This is all that `TendrilSink::read_from_async` needs, so that it works
+/// with any runtime. Implementing it for a runtime's own type is a matter
+/// of forwarding one method.
+pub trait PollRead {
+    /// Read into `buf`, as `io::Read::read` does, if there are bytes to
+    /// read or the input has ended. Otherwise return `Poll::Pending`, and
+    /// arrange for the task in `cx` to be woken once there are.
+    fn poll_read(self: Pin<&mut Self>, cx: &mut Context, buf: &mut [u8])
+        -> Poll<io::Result<usize>>;
+}
+
+impl<'a> PollRead for &'a [u8] {
+    #[inline]
+    fn poll_read(
+        mut self: Pin<&mut Self>,
+        _: &mut Context,
+        buf: &mut [u8],
+    ) -> Poll<io::Result<usize>> {
+        Poll::Ready(io::Read::read(&mut *self, buf))
+    }
+}
+
+impl<'a, R> PollRead for &'a mut R
+where
+    R: PollRead + Unpin + ?Sized,
+{
+    #[inline]
+    fn poll_read(
+        mut self: Pin<&mut Self>,
+        cx: &mut Context,
+        buf: &mut [u8],
+    ) -> Poll<io::Result<usize>> {
+        Pin::new(&mut **self).poll_read(cx, buf)
+    }
+}
+
+impl<R> PollRead for Box<R>
+where
+    R: PollRead + Unpin + ?Sized,
+{
+    #[inline]
+    fn poll_read(
+        mut self: Pin<&mut Self>,
+        cx: &mut Context,
+        buf: &mut [u8],
+    ) -> Poll<io::Result<usize>> {
+        Pin::new(&mut **self).poll_read(cx, buf)
+    }
+}
+
+/// How many tendrils `ReadFromAsync` reads in one poll before giving other
+/// tasks a turn, if neither its source nor its sink makes it wait.
+const ASYNC_BUDGET: u32 = 32;
+
+/// A `Future` which reads from a `PollRead` source into a `TendrilSink`.
+///
+/// See `TendrilSink::read_from_async`.
+pub struct ReadFromAsync<S, R, F, A = NonAtomic>
+where
+    S: TendrilSink<F, A>,
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// `None` once finished.
+    sink: Option<S>,
+    reader: R,
+    pool: TendrilPool<A>,
+    blocks: Blocks<A>,
+    marker: PhantomData<F>,
+}
+
+// Nothing is pinned structurally, and the reader is `Unpin`.
+impl<S, R, F, A> Unpin for ReadFromAsync<S, R, F, A>
+where
+    S: TendrilSink<F, A>,
+    F: fmt::Format,
+    A: Atomicity,
+{
+}
+
+impl<S, R, F, A> Future for ReadFromAsync<S, R, F, A>
+where
+    S: TendrilSink<F, A>,
+    R: PollRead + Unpin,
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+{
+    type Output = io::Result<S::Output>;
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<io::Result<S::Output>> {
+        let this = &mut *self;
+        for _ in 0..ASYNC_BUDGET {
+            let sink = this
+                .sink
+                .as_mut()
+                .expect("ReadFromAsync polled after completion");
+            if sink.poll_ready(cx).is_pending() {
+                return Poll::Pending;
+            }
+            let reader = &mut this.reader;
+            let read = this
+                .blocks
+                .read_with(&this.pool, |buf| Pin::new(&mut *reader).poll_read(cx, buf));
+            let t: Tendril<F, A> = match read {
+                Poll::Pending => return Poll::Pending,
+                Poll::Ready(Err(e)) => {
+                    this.sink = None;
+                    return Poll::Ready(Err(e));
+                }
+                Poll::Ready(Ok(t)) => t,
+            };
+            if t.len() == 0 {
+                return Poll::Ready(Ok(this.sink.take().unwrap().finish()));
+            }
+            sink.process(t);
+        }
+        cx.waker().wake_by_ref();
+        Poll::Pending
+    }
+}
+
+/// The size of the buffers `from_files` reads into.
+const FILES_BLOCK_SIZE: u32 = 64 * 1024;
+
+/// How many reads `from_files` keeps in flight.
+#[cfg(target_os = "linux")]
+const FILES_DEPTH: u32 = 64;
+
+/// Read each of the files at `paths` into a sink that `new_sink` makes
+/// from its index, and finish it. Return the results in the order of
+/// `paths`. An I/O error affects only the file it happened on.
+///
+/// On Linux, this keeps up to 64 reads in flight at once with io_uring,
+/// spread over as many files, so that the disk is kept busy while the sinks
+/// process what has already been read. Each sink gets the bytes of its file
+/// in order, in tendrils of up to 64 KiB. Anything appended to a file
+/// after it is opened is read as usual.
+///
+/// Where io_uring is not available, the files are read one after another,
+/// as by `from_file`.
+pub fn from_files<S, F, A, P, M>(paths: &[P], mut new_sink: M) -> Vec<io::Result<S::Output>>
+where
+    S: TendrilSink<F, A>,
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+    P: AsRef<Path>,
+    M: FnMut(usize) -> S,
+{
+    let pool = TendrilPool::with_block_size(FILES_BLOCK_SIZE);
+    #[cfg(target_os = "linux")]
+    {
+        if let Ok(results) = ::tendril::read_files(paths, &mut new_sink, &pool, FILES_DEPTH) {
+            return results;
+        }
+    }
+    paths
+        .iter()
+        .enumerate()
+        .map(|(i, path)| {
+            let sink = new_sink(i);
+            sink.read_from_pool(&mut File::open(path)?, &pool)
+        })
+        .collect()
 }
 
+/// The length of the tendrils `from_file_mapped` passes to a sink.
+#[cfg(target_os = "linux")]
+const MAPPED_CHUNK_SIZE: u32 = 64 * 1024;
+
 /// A `TendrilSink` adaptor that takes bytes, decodes them as UTF-8,
 /// lossily replace ill-formed byte sequences with U+FFFD replacement characters,
 /// and emits Unicode (`StrTendril`).
 ///
 /// This does not allocate memory: the output is either subtendrils on the input,
 /// on inline tendrils for a single code point.
+///
+/// Subtendrils keep any metadata attached to the input, with their offsets
+/// into the input buffer. See `Tendril::attach_metadata`.
 pub struct Utf8LossyDecoder<Sink, A = NonAtomic>
 where
     Sink: TendrilSink<fmt::UTF8, A>,
@@ -151,6 +426,11 @@ where
     Sink: TendrilSink<fmt::UTF8, A>,
     A: Atomicity,
 {
+    #[inline]
+    fn poll_ready(&mut self, cx: &mut Context) -> Poll<()> {
+        self.inner_sink.poll_ready(cx)
+    }
+
     #[inline]
     fn process(&mut self, mut t: Tendril<fmt::Bytes, A>) {
         // FIXME: remove take() and map() when non-lexical borrows are stable.
@@ -255,7 +535,9 @@ where
 /// lossily replace ill-formed byte sequences with U+FFFD replacement characters,
 /// and emits Unicode (`StrTendril`).
 ///
-/// This allocates new tendrils for encodings other than UTF-8.
+/// This allocates new tendrils for encodings other than UTF-8. These carry
+/// any metadata attached to the input, but their offsets are into the
+/// decoded text.
 #[cfg(any(feature = "encoding", feature = "encoding_rs"))]
 pub struct LossyDecoder<Sink, A = NonAtomic>
 where
@@ -275,7 +557,7 @@ where
     #[cfg(feature = "encoding")]
     Encoding(Box<encoding::RawDecoder>, Sink),
     #[cfg(feature = "encoding_rs")]
-    EncodingRs(encoding_rs::Decoder, Sink),
+    EncodingRs(encoding_rs::Decoder, Sink, TendrilPool<A>, Blocks<A>),
 }
 
 #[cfg(any(feature = "encoding", feature = "encoding_rs"))]
@@ -305,7 +587,12 @@ where
             return Self::utf8(sink);
         }
         Self {
-            inner: LossyDecoderInner::EncodingRs(encoding.new_decoder(), sink),
+            inner: LossyDecoderInner::EncodingRs(
+                encoding.new_decoder(),
+                sink,
+                TendrilPool::with_block_size(DECODE_BLOCK_SIZE),
+                Blocks::new(),
+            ),
         }
     }
 
@@ -327,7 +614,7 @@ where
             #[cfg(feature = "encoding")]
             LossyDecoderInner::Encoding(_, ref inner_sink) => inner_sink,
             #[cfg(feature = "encoding_rs")]
-            LossyDecoderInner::EncodingRs(_, ref inner_sink) => inner_sink,
+            LossyDecoderInner::EncodingRs(_, ref inner_sink, ..) => inner_sink,
         }
     }
 
@@ -338,7 +625,7 @@ where
             #[cfg(feature = "encoding")]
             LossyDecoderInner::Encoding(_, ref mut inner_sink) => inner_sink,
             #[cfg(feature = "encoding_rs")]
-            LossyDecoderInner::EncodingRs(_, ref mut inner_sink) => inner_sink,
+            LossyDecoderInner::EncodingRs(_, ref mut inner_sink, ..) => inner_sink,
         }
     }
 }
@@ -349,6 +636,17 @@ where
     Sink: TendrilSink<fmt::UTF8, A>,
     A: Atomicity,
 {
+    #[inline]
+    fn poll_ready(&mut self, cx: &mut Context) -> Poll<()> {
+        match self.inner {
+            LossyDecoderInner::Utf8(ref mut utf8) => utf8.poll_ready(cx),
+            #[cfg(feature = "encoding")]
+            LossyDecoderInner::Encoding(_, ref mut sink) => sink.poll_ready(cx),
+            #[cfg(feature = "encoding_rs")]
+            LossyDecoderInner::EncodingRs(_, ref mut sink, ..) => sink.poll_ready(cx),
+        }
+    }
+
     #[inline]
     fn process(&mut self, t: Tendril<fmt::Bytes, A>) {
         match self.inner {
@@ -370,15 +668,21 @@ where
                     }
                 }
                 if out.len() > 0 {
+                    out.attach_metadata_from(&t);
                     sink.process(out);
                 }
             }
             #[cfg(feature = "encoding_rs")]
-            LossyDecoderInner::EncodingRs(ref mut decoder, ref mut sink) => {
+            LossyDecoderInner::EncodingRs(
+                ref mut decoder,
+                ref mut sink,
+                ref pool,
+                ref mut blocks,
+            ) => {
                 if t.is_empty() {
                     return;
                 }
-                decode_to_sink(t, decoder, sink, false);
+                decode_to_sink(t, decoder, sink, pool, blocks, false);
             }
         }
     }
@@ -390,7 +694,7 @@ where
             #[cfg(feature = "encoding")]
             LossyDecoderInner::Encoding(_, ref mut sink) => sink.error(desc),
             #[cfg(feature = "encoding_rs")]
-            LossyDecoderInner::EncodingRs(_, ref mut sink) => sink.error(desc),
+            LossyDecoderInner::EncodingRs(_, ref mut sink, ..) => sink.error(desc),
         }
     }
 
@@ -413,39 +717,59 @@ where
                 sink.finish()
             }
             #[cfg(feature = "encoding_rs")]
-            LossyDecoderInner::EncodingRs(mut decoder, mut sink) => {
-                decode_to_sink(Tendril::new(), &mut decoder, &mut sink, true);
+            LossyDecoderInner::EncodingRs(mut decoder, mut sink, pool, mut blocks) => {
+                decode_to_sink(
+                    Tendril::new(),
+                    &mut decoder,
+                    &mut sink,
+                    &pool,
+                    &mut blocks,
+                    true,
+                );
                 sink.finish()
             }
         }
     }
 }
 
+/// The size of the buffers that `LossyDecoder` decodes into with encoding_rs.
+/// Short outputs are packed into a buffer together, as by `BlockReader`.
+#[cfg(feature = "encoding_rs")]
+const DECODE_BLOCK_SIZE: u32 = 8192;
+
 #[cfg(feature = "encoding_rs")]
 fn decode_to_sink<Sink, A>(
     mut t: Tendril<fmt::Bytes, A>,
     decoder: &mut encoding_rs::Decoder,
     sink: &mut Sink,
+    pool: &TendrilPool<A>,
+    blocks: &mut Blocks<A>,
     last: bool,
 ) where
     Sink: TendrilSink<fmt::UTF8, A>,
     A: Atomicity,
 {
     loop {
-        let mut out = <Tendril<fmt::Bytes, A>>::new();
+        // Room to decode all of `t`, up to a whole buffer, so that short
+        // outputs share a buffer rather than take one each.
         let max_len = decoder
             .max_utf8_buffer_length_without_replacement(t.len())
-            .unwrap_or(8192);
-        unsafe {
-            out.push_uninitialized(std::cmp::min(max_len as u32, 8192));
-        }
-        let (result, bytes_read, bytes_written) =
-            decoder.decode_to_utf8_without_replacement(&t, &mut out, last);
-        if bytes_written > 0 {
-            sink.process(unsafe {
-                out.subtendril(0, bytes_written as u32)
-                    .reinterpret_without_validating()
-            });
+            .unwrap_or(DECODE_BLOCK_SIZE as usize);
+        let min_space = ::std::cmp::min(max_len, DECODE_BLOCK_SIZE as usize) as u32;
+        let mut status = None;
+        let mut decoded: Tendril<fmt::UTF8, A> = unsafe {
+            blocks.fill_without_validating(pool, min_space, |out| {
+                let (result, bytes_read, bytes_written) =
+                    decoder.decode_to_utf8_without_replacement(&t, out, last);
+                status = Some((result, bytes_read));
+                Ok::<usize, ()>(bytes_written)
+            })
+        }
+        .unwrap();
+        let (result, bytes_read) = status.unwrap();
+        if decoded.len() > 0 {
+            decoded.attach_metadata_from(&t);
+            sink.process(decoded);
         }
         match result {
             DecoderResult::InputEmpty => return,
@@ -464,10 +788,19 @@ fn decode_to_sink<Sink, A>(
 
 #[cfg(test)]
 mod test {
-    use super::{TendrilSink, Utf8LossyDecoder};
+    use super::{PollRead, TendrilSink, Utf8LossyDecoder};
     use fmt;
     use std::borrow::Cow;
-    use tendril::{Atomicity, NonAtomic, Tendril};
+    use std::cell::Cell;
+    use std::future::Future;
+    use std::io;
+    use std::mem;
+    use std::pin::Pin;
+    use std::rc::Rc;
+    use std::sync::Arc;
+    use std::task::{Context, Poll, RawWaker, RawWakerVTable, Waker};
+    use std::thread::{self, Thread};
+    use tendril::{Atomic, Atomicity, NonAtomic, Tendril};
 
     #[cfg(any(feature = "encoding", feature = "encoding_rs"))]
     use super::LossyDecoder;
@@ -583,6 +916,31 @@ mod test {
         check_utf8(&[b"\xEA\x99"], &["\u{fffd}"], 1);
     }
 
+    #[test]
+    fn utf8_keeps_metadata() {
+        let mut first: Tendril<fmt::Bytes> = Tendril::from_slice(&b"abc\xEA"[..]);
+        first.attach_metadata("first");
+        let mut second: Tendril<fmt::Bytes> = Tendril::from_slice(&b"\x99\xAEdefghijkl\xFFmn"[..]);
+        second.attach_metadata("second");
+
+        let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
+        let (tendrils, _) = decoder.from_iter(vec![first, second]);
+        let found: Vec<_> = tendrils
+            .iter()
+            .map(|t| (&**t, t.metadata::<&str>().map(|(m, off)| (*m, off))))
+            .collect();
+        assert_eq!(
+            vec![
+                ("abc", Some(("first", 0))),
+                ("\u{a66e}d", None),
+                ("efghijkl", Some(("second", 3))),
+                ("\u{fffd}", None),
+                ("mn", Some(("second", 12))),
+            ],
+            found
+        );
+    }
+
     #[cfg(any(feature = "encoding", feature = "encoding_rs"))]
     fn check_decode(
         mut decoder: LossyDecoder<Accumulate<NonAtomic>>,
@@ -738,6 +1096,27 @@ mod test {
         }
     }
 
+    #[cfg(feature = "encoding_rs")]
+    #[test]
+    fn decode_encoding_rs_packs_outputs() {
+        let mut decoder = LossyDecoder::new_encoding_rs(enc_rs::KOI8_U, Accumulate::new());
+        for i in 0..100 {
+            decoder.process(
+                format!("chunk {} of plain ASCII", i)
+                    .as_bytes()
+                    .to_tendril(),
+            );
+        }
+        let (tendrils, errors) = decoder.finish();
+        assert!(errors.is_empty());
+        assert_eq!(100, tendrils.len());
+        assert_eq!("chunk 99 of plain ASCII", &*tendrils[99]);
+
+        // Short outputs follow one another in a buffer.
+        let next = tendrils[0].as_ptr() as usize + tendrils[0].len();
+        assert_eq!(next, tendrils[1].as_ptr() as usize);
+    }
+
     #[test]
     fn read_from() {
         let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
@@ -749,4 +1128,243 @@ mod test {
         );
         assert_eq!(errors, &["invalid byte sequence"]);
     }
+
+    #[test]
+    fn read_from_blocks() {
+        let mut input = vec![];
+        for i in 0..20000 {
+            input.extend_from_slice(format!("line {} \u{2764}\n", i).as_bytes());
+        }
+        input.push(0xFF);
+        let join = |(tendrils, errors): (Vec<Tendril<fmt::UTF8>>, Vec<_>)| {
+            let s: String = tendrils.iter().map(|t| &**t).collect();
+            (s, errors)
+        };
+
+        let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
+        let (s, errors) = join(decoder.read_from_blocks(&mut &*input, 64 * 1024).unwrap());
+        assert!(s.ends_with("line 19999 \u{2764}\n\u{FFFD}"));
+        assert_eq!(String::from_utf8_lossy(&input), s);
+        assert_eq!(errors, &["invalid byte sequence"]);
+    }
+
+    /// A `Waker` that unparks the current thread, built by hand from an
+    /// `Arc<Thread>` because `std::task::Wake` is newer than Rust 1.36.
+    fn unpark_waker() -> Waker {
+        unsafe fn clone(p: *const ()) -> RawWaker {
+            let thread = Arc::from_raw(p as *const Thread);
+            let copy = Arc::into_raw(thread.clone());
+            mem::forget(thread);
+            RawWaker::new(copy as *const (), &VTABLE)
+        }
+        unsafe fn wake(p: *const ()) {
+            Arc::from_raw(p as *const Thread).unpark();
+        }
+        unsafe fn wake_by_ref(p: *const ()) {
+            (*(p as *const Thread)).unpark();
+        }
+        unsafe fn drop(p: *const ()) {
+            Arc::from_raw(p as *const Thread);
+        }
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, wake, wake_by_ref, drop);
+
+        let p = Arc::into_raw(Arc::new(thread::current()));
+        unsafe { Waker::from_raw(RawWaker::new(p as *const (), &VTABLE)) }
+    }
+
+    /// Poll `f` to completion on this thread.
+    fn block_on<T>(mut f: impl Future<Output = T> + Unpin) -> T {
+        let waker = unpark_waker();
+        let mut cx = Context::from_waker(&waker);
+        loop {
+            if let Poll::Ready(x) = Pin::new(&mut f).poll(&mut cx) {
+                return x;
+            }
+            thread::park();
+        }
+    }
+
+    /// Returns a few bytes at a time, after making the task wait for each.
+    struct Trickle<'a> {
+        input: &'a [u8],
+        waited: bool,
+        /// Set by the sink while it is ready for more.
+        ready: Rc<Cell<bool>>,
+    }
+
+    impl<'a> PollRead for Trickle<'a> {
+        fn poll_read(
+            mut self: Pin<&mut Self>,
+            cx: &mut Context,
+            buf: &mut [u8],
+        ) -> Poll<io::Result<usize>> {
+            assert!(self.ready.get(), "read while the sink was not ready");
+            if !self.waited {
+                self.waited = true;
+                cx.waker().wake_by_ref();
+                return Poll::Pending;
+            }
+            self.waited = false;
+            let n = self.input.len().min(7).min(buf.len());
+            buf[..n].copy_from_slice(&self.input[..n]);
+            self.input = &self.input[n..];
+            Poll::Ready(Ok(n))
+        }
+    }
+
+    /// Is ready for more only every other time it is asked.
+    struct Throttle {
+        inner: Accumulate<NonAtomic>,
+        polls: u32,
+        ready: Rc<Cell<bool>>,
+    }
+
+    impl TendrilSink<fmt::UTF8> for Throttle {
+        fn poll_ready(&mut self, cx: &mut Context) -> Poll<()> {
+            self.polls += 1;
+            self.ready.set(self.polls % 2 == 1);
+            if self.ready.get() {
+                Poll::Ready(())
+            } else {
+                cx.waker().wake_by_ref();
+                Poll::Pending
+            }
+        }
+
+        fn process(&mut self, t: Tendril<fmt::UTF8>) {
+            self.ready.set(false);
+            self.inner.process(t)
+        }
+
+        fn error(&mut self, desc: Cow<'static, str>) {
+            self.inner.error(desc)
+        }
+
+        type Output = <Accumulate<NonAtomic> as TendrilSink<fmt::UTF8>>::Output;
+
+        fn finish(self) -> Self::Output {
+            self.inner.finish()
+        }
+    }
+
+    #[test]
+    fn read_from_async() {
+        let mut input = vec![];
+        for i in 0..1000 {
+            input.extend_from_slice(format!("{} \u{2764} ", i).as_bytes());
+            if i % 100 == 0 {
+                input.push(0xFF);
+            }
+        }
+        let join = |(tendrils, errors): (Vec<Tendril<fmt::UTF8>>, Vec<String>)| {
+            let s: String = tendrils.iter().map(|t| &**t).collect();
+            (s, errors)
+        };
+        let expected = (
+            String::from_utf8_lossy(&input).into_owned(),
+            vec!["invalid byte sequence".to_owned(); 10],
+        );
+
+        let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
+        let ready = join(block_on(decoder.read_from_async(&*input)).unwrap());
+        assert_eq!(expected, ready);
+
+        let ready = Rc::new(Cell::new(false));
+        let sink = Throttle {
+            inner: Accumulate::new(),
+            polls: 0,
+            ready: ready.clone(),
+        };
+        let source = Trickle {
+            input: &input,
+            waited: false,
+            ready: ready,
+        };
+        let (tendrils, errors) =
+            block_on(Utf8LossyDecoder::new(sink).read_from_async(source)).unwrap();
+        assert_eq!(expected, join((tendrils, errors)));
+    }
+
+    #[test]
+    fn read_from_async_error() {
+        struct Broken;
+        impl PollRead for Broken {
+            fn poll_read(
+                self: Pin<&mut Self>,
+                _: &mut Context,
+                _: &mut [u8],
+            ) -> Poll<io::Result<usize>> {
+                Poll::Ready(Err(io::Error::new(io::ErrorKind::Other, "broken")))
+            }
+        }
+
+        let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
+        assert!(block_on(decoder.read_from_async(Broken)).is_err());
+
+        fn assert_send<T: Send>(_: &T) {}
+        let decoder = Utf8LossyDecoder::new(Accumulate::<Atomic>::new());
+        assert_send(&decoder.read_from_async(&b""[..]));
+    }
+
+    #[test]
+    fn from_files() {
+        use std::{env, fs, process};
+
+        let dir = env::temp_dir().join(format!("tendril-{}-from_files", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let mut paths = vec![];
+        let mut expected = vec![];
+        for i in 0..100 {
+            let mut contents = String::new();
+            for j in 0..i * 100 {
+                contents.push_str(&format!("{} {} \u{2764}\n", i, j));
+            }
+            let path = dir.join(format!("{}.txt", i));
+            fs::write(&path, &contents).unwrap();
+            paths.push(path);
+            expected.push(contents);
+        }
+        paths.insert(50, dir.join("missing"));
+
+        let results = super::from_files(&paths, |_| {
+            Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new())
+        });
+        fs::remove_dir_all(&dir).unwrap();
+
+        assert_eq!(101, results.len());
+        assert!(results[50].is_err());
+        for (i, result) in results.into_iter().enumerate().filter(|&(i, _)| i != 50) {
+            let (tendrils, errors) = result.unwrap();
+            let s: String = tendrils.iter().map(|t| &**t).collect();
+            assert_eq!(expected[if i < 50 { i } else { i - 1 }], s);
+            assert!(errors.is_empty());
+        }
+    }
+
+    #[test]
+    fn from_file_mapped() {
+        use std::io::Write;
+        use std::{env, fs, process};
+
+        let mut contents = vec![];
+        for i in 0..20000 {
+            write!(contents, "line {} \u{2764}\n", i).unwrap();
+        }
+        contents.push(0xFF);
+        let path = env::temp_dir().join(format!("tendril-{}-from_file_mapped", process::id()));
+        fs::write(&path, &contents).unwrap();
+
+        let join = |(tendrils, errors): (Vec<Tendril<fmt::UTF8>>, Vec<_>)| {
+            let s: String = tendrils.iter().map(|t| &**t).collect();
+            (s, errors)
+        };
+        let decoder = Utf8LossyDecoder::new(Accumulate::<NonAtomic>::new());
+        let (s, errors) = join(unsafe { decoder.from_file_mapped(&path).unwrap() });
+        fs::remove_file(&path).unwrap();
+
+        assert!(s.len() > 256 * 1024);
+        assert!(s.ends_with("line 19999 \u{2764}\n\u{FFFD}"));
+        assert_eq!(String::from_utf8_lossy(&contents), s);
+        assert_eq!(errors, &["invalid byte sequence"]);
+    }
 }
@@ -4,18 +4,23 @@
 // option. This file may not be copied, modified, or distributed
 // except according to those terms.
 
+use std::alloc::{self, Layout};
+use std::any::Any;
 use std::borrow::Borrow;
 use std::cell::{Cell, UnsafeCell};
-use std::cmp::Ordering;
+use std::cmp::{self, Ordering};
+use std::collections::hash_map::RandomState;
 use std::default::Default;
 use std::fmt as strfmt;
+use std::hash::{BuildHasher, Hasher};
 use std::iter::FromIterator;
 use std::marker::PhantomData;
 use std::num::NonZeroUsize;
 use std::ops::{Deref, DerefMut};
 use std::sync::atomic::Ordering as AtomicOrdering;
-use std::sync::atomic::{self, AtomicUsize};
-use std::{hash, io, mem, ptr, str, u32};
+use std::sync::atomic::{self, AtomicU32, AtomicUsize};
+use std::sync::{Arc, Mutex, Once};
+use std::{hash, io, mem, ptr, slice, str, u16, u32};
 
 #[cfg(feature = "encoding")]
 use encoding::{self, DecoderTrap, EncoderTrap, EncodingRef};
@@ -23,22 +28,35 @@ use encoding::{self, DecoderTrap, EncoderTrap, EncodingRef};
 use buf32::{self, Buf32};
 use fmt::imp::Fixup;
 use fmt::{self, Slice};
+use simd;
 use util::{copy_and_advance, copy_lifetime, copy_lifetime_mut, unsafe_slice, unsafe_slice_mut};
 use OFLOW;
 
-const MAX_INLINE_LEN: usize = 8;
-const MAX_INLINE_TAG: usize = 0xF;
-const EMPTY_TAG: usize = 0xF;
+const MAX_INLINE_TAG: usize = 0x1F;
+const EMPTY_TAG: usize = 0x1F;
+
+/// Tag bit for a buffer with an `ExternalHeader`. Such buffers are always
+/// marked shared, so they are never written to.
+const EXTERNAL: usize = 2;
+
+/// Tag bit for `'static` bytes, which have no header. The rest of the
+/// pointer is their address rounded down to a multiple of 8, and the
+/// remainder is added to the offset. Such tendrils are always marked
+/// shared, and are not reference counted.
+const STATIC: usize = 4;
+
+/// All the tag bits of a pointer to a buffer.
+const TAGS: usize = 1 | EXTERNAL | STATIC;
 
 #[inline(always)]
 fn inline_tag(len: u32) -> NonZeroUsize {
-    debug_assert!(len <= MAX_INLINE_LEN as u32);
+    debug_assert!(len < EMPTY_TAG as u32);
     unsafe { NonZeroUsize::new_unchecked(if len == 0 { EMPTY_TAG } else { len as usize }) }
 }
 
 /// The multithreadedness of a tendril.
 ///
-/// Exactly two types implement this trait:
+/// Exactly three types implement this trait:
 ///
 /// - `Atomic`: use this in your tendril and you will have a `Send` tendril which works
 ///   across threads; this is akin to `Arc`.
@@ -46,8 +64,14 @@ fn inline_tag(len: u32) -> NonZeroUsize {
 /// - `NonAtomic`: use this in your tendril and you will have a tendril which is neither
 ///   `Send` nor `Sync` but should be a tad faster; this is akin to `Rc`.
 ///
-/// The layout of this trait is also mandated to be that of a `usize`,
-/// for it is used for reference counting.
+/// - `BiasedAtomic`: use this in your tendril and you will have a tendril which can be
+///   sent between threads through `SendBiasedTendril`, at nearly the cost of `NonAtomic`
+///   on the thread which shares each buffer.
+///
+/// The size of this trait is also mandated to be at most 8 bytes, with alignment at
+/// most 8. It is 4 bytes for `NonAtomic` and `Atomic` on 32-bit platforms, and 8
+/// otherwise; as it comes last in a buffer's header, the rest of the header has the
+/// same layout whichever is used.
 pub unsafe trait Atomicity: 'static {
     #[doc(hidden)]
     fn new() -> Self;
@@ -60,6 +84,43 @@ pub unsafe trait Atomicity: 'static {
 
     #[doc(hidden)]
     fn fence_acquire();
+
+    #[doc(hidden)]
+    fn is_unique(&self) -> bool;
+
+    /// Guards state shared by the buffers of a `TendrilPool`.
+    #[doc(hidden)]
+    type Lock: Lock;
+}
+
+/// A lock for state shared between buffers, such as a `TendrilPool`'s free
+/// list. Buffers which never leave their thread need no real lock.
+#[doc(hidden)]
+pub trait Lock: Default {
+    fn with<R, G>(&self, f: G) -> R
+    where
+        G: FnOnce() -> R;
+}
+
+impl Lock for () {
+    #[inline(always)]
+    fn with<R, G>(&self, f: G) -> R
+    where
+        G: FnOnce() -> R,
+    {
+        f()
+    }
+}
+
+impl Lock for Mutex<()> {
+    #[inline]
+    fn with<R, G>(&self, f: G) -> R
+    where
+        G: FnOnce() -> R,
+    {
+        let _guard = self.lock().unwrap_or_else(|e| e.into_inner());
+        f()
+    }
 }
 
 /// A marker of a non-atomic tendril.
@@ -97,6 +158,13 @@ unsafe impl Atomicity for NonAtomic {
 
     #[inline]
     fn fence_acquire() {}
+
+    #[inline]
+    fn is_unique(&self) -> bool {
+        self.0.get().0 == 1
+    }
+
+    type Lock = ();
 }
 
 /// A marker of an atomic (and hence concurrent) tendril.
@@ -128,11 +196,443 @@ unsafe impl Atomicity for Atomic {
     fn fence_acquire() {
         atomic::fence(AtomicOrdering::Acquire);
     }
+
+    #[inline]
+    fn is_unique(&self) -> bool {
+        // Acquire, to see every write made through references since dropped.
+        self.0.load(AtomicOrdering::Acquire) == 1
+    }
+
+    type Lock = Mutex<()>;
+}
+
+/// A marker of a tendril with biased reference counting.
+///
+/// Each buffer is biased towards the thread that first shares it: that
+/// thread counts its references without atomic operations, and every other
+/// thread counts in a separate atomic count. When the owning thread drops
+/// its last reference, the two are merged and the buffer becomes like that
+/// of an `Atomic` tendril. Where most clones happen on the thread that made
+/// a buffer, this costs little more than `NonAtomic`.
+///
+/// A `Tendril<F, BiasedAtomic>` is not `Send` itself, because a reference
+/// counted by its owner must not be dropped elsewhere. Convert it into a
+/// `SendBiasedTendril`, which moves it to the atomic count, for free unless
+/// it is on an external buffer such as an `Arena`'s.
+///
+/// Each of the first 65534 threads to use this gets an owner id; threads
+/// after that always count atomically.
+#[repr(C)]
+pub struct BiasedAtomic {
+    /// The count of other threads, plus `MERGED`.
+    shared: AtomicU32,
+    /// The count of the owner, or 0 once merged. Only the owner touches it.
+    biased: Cell<u16>,
+    owner: u16,
+}
+
+/// Set in `BiasedAtomic::shared` once the owner has no references left.
+const MERGED: u32 = 1 << 31;
+
+/// `BiasedAtomic::owner` for a buffer which is merged from the start.
+const NO_OWNER: u16 = u16::MAX;
+
+thread_local!(static THREAD_ID: Cell<u16> = Cell::new(0));
+
+static NEXT_THREAD_ID: AtomicUsize = AtomicUsize::new(1);
+
+/// The owner id of this thread, or `NO_OWNER`.
+#[inline(always)]
+fn thread_id() -> u16 {
+    THREAD_ID.with(|id| match id.get() {
+        0 => {
+            let next = NEXT_THREAD_ID.fetch_add(1, AtomicOrdering::Relaxed);
+            let next = cmp::min(next, NO_OWNER as usize) as u16;
+            id.set(next);
+            next
+        }
+        n => n,
+    })
+}
+
+impl BiasedAtomic {
+    /// Move a reference held by this thread to the atomic count, so that it
+    /// can be dropped on any thread.
+    #[inline]
+    fn unbias(&self) {
+        if self.owner == thread_id() {
+            let biased = self.biased.get();
+            if biased != 0 {
+                self.biased.set(biased - 1);
+                let merged = if biased == 1 { MERGED } else { 0 };
+                self.shared.fetch_add(1 | merged, AtomicOrdering::Release);
+            }
+        }
+    }
+}
+
+unsafe impl Atomicity for BiasedAtomic {
+    #[inline]
+    fn new() -> Self {
+        let owner = thread_id();
+        let (shared, biased) = match owner {
+            NO_OWNER => (MERGED | 1, 0),
+            _ => (0, 1),
+        };
+        BiasedAtomic {
+            shared: AtomicU32::new(shared),
+            biased: Cell::new(biased),
+            owner: owner,
+        }
+    }
+
+    #[inline]
+    fn increment(&self) -> usize {
+        if self.owner == thread_id() {
+            let biased = self.biased.get();
+            // Once the owner's count is full, it carries on in the shared one.
+            if biased != 0 && biased != u16::MAX {
+                self.biased.set(biased + 1);
+                return biased as usize;
+            }
+        }
+        // Relaxed is OK because we have a reference already.
+        let old = self.shared.fetch_add(1, AtomicOrdering::Relaxed);
+        if old & !MERGED == !MERGED - 1 {
+            panic!("{}", OFLOW);
+        }
+        (old & !MERGED) as usize
+    }
+
+    #[inline]
+    fn decrement(&self) -> usize {
+        if self.owner == thread_id() {
+            let biased = self.biased.get();
+            if biased > 1 {
+                self.biased.set(biased - 1);
+                return biased as usize;
+            }
+            if biased == 1 {
+                self.biased.set(0);
+                let old = self.shared.fetch_or(MERGED, AtomicOrdering::Release);
+                return old as usize + 1;
+            }
+        }
+        let old = self.shared.fetch_sub(1, AtomicOrdering::Release);
+        debug_assert!(old & !MERGED != 0);
+        match old & MERGED {
+            0 => old as usize + 1,
+            _ => (old & !MERGED) as usize,
+        }
+    }
+
+    #[inline]
+    fn fence_acquire() {
+        atomic::fence(AtomicOrdering::Acquire);
+    }
+
+    #[inline]
+    fn is_unique(&self) -> bool {
+        let shared = self.shared.load(AtomicOrdering::Acquire);
+        if self.owner == thread_id() && self.biased.get() != 0 {
+            self.biased.get() == 1 && shared == 0
+        } else {
+            shared == MERGED | 1
+        }
+    }
+
+    type Lock = Mutex<()>;
+}
+
+/// The inline capacity of a tendril.
+///
+/// Exactly two types implement this trait:
+///
+/// - `Inline8`: store up to 8 bytes in-line, in a 16-byte `Tendril`. This is
+///   the default.
+///
+/// - `Inline16`: store up to 16 bytes in-line, in a 24-byte `Tendril`. This
+///   saves an allocation for mid-sized strings such as many attribute values
+///   and tag names, at the cost of a larger handle.
+pub unsafe trait InlineCapacity: 'static {
+    #[doc(hidden)]
+    type Storage: Copy;
+
+    #[doc(hidden)]
+    const LEN: usize;
+}
+
+/// Store up to 8 bytes in-line. See `InlineCapacity`.
+#[derive(Copy, Clone, Default, Debug)]
+pub struct Inline8;
+
+unsafe impl InlineCapacity for Inline8 {
+    type Storage = [u8; 8];
+    const LEN: usize = 8;
+}
+
+/// Store up to 16 bytes in-line. See `InlineCapacity`.
+#[derive(Copy, Clone, Default, Debug)]
+pub struct Inline16;
+
+unsafe impl InlineCapacity for Inline16 {
+    type Storage = [u8; 16];
+    const LEN: usize = 16;
+}
+
+/// The allocator for a `Tendril`'s heap buffers.
+///
+/// The methods take no `self`, so the choice of allocator costs nothing in
+/// the size of a `Tendril`; an allocator with state keeps it in a `static`.
+/// Calls are made through the type, and inline like any other generic code.
+///
+/// Buffers made by other means, such as those from an `Arena` or those with
+/// metadata attached, are released by whatever made them and never passed
+/// to `dealloc`.
+///
+/// This is unsafe to implement because the methods must behave like their
+/// namesakes in `std::alloc`.
+pub unsafe trait Allocator: 'static {
+    /// Allocate memory as described by `layout`, or return null.
+    unsafe fn alloc(layout: Layout) -> *mut u8;
+
+    /// Free memory allocated by `alloc` or `realloc` with the same `layout`.
+    unsafe fn dealloc(ptr: *mut u8, layout: Layout);
+
+    /// Resize memory to `new_size` bytes, keeping its contents and
+    /// alignment, or return null and leave it untouched.
+    unsafe fn realloc(ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8;
+
+    /// The number of bytes usable at `ptr`, just returned by `alloc` or
+    /// `realloc` for `layout`. A buffer grows into the spare bytes for free.
+    ///
+    /// If this is more than `layout.size()`, then `dealloc` and `realloc`
+    /// must accept any size in between. The default is `layout.size()`.
+    #[inline(always)]
+    unsafe fn usable_size(ptr: *mut u8, layout: Layout) -> usize {
+        let _ = ptr;
+        layout.size()
+    }
+}
+
+/// The global allocator, as set by `#[global_allocator]`. See `Allocator`.
+///
+/// On Linux, buffers of `HUGE_SIZE` bytes and more are mapped directly
+/// instead, so that growing one is an `mremap` rather than a copy.
+#[derive(Copy, Clone, Default, Debug)]
+pub struct Global;
+
+#[cfg(target_os = "linux")]
+const HUGE_SIZE: usize = 64 << 20;
+
+#[cfg(target_os = "linux")]
+const PAGE_SIZE: usize = 4096;
+
+unsafe impl Allocator for Global {
+    #[inline(always)]
+    unsafe fn alloc(layout: Layout) -> *mut u8 {
+        #[cfg(target_os = "linux")]
+        {
+            if layout.size() >= HUGE_SIZE {
+                return huge::alloc(layout.size());
+            }
+        }
+        alloc::alloc(layout)
+    }
+
+    #[inline(always)]
+    unsafe fn dealloc(ptr: *mut u8, layout: Layout) {
+        #[cfg(target_os = "linux")]
+        {
+            if layout.size() >= HUGE_SIZE {
+                return huge::dealloc(ptr, layout.size());
+            }
+        }
+        alloc::dealloc(ptr, layout)
+    }
+
+    #[inline(always)]
+    unsafe fn realloc(ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        #[cfg(target_os = "linux")]
+        {
+            match (layout.size() >= HUGE_SIZE, new_size >= HUGE_SIZE) {
+                (false, false) => (),
+                (true, true) => return huge::realloc(ptr, layout.size(), new_size),
+                _ => {
+                    let new_layout = Layout::from_size_align_unchecked(new_size, layout.align());
+                    let new_ptr = Global::alloc(new_layout);
+                    if !new_ptr.is_null() {
+                        let len = cmp::min(layout.size(), new_size);
+                        ptr::copy_nonoverlapping(ptr, new_ptr, len);
+                        Global::dealloc(ptr, layout);
+                    }
+                    return new_ptr;
+                }
+            }
+        }
+        alloc::realloc(ptr, layout, new_size)
+    }
+
+    #[inline(always)]
+    unsafe fn usable_size(ptr: *mut u8, layout: Layout) -> usize {
+        let _ = ptr;
+        #[cfg(target_os = "linux")]
+        {
+            if layout.size() >= HUGE_SIZE {
+                return (layout.size() + PAGE_SIZE - 1) & !(PAGE_SIZE - 1);
+            }
+        }
+        layout.size()
+    }
 }
 
+/// Anonymous mappings for `Global`'s huge buffers.
+#[cfg(target_os = "linux")]
+mod huge {
+    use libc;
+    use std::ptr;
+
+    pub unsafe fn alloc(size: usize) -> *mut u8 {
+        let ptr = libc::mmap(
+            ptr::null_mut(),
+            size,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+            -1,
+            0,
+        );
+        if ptr == libc::MAP_FAILED {
+            return ptr::null_mut();
+        }
+        ptr as *mut u8
+    }
+
+    pub unsafe fn dealloc(ptr: *mut u8, size: usize) {
+        libc::munmap(ptr as *mut libc::c_void, size);
+    }
+
+    pub unsafe fn realloc(ptr: *mut u8, old_size: usize, new_size: usize) -> *mut u8 {
+        let ptr = libc::mremap(
+            ptr as *mut libc::c_void,
+            old_size,
+            new_size,
+            libc::MREMAP_MAYMOVE,
+        );
+        if ptr == libc::MAP_FAILED {
+            return ptr::null_mut();
+        }
+        ptr as *mut u8
+    }
+}
+
+// Aligned to 8 so that the `STATIC` tag bit is clear, even on 32-bit
+// platforms. The reference count comes last, so that the other fields, and
+// those of an `ExternalHeader`, are at the same offsets for every `A`.
+#[repr(C, align(8))]
 struct Header<A: Atomicity> {
-    refcount: A,
     cap: u32,
+    /// The end of the bytes any `Tendril` on a shared buffer may refer to.
+    /// The one `Tendril` which ends there may append in place up to `cap`.
+    used: AtomicU32,
+    refcount: A,
+}
+
+/// Hash bytes for `HashedTendril`, with keys chosen at random once per process.
+fn hash_bytes(x: &[u8]) -> u32 {
+    static INIT: Once = Once::new();
+    static mut KEYS: *const RandomState = 0 as *const RandomState;
+
+    unsafe {
+        INIT.call_once(|| KEYS = Box::into_raw(Box::new(RandomState::new())));
+        let mut hasher = (*KEYS).build_hasher();
+        hasher.write(x);
+        let hash = hasher.finish();
+        (hash >> 32) as u32 ^ hash as u32
+    }
+}
+
+/// Header for a buffer whose bytes are not stored after the header.
+///
+/// This starts with a `Header`, whose `cap` is the length of the bytes, so
+/// that reference counting works the same way for both kinds of buffer.
+#[repr(C)]
+struct ExternalHeader<A: Atomicity> {
+    header: Header<A>,
+    data: *const u8,
+    /// Frees the header and `owner`, which keeps the bytes alive, once the
+    /// reference count reaches zero.
+    release: unsafe fn(*mut ExternalHeader<A>),
+    owner: *mut (),
+    metadata: Option<Arc<dyn Any + Send + Sync>>,
+}
+
+impl<A> ExternalHeader<A>
+where
+    A: Atomicity,
+{
+    #[inline(always)]
+    unsafe fn new(
+        data: *const u8,
+        len: u32,
+        release: unsafe fn(*mut ExternalHeader<A>),
+        owner: *mut (),
+    ) -> ExternalHeader<A> {
+        ExternalHeader {
+            header: Header {
+                refcount: A::new(),
+                cap: len,
+                used: AtomicU32::new(len),
+            },
+            data: data,
+            release: release,
+            owner: owner,
+            metadata: None,
+        }
+    }
+}
+
+/// `release` for a boxed `ExternalHeader` whose owner is a `Box<T>`.
+unsafe fn release_boxed<A, T>(header: *mut ExternalHeader<A>)
+where
+    A: Atomicity,
+{
+    drop(Box::from_raw((*header).owner as *mut T));
+    drop(Box::from_raw(header));
+}
+
+/// `release` for an `ExternalHeader` on the buffer of a `Vec<u8>`, whose
+/// capacity is the `owner`.
+///
+/// This is not generic, so that `into_vec` can recognize it by address; the
+/// fields it reads from an `ExternalHeader<A>` are at the same offsets for
+/// every `A`.
+#[inline(never)]
+unsafe fn release_vec(header: *mut ExternalHeader<NonAtomic>) {
+    drop(reclaim_vec(header));
+}
+
+/// `release_vec` for an `ExternalHeader<A>`.
+#[inline(always)]
+fn release_vec_fn<A>() -> unsafe fn(*mut ExternalHeader<A>)
+where
+    A: Atomicity,
+{
+    unsafe { mem::transmute(release_vec as unsafe fn(*mut ExternalHeader<NonAtomic>)) }
+}
+
+/// Free the `ExternalHeader` of a buffer from a `Vec<u8>`, and return the
+/// `Vec`. The header is either boxed or in the `Vec`'s spare capacity.
+unsafe fn reclaim_vec(header: *mut ExternalHeader<NonAtomic>) -> Vec<u8> {
+    let data = (*header).data as *mut u8;
+    let len = (*header).header.cap as usize;
+    let capacity = (*header).owner as usize;
+    let addr = header as usize;
+    if addr >= data as usize && addr < data as usize + capacity {
+        ptr::drop_in_place(header);
+    } else {
+        drop(Box::from_raw(header));
+    }
+    Vec::from_raw_parts(data, len, capacity)
 }
 
 impl<A> Header<A>
@@ -144,6 +644,7 @@ where
         Header {
             refcount: A::new(),
             cap: 0,
+            used: AtomicU32::new(0),
         }
     }
 }
@@ -168,7 +669,8 @@ pub enum SubtendrilError {
 /// relax this restriction in the future; see `README.md`.
 ///
 /// Whereas `String` allocates in the heap for any non-empty string, `Tendril`
-/// can store small strings (up to 8 bytes) in-line, without a heap allocation.
+/// can store small strings (up to 8 bytes, by default) in-line, without a heap
+/// allocation.
 /// `Tendril` is also smaller than `String` on 64-bit platforms — 16 bytes
 /// versus 24.
 ///
@@ -181,24 +683,33 @@ pub enum SubtendrilError {
 /// default `NonAtomic`, but can be specified as `Atomic` to get a tendril
 /// which implements `Send` (viz. a thread-safe tendril).
 ///
+/// The type parameter `I` sets how many bytes are stored in-line; it is by
+/// default `Inline8`. See `InlineCapacity`.
+///
+/// The type parameter `Al` chooses where heap buffers come from; it is by
+/// default `Global`, the global allocator. See `Allocator`.
+///
 /// The maximum length of a `Tendril` is 4 GB. The library will panic if
 /// you attempt to go over the limit.
 #[repr(C)]
-pub struct Tendril<F, A = NonAtomic>
+pub struct Tendril<F, A = NonAtomic, I = Inline8, Al = Global>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     ptr: Cell<NonZeroUsize>,
-    buf: UnsafeCell<Buffer>,
+    buf: UnsafeCell<Buffer<I::Storage>>,
     marker: PhantomData<*mut F>,
     refcount_marker: PhantomData<A>,
+    alloc_marker: PhantomData<Al>,
 }
 
 #[repr(C)]
-union Buffer {
+union Buffer<S: Copy> {
     heap: Heap,
-    inline: [u8; 8],
+    inline: S,
 }
 
 #[derive(Copy, Clone)]
@@ -208,10 +719,12 @@ struct Heap {
     aux: u32,
 }
 
-unsafe impl<F, A> Send for Tendril<F, A>
+unsafe impl<F, A, I, Al> Send for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity + Sync,
+    I: InlineCapacity,
+    Al: Allocator,
 {
 }
 
@@ -221,13 +734,15 @@ pub type StrTendril = Tendril<fmt::UTF8>;
 /// `Tendril` for storing binary data.
 pub type ByteTendril = Tendril<fmt::Bytes>;
 
-impl<F, A> Clone for Tendril<F, A>
+impl<F, A, I, Al> Clone for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn clone(&self) -> Tendril<F, A> {
+    fn clone(&self) -> Tendril<F, A, I, Al> {
         unsafe {
             if self.ptr.get().get() > MAX_INLINE_TAG {
                 self.make_buf_shared();
@@ -239,16 +754,18 @@ where
     }
 }
 
-impl<F, A> Drop for Tendril<F, A>
+impl<F, A, I, Al> Drop for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn drop(&mut self) {
         unsafe {
             let p = self.ptr.get().get();
-            if p <= MAX_INLINE_TAG {
+            if p <= MAX_INLINE_TAG || p & STATIC != 0 {
                 return;
             }
 
@@ -257,7 +774,12 @@ where
                 let header = self.header();
                 if (*header).refcount.decrement() == 1 {
                     A::fence_acquire();
-                    buf.destroy();
+                    if p & EXTERNAL == 0 {
+                        buf.destroy();
+                    } else {
+                        let header = header as *mut ExternalHeader<A>;
+                        ((*header).release)(header);
+                    }
                 }
             } else {
                 buf.destroy();
@@ -269,9 +791,9 @@ where
 macro_rules! from_iter_method {
     ($ty:ty) => {
         #[inline]
-        fn from_iter<I>(iterable: I) -> Self
+        fn from_iter<T>(iterable: T) -> Self
         where
-            I: IntoIterator<Item = $ty>,
+            T: IntoIterator<Item = $ty>,
         {
             let mut output = Self::new();
             output.extend(iterable);
@@ -280,14 +802,16 @@ macro_rules! from_iter_method {
     };
 }
 
-impl<A> Extend<char> for Tendril<fmt::UTF8, A>
+impl<A, I, Al> Extend<char> for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = char>,
+        T: IntoIterator<Item = char>,
     {
         let iterator = iterable.into_iter();
         self.force_reserve(iterator.size_hint().0 as u32);
@@ -297,21 +821,25 @@ where
     }
 }
 
-impl<A> FromIterator<char> for Tendril<fmt::UTF8, A>
+impl<A, I, Al> FromIterator<char> for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     from_iter_method!(char);
 }
 
-impl<A> Extend<u8> for Tendril<fmt::Bytes, A>
+impl<A, I, Al> Extend<u8> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = u8>,
+        T: IntoIterator<Item = u8>,
     {
         let iterator = iterable.into_iter();
         self.force_reserve(iterator.size_hint().0 as u32);
@@ -321,21 +849,25 @@ where
     }
 }
 
-impl<A> FromIterator<u8> for Tendril<fmt::Bytes, A>
+impl<A, I, Al> FromIterator<u8> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     from_iter_method!(u8);
 }
 
-impl<'a, A> Extend<&'a u8> for Tendril<fmt::Bytes, A>
+impl<'a, A, I, Al> Extend<&'a u8> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = &'a u8>,
+        T: IntoIterator<Item = &'a u8>,
     {
         let iterator = iterable.into_iter();
         self.force_reserve(iterator.size_hint().0 as u32);
@@ -345,21 +877,25 @@ where
     }
 }
 
-impl<'a, A> FromIterator<&'a u8> for Tendril<fmt::Bytes, A>
+impl<'a, A, I, Al> FromIterator<&'a u8> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     from_iter_method!(&'a u8);
 }
 
-impl<'a, A> Extend<&'a str> for Tendril<fmt::UTF8, A>
+impl<'a, A, I, Al> Extend<&'a str> for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = &'a str>,
+        T: IntoIterator<Item = &'a str>,
     {
         for s in iterable {
             self.push_slice(s);
@@ -367,21 +903,25 @@ where
     }
 }
 
-impl<'a, A> FromIterator<&'a str> for Tendril<fmt::UTF8, A>
+impl<'a, A, I, Al> FromIterator<&'a str> for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     from_iter_method!(&'a str);
 }
 
-impl<'a, A> Extend<&'a [u8]> for Tendril<fmt::Bytes, A>
+impl<'a, A, I, Al> Extend<&'a [u8]> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = &'a [u8]>,
+        T: IntoIterator<Item = &'a [u8]>,
     {
         for s in iterable {
             self.push_slice(s);
@@ -389,22 +929,26 @@ where
     }
 }
 
-impl<'a, A> FromIterator<&'a [u8]> for Tendril<fmt::Bytes, A>
+impl<'a, A, I, Al> FromIterator<&'a [u8]> for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     from_iter_method!(&'a [u8]);
 }
 
-impl<'a, F, A> Extend<&'a Tendril<F, A>> for Tendril<F, A>
+impl<'a, F, A, I, Al> Extend<&'a Tendril<F, A, I, Al>> for Tendril<F, A, I, Al>
 where
     F: fmt::Format + 'a,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn extend<I>(&mut self, iterable: I)
+    fn extend<T>(&mut self, iterable: T)
     where
-        I: IntoIterator<Item = &'a Tendril<F, A>>,
+        T: IntoIterator<Item = &'a Tendril<F, A, I, Al>>,
     {
         for t in iterable {
             self.push_tendril(t);
@@ -412,18 +956,22 @@ where
     }
 }
 
-impl<'a, F, A> FromIterator<&'a Tendril<F, A>> for Tendril<F, A>
+impl<'a, F, A, I, Al> FromIterator<&'a Tendril<F, A, I, Al>> for Tendril<F, A, I, Al>
 where
     F: fmt::Format + 'a,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
-    from_iter_method!(&'a Tendril<F, A>);
+    from_iter_method!(&'a Tendril<F, A, I, Al>);
 }
 
-impl<F, A> Deref for Tendril<F, A>
+impl<F, A, I, Al> Deref for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     type Target = F::Slice;
 
@@ -433,10 +981,12 @@ where
     }
 }
 
-impl<F, A> DerefMut for Tendril<F, A>
+impl<F, A, I, Al> DerefMut for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn deref_mut(&mut self) -> &mut F::Slice {
@@ -444,10 +994,12 @@ where
     }
 }
 
-impl<F, A> Borrow<[u8]> for Tendril<F, A>
+impl<F, A, I, Al> Borrow<[u8]> for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     fn borrow(&self) -> &[u8] {
         self.as_byte_slice()
@@ -458,74 +1010,93 @@ where
 // and so a HashMap<StrTendril, _> would silently break if we indexed by str. Ick.
 // https://github.com/rust-lang/rust/issues/27108
 
-impl<F, A> PartialEq for Tendril<F, A>
+impl<F, A, I, Al> PartialEq for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn eq(&self, other: &Self) -> bool {
-        self.as_byte_slice() == other.as_byte_slice()
+        self.ptr_eq(other) || self.as_byte_slice() == other.as_byte_slice()
     }
 
     #[inline]
     fn ne(&self, other: &Self) -> bool {
-        self.as_byte_slice() != other.as_byte_slice()
+        !self.eq(other)
     }
 }
 
-impl<F, A> Eq for Tendril<F, A>
+impl<F, A, I, Al> Eq for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
 }
 
-impl<F, A> PartialOrd for Tendril<F, A>
+impl<F, A, I, Al> PartialOrd for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     <F as fmt::SliceFormat>::Slice: PartialOrd,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        if self.ptr_eq(other) {
+            return Some(Ordering::Equal);
+        }
         PartialOrd::partial_cmp(&**self, &**other)
     }
 }
 
-impl<F, A> Ord for Tendril<F, A>
+impl<F, A, I, Al> Ord for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     <F as fmt::SliceFormat>::Slice: Ord,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn cmp(&self, other: &Self) -> Ordering {
+        if self.ptr_eq(other) {
+            return Ordering::Equal;
+        }
         Ord::cmp(&**self, &**other)
     }
 }
 
-impl<F, A> Default for Tendril<F, A>
+impl<F, A, I, Al> Default for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline(always)]
-    fn default() -> Tendril<F, A> {
+    fn default() -> Tendril<F, A, I, Al> {
         Tendril::new()
     }
 }
 
-impl<F, A> strfmt::Debug for Tendril<F, A>
+impl<F, A, I, Al> strfmt::Debug for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat + Default + strfmt::Debug,
     <F as fmt::SliceFormat>::Slice: strfmt::Debug,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
         let kind = match self.ptr.get().get() {
             p if p <= MAX_INLINE_TAG => "inline",
+            p if p & STATIC != 0 => "static",
             p if p & 1 == 1 => "shared",
             _ => "owned",
         };
@@ -536,10 +1107,12 @@ where
     }
 }
 
-impl<F, A> hash::Hash for Tendril<F, A>
+impl<F, A, I, Al> hash::Hash for Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn hash<H: hash::Hasher>(&self, hasher: &mut H) {
@@ -547,22 +1120,24 @@ where
     }
 }
 
-impl<F, A> Tendril<F, A>
+impl<F, A, I, Al> Tendril<F, A, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     /// Create a new, empty `Tendril` in any format.
     #[inline(always)]
-    pub fn new() -> Tendril<F, A> {
+    pub fn new() -> Tendril<F, A, I, Al> {
         unsafe { Tendril::inline(&[]) }
     }
 
     /// Create a new, empty `Tendril` with a specified capacity.
     #[inline]
-    pub fn with_capacity(capacity: u32) -> Tendril<F, A> {
-        let mut t: Tendril<F, A> = Tendril::new();
-        if capacity > MAX_INLINE_LEN as u32 {
+    pub fn with_capacity(capacity: u32) -> Tendril<F, A, I, Al> {
+        let mut t: Tendril<F, A, I, Al> = Tendril::new();
+        if capacity > I::LEN as u32 {
             unsafe {
                 t.make_owned_with_capacity(capacity);
             }
@@ -587,7 +1162,7 @@ where
     #[inline]
     fn force_reserve(&mut self, additional: u32) {
         let new_len = self.len32().checked_add(additional).expect(OFLOW);
-        if new_len > MAX_INLINE_LEN as u32 {
+        if new_len > I::LEN as u32 {
             unsafe {
                 self.make_owned_with_capacity(new_len);
             }
@@ -602,7 +1177,7 @@ where
     pub fn len32(&self) -> u32 {
         match self.ptr.get().get() {
             EMPTY_TAG => 0,
-            n if n <= MAX_INLINE_LEN => n as u32,
+            n if n <= I::LEN => n as u32,
             _ => unsafe { self.raw_len() },
         }
     }
@@ -617,12 +1192,120 @@ where
 
     /// Is the backing buffer shared with this other `Tendril`?
     #[inline]
-    pub fn is_shared_with(&self, other: &Tendril<F, A>) -> bool {
+    pub fn is_shared_with(&self, other: &Tendril<F, A, I, Al>) -> bool {
         let n = self.ptr.get().get();
 
         (n > MAX_INLINE_TAG) && (n == other.ptr.get().get())
     }
 
+    /// Are these the same bytes in the same place? That is, either both are
+    /// stored in-line with equal contents, or both span the same range of
+    /// the same buffer. Either way they are equal, and this is cheaper to
+    /// check than `==`.
+    ///
+    /// Tendrils from the same `Interner` are equal exactly when this holds.
+    #[inline]
+    pub fn ptr_eq(&self, other: &Tendril<F, A, I, Al>) -> bool {
+        let n = self.ptr.get().get();
+        if n != other.ptr.get().get() {
+            return false;
+        }
+        if n <= MAX_INLINE_TAG {
+            return self.as_byte_slice() == other.as_byte_slice();
+        }
+        unsafe { self.len32() == other.len32() && self.aux() == other.aux() }
+    }
+
+    /// The byte index at which this `Tendril` first differs from another,
+    /// or `None` if they are equal. If one is a prefix of the other, this
+    /// is the length of the shorter.
+    ///
+    /// This is an index into the bytes, and may not fall on a character
+    /// boundary. Long tendrils are compared many bytes at a time, with SIMD
+    /// where the CPU supports it.
+    #[inline]
+    pub fn mismatch_index(&self, other: &Tendril<F, A, I, Al>) -> Option<u32> {
+        if self.ptr_eq(other) {
+            return None;
+        }
+        simd::mismatch(self.as_byte_slice(), other.as_byte_slice()).map(|i| i as u32)
+    }
+
+    /// The length in bytes of the longest common prefix of this `Tendril`
+    /// and another. Like `mismatch_index`, this may not fall on a character
+    /// boundary.
+    #[inline]
+    pub fn common_prefix_len(&self, other: &Tendril<F, A, I, Al>) -> u32 {
+        self.mismatch_index(other).unwrap_or(self.len32())
+    }
+
+    /// Attach metadata to this `Tendril`, such as the source file and
+    /// position it was read from.
+    ///
+    /// The metadata is kept with the buffer, and every subtendril of this
+    /// `Tendril` can retrieve it along with its own byte offset, using
+    /// `metadata()`. Subtendrils of a buffer with metadata are never stored
+    /// in-line. Mutating a `Tendril` copies it to a new buffer, which has no
+    /// metadata.
+    ///
+    /// This replaces any metadata already attached. It costs two small
+    /// allocations, but does not copy the contents.
+    pub fn attach_metadata<M>(&mut self, metadata: M)
+    where
+        M: Any + Send + Sync,
+    {
+        self.attach_metadata_arc(Arc::new(metadata))
+    }
+
+    /// Attach the metadata of another `Tendril`'s buffer, if any, to this
+    /// `Tendril`.
+    ///
+    /// Offsets reported by `metadata()` are relative to this `Tendril`.
+    pub fn attach_metadata_from<G, J>(&mut self, other: &Tendril<G, A, J, Al>)
+    where
+        G: fmt::Format,
+        J: InlineCapacity,
+    {
+        if let Some(metadata) = other.metadata_arc() {
+            self.attach_metadata_arc(metadata.clone())
+        }
+    }
+
+    /// Get the metadata attached to this `Tendril`'s buffer, and the byte
+    /// offset of this `Tendril` within that buffer.
+    ///
+    /// Returns `None` if there is no metadata or it is not of type `M`.
+    #[inline]
+    pub fn metadata<M>(&self) -> Option<(&M, u32)>
+    where
+        M: Any,
+    {
+        let metadata = self.metadata_arc()?.downcast_ref::<M>()?;
+        Some((metadata, unsafe { self.aux() }))
+    }
+
+    #[inline]
+    fn metadata_arc(&self) -> Option<&Arc<dyn Any + Send + Sync>> {
+        if !self.is_external() {
+            return None;
+        }
+        unsafe {
+            let header = self.header() as *const ExternalHeader<A>;
+            (*header).metadata.as_ref()
+        }
+    }
+
+    fn attach_metadata_arc(&mut self, metadata: Arc<dyn Any + Send + Sync>) {
+        unsafe {
+            // Box the old tendril, so that in-line bytes have a stable address.
+            let owner: Box<Tendril<fmt::Bytes, A, I, Al>> =
+                Box::new(mem::replace(self, Tendril::new()).cast());
+            let bytes = owner.as_byte_slice();
+            *self =
+                Tendril::boxed_external(bytes.as_ptr(), bytes.len() as u32, owner, Some(metadata));
+        }
+    }
+
     /// Truncate to length 0 without discarding any owned storage.
     #[inline]
     pub fn clear(&mut self) {
@@ -642,42 +1325,53 @@ where
 
     /// Build a `Tendril` by copying a byte slice, if it conforms to the format.
     #[inline]
-    pub fn try_from_byte_slice(x: &[u8]) -> Result<Tendril<F, A>, ()> {
+    pub fn try_from_byte_slice(x: &[u8]) -> Result<Tendril<F, A, I, Al>, ()> {
         match F::validate(x) {
             true => Ok(unsafe { Tendril::from_byte_slice_without_validating(x) }),
             false => Err(()),
         }
     }
 
+    /// Build a `Tendril` on the bytes of a `Vec<u8>`, if they conform to the
+    /// format, or give the `Vec` back. See `from_vec`.
+    #[inline]
+    pub fn try_from_vec(v: Vec<u8>) -> Result<Tendril<F, A, I, Al>, Vec<u8>> {
+        match F::validate(&v) {
+            true => Ok(unsafe { Tendril::from_vec_without_validating(v) }),
+            false => Err(v),
+        }
+    }
+
     /// View as uninterpreted bytes.
     #[inline(always)]
-    pub fn as_bytes(&self) -> &Tendril<fmt::Bytes, A> {
+    pub fn as_bytes(&self) -> &Tendril<fmt::Bytes, A, I, Al> {
         unsafe { mem::transmute(self) }
     }
 
     /// Convert into uninterpreted bytes.
     #[inline(always)]
-    pub fn into_bytes(self) -> Tendril<fmt::Bytes, A> {
-        unsafe { mem::transmute(self) }
+    pub fn into_bytes(self) -> Tendril<fmt::Bytes, A, I, Al> {
+        unsafe { self.cast() }
     }
 
     /// Convert `self` into a type which is `Send`.
     ///
-    /// If the tendril is owned or inline, this is free,
-    /// but if it's shared this will entail a copy of the contents.
+    /// If the tendril is owned or inline, or the last reference to a shared
+    /// buffer, this is free, but otherwise this will entail a copy of the
+    /// contents.
     #[inline]
-    pub fn into_send(mut self) -> SendTendril<F> {
+    pub fn into_send(mut self) -> SendTendril<F, I, Al> {
         self.make_owned();
         SendTendril {
             // This changes the header.refcount from A to NonAtomic, but that's
             // OK because we have defined the format of A as a usize.
-            tendril: unsafe { mem::transmute(self) },
+            tendril: unsafe { self.cast() },
         }
     }
 
     /// View as a superset format, for free.
     #[inline(always)]
-    pub fn as_superset<Super>(&self) -> &Tendril<Super, A>
+    pub fn as_superset<Super>(&self) -> &Tendril<Super, A, I, Al>
     where
         F: fmt::SubsetOf<Super>,
         Super: fmt::Format,
@@ -687,17 +1381,17 @@ where
 
     /// Convert into a superset format, for free.
     #[inline(always)]
-    pub fn into_superset<Super>(self) -> Tendril<Super, A>
+    pub fn into_superset<Super>(self) -> Tendril<Super, A, I, Al>
     where
         F: fmt::SubsetOf<Super>,
         Super: fmt::Format,
     {
-        unsafe { mem::transmute(self) }
+        unsafe { self.cast() }
     }
 
     /// View as a subset format, if the `Tendril` conforms to that subset.
     #[inline]
-    pub fn try_as_subset<Sub>(&self) -> Result<&Tendril<Sub, A>, ()>
+    pub fn try_as_subset<Sub>(&self) -> Result<&Tendril<Sub, A, I, Al>, ()>
     where
         Sub: fmt::SubsetOf<F>,
     {
@@ -709,12 +1403,12 @@ where
 
     /// Convert into a subset format, if the `Tendril` conforms to that subset.
     #[inline]
-    pub fn try_into_subset<Sub>(self) -> Result<Tendril<Sub, A>, Self>
+    pub fn try_into_subset<Sub>(self) -> Result<Tendril<Sub, A, I, Al>, Self>
     where
         Sub: fmt::SubsetOf<F>,
     {
         match Sub::revalidate_subset(self.as_byte_slice()) {
-            true => Ok(unsafe { mem::transmute(self) }),
+            true => Ok(unsafe { self.cast() }),
             false => Err(self),
         }
     }
@@ -722,7 +1416,7 @@ where
     /// View as another format, if the bytes of the `Tendril` are valid for
     /// that format.
     #[inline]
-    pub fn try_reinterpret_view<Other>(&self) -> Result<&Tendril<Other, A>, ()>
+    pub fn try_reinterpret_view<Other>(&self) -> Result<&Tendril<Other, A, I, Al>, ()>
     where
         Other: fmt::Format,
     {
@@ -739,12 +1433,12 @@ where
     ///
     /// See the `encode` and `decode` methods for character encoding conversion.
     #[inline]
-    pub fn try_reinterpret<Other>(self) -> Result<Tendril<Other, A>, Self>
+    pub fn try_reinterpret<Other>(self) -> Result<Tendril<Other, A, I, Al>, Self>
     where
         Other: fmt::Format,
     {
         match Other::validate(self.as_byte_slice()) {
-            true => Ok(unsafe { mem::transmute(self) }),
+            true => Ok(unsafe { self.cast() }),
             false => Err(self),
         }
     }
@@ -764,7 +1458,7 @@ where
 
     /// Push another `Tendril` onto the end of this one.
     #[inline]
-    pub fn push_tendril(&mut self, other: &Tendril<F, A>) {
+    pub fn push_tendril(&mut self, other: &Tendril<F, A, I, Al>) {
         let new_len = self.len32().checked_add(other.len32()).expect(OFLOW);
 
         unsafe {
@@ -799,7 +1493,7 @@ where
         &self,
         offset: u32,
         length: u32,
-    ) -> Result<Tendril<F, A>, SubtendrilError> {
+    ) -> Result<Tendril<F, A, I, Al>, SubtendrilError> {
         let self_len = self.len32();
         if offset > self_len || length > (self_len - offset) {
             return Err(SubtendrilError::OutOfBounds);
@@ -819,7 +1513,7 @@ where
     ///
     /// Panics on bounds or validity check failure.
     #[inline]
-    pub fn subtendril(&self, offset: u32, length: u32) -> Tendril<F, A> {
+    pub fn subtendril(&self, offset: u32, length: u32) -> Tendril<F, A, I, Al> {
         self.try_subtendril(offset, length).unwrap()
     }
 
@@ -895,9 +1589,78 @@ where
         self.try_pop_back(n).unwrap()
     }
 
+    /// Attempt to split this `Tendril` in two at byte index `mid`.
+    ///
+    /// Both halves share the buffer when possible. Returns `Err` if `mid`
+    /// is out of bounds, or if the cut would split a character.
+    #[inline]
+    pub fn try_split_at(
+        &self,
+        mid: u32,
+    ) -> Result<(Tendril<F, A, I, Al>, Tendril<F, A, I, Al>), SubtendrilError> {
+        let len = self.len32();
+        if mid > len {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        if !self.is_cut(mid) {
+            return Err(SubtendrilError::ValidationFailed);
+        }
+        unsafe {
+            Ok((
+                self.unsafe_subtendril(0, mid),
+                self.unsafe_subtendril(mid, len - mid),
+            ))
+        }
+    }
+
+    /// Split this `Tendril` in two at byte index `mid`.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn split_at(&self, mid: u32) -> (Tendril<F, A, I, Al>, Tendril<F, A, I, Al>) {
+        self.try_split_at(mid).unwrap()
+    }
+
+    /// Attempt to split off the bytes from index `at` onwards, returning
+    /// them as a new `Tendril` which shares the buffer when possible.
+    ///
+    /// Returns `Err`, leaving `self` as it was, if `at` is out of bounds or
+    /// if the cut would split a character.
+    #[inline]
+    pub fn try_split_off(&mut self, at: u32) -> Result<Tendril<F, A, I, Al>, SubtendrilError> {
+        let len = self.len32();
+        if at > len {
+            return Err(SubtendrilError::OutOfBounds);
+        }
+        if !self.is_cut(at) {
+            return Err(SubtendrilError::ValidationFailed);
+        }
+        unsafe {
+            let tail = self.unsafe_subtendril(at, len - at);
+            self.unsafe_pop_back(len - at);
+            Ok(tail)
+        }
+    }
+
+    /// Split off the bytes from index `at` onwards.
+    ///
+    /// Panics on bounds or validity check failure.
+    #[inline]
+    pub fn split_off(&mut self, at: u32) -> Tendril<F, A, I, Al> {
+        self.try_split_off(at).unwrap()
+    }
+
+    /// Could the contents be cut in two at byte index `i`, which must be in
+    /// bounds, leaving both sides valid?
+    #[inline]
+    fn is_cut(&self, i: u32) -> bool {
+        let (prefix, suffix) = self.as_byte_slice().split_at(i as usize);
+        F::validate_prefix(prefix) && F::validate_suffix(suffix)
+    }
+
     /// View as another format, without validating.
     #[inline(always)]
-    pub unsafe fn reinterpret_view_without_validating<Other>(&self) -> &Tendril<Other, A>
+    pub unsafe fn reinterpret_view_without_validating<Other>(&self) -> &Tendril<Other, A, I, Al>
     where
         Other: fmt::Format,
     {
@@ -906,24 +1669,77 @@ where
 
     /// Convert into another format, without validating.
     #[inline(always)]
-    pub unsafe fn reinterpret_without_validating<Other>(self) -> Tendril<Other, A>
+    pub unsafe fn reinterpret_without_validating<Other>(self) -> Tendril<Other, A, I, Al>
     where
         Other: fmt::Format,
     {
-        mem::transmute(self)
+        self.cast()
     }
 
     /// Build a `Tendril` by copying a byte slice, without validating.
     #[inline]
-    pub unsafe fn from_byte_slice_without_validating(x: &[u8]) -> Tendril<F, A> {
+    pub unsafe fn from_byte_slice_without_validating(x: &[u8]) -> Tendril<F, A, I, Al> {
         assert!(x.len() <= buf32::MAX_LEN);
-        if x.len() <= MAX_INLINE_LEN {
+        if x.len() <= I::LEN {
             Tendril::inline(x)
         } else {
             Tendril::owned_copy(x)
         }
     }
 
+    /// Build a `Tendril` on the bytes of a `Vec<u8>`, without copying or
+    /// validating them. See `from_vec`.
+    pub unsafe fn from_vec_without_validating(mut v: Vec<u8>) -> Tendril<F, A, I, Al> {
+        assert!(v.len() <= buf32::MAX_LEN);
+        if v.len() <= I::LEN {
+            return Tendril::inline(&v);
+        }
+        let (data, len, capacity) = (v.as_mut_ptr(), v.len(), v.capacity());
+        mem::forget(v);
+        let header =
+            ExternalHeader::new(data, len as u32, release_vec_fn::<A>(), capacity as *mut ());
+
+        // Put the header in spare capacity if it fits, or else box it.
+        let size = mem::size_of::<ExternalHeader<A>>();
+        let align = mem::align_of::<ExternalHeader<A>>();
+        let spare = (data as usize + len + align - 1) & !(align - 1);
+        let header = if spare + size <= data as usize + capacity {
+            let spare = spare as *mut ExternalHeader<A>;
+            ptr::write(spare, header);
+            spare
+        } else {
+            Box::into_raw(Box::new(header))
+        };
+        Tendril::external(header)
+    }
+
+    /// Convert into a `Vec<u8>` of the bytes.
+    ///
+    /// This is free for a `Tendril` built on a `Vec<u8>` or `String` which
+    /// starts at the beginning of it and is the last `Tendril` on it.
+    /// Otherwise the bytes are copied: buffers that `Tendril` allocates
+    /// itself start with a header, so a `Vec` cannot take them over.
+    pub fn into_vec(self) -> Vec<u8> {
+        unsafe {
+            if self.is_external() && self.aux() == 0 {
+                let header = self.header() as *mut ExternalHeader<NonAtomic>;
+                if (*header).release as usize == release_vec as usize
+                    && (*(header as *mut ExternalHeader<A>))
+                        .header
+                        .refcount
+                        .is_unique()
+                {
+                    let len = self.len32() as usize;
+                    mem::forget(self);
+                    let mut v = reclaim_vec(header);
+                    v.truncate(len);
+                    return v;
+                }
+            }
+            self.as_byte_slice().to_vec()
+        }
+    }
+
     /// Push some bytes onto the end of the `Tendril`, without validating.
     #[inline]
     pub unsafe fn push_bytes_without_validating(&mut self, buf: &[u8]) {
@@ -944,11 +1760,11 @@ where
         let drop_left = drop_left as usize;
         let drop_right = drop_right as usize;
 
-        if new_len <= MAX_INLINE_LEN as u32 {
-            let mut tmp = [0_u8; MAX_INLINE_LEN];
+        if new_len <= I::LEN as u32 {
+            let tmp: Tendril<F, A, I, Al> = Tendril::inline(&[]);
             {
                 let old = self.as_byte_slice();
-                let mut dest = tmp.as_mut_ptr();
+                let mut dest = tmp.inline_ptr();
                 copy_and_advance(&mut dest, unsafe_slice(old, 0, old.len() - drop_left));
                 copy_and_advance(
                     &mut dest,
@@ -959,8 +1775,15 @@ where
                     unsafe_slice(buf, drop_right, buf.len() - drop_right),
                 );
             }
-            *self = Tendril::inline(&tmp[..new_len as usize]);
+            tmp.ptr.set(inline_tag(new_len));
+            *self = tmp;
         } else {
+            if drop_left == 0
+                && insert_len == 0
+                && self.try_push_in_place(unsafe_slice(buf, drop_right, buf.len() - drop_right))
+            {
+                return;
+            }
             self.make_owned_with_capacity(new_len);
             let (owned, _, _) = self.assume_buf();
             let mut dest = owned
@@ -978,12 +1801,42 @@ where
         }
     }
 
+    /// Append to a shared buffer without copying, if this `Tendril` ends
+    /// where the buffer's used bytes do and there is room after them. Other
+    /// `Tendril`s on the buffer do not see the new bytes.
+    #[inline]
+    unsafe fn try_push_in_place(&mut self, x: &[u8]) -> bool {
+        let p = self.ptr.get().get();
+        if p <= MAX_INLINE_TAG || p & TAGS != 1 {
+            return false;
+        }
+        let (buf, _, offset) = self.assume_buf();
+        let end = offset + self.raw_len();
+        let new_end = match end.checked_add(x.len() as u32) {
+            Some(n) if n <= buf.cap => n,
+            _ => return false,
+        };
+        let claimed = (*buf.ptr).used.compare_exchange(
+            end,
+            new_end,
+            AtomicOrdering::Relaxed,
+            AtomicOrdering::Relaxed,
+        );
+        if claimed.is_err() {
+            return false;
+        }
+        let dest = buf.data_ptr().offset(end as isize);
+        ptr::copy_nonoverlapping(x.as_ptr(), dest, x.len());
+        self.set_len(new_end - offset);
+        true
+    }
+
     /// Slice this `Tendril` as a new `Tendril`.
     ///
     /// Does not check validity or bounds!
     #[inline]
-    pub unsafe fn unsafe_subtendril(&self, offset: u32, length: u32) -> Tendril<F, A> {
-        if length <= MAX_INLINE_LEN as u32 {
+    pub unsafe fn unsafe_subtendril(&self, offset: u32, length: u32) -> Tendril<F, A, I, Al> {
+        if length <= I::LEN as u32 && self.metadata_arc().is_none() {
             Tendril::inline(unsafe_slice(
                 self.as_byte_slice(),
                 offset as usize,
@@ -992,8 +1845,13 @@ where
         } else {
             self.make_buf_shared();
             self.incref();
-            let (buf, _, _) = self.assume_buf();
-            Tendril::shared(buf, self.aux() + offset, length)
+            let t = Tendril::new();
+            t.ptr.set(self.ptr.get());
+            (*t.buf.get()).heap = Heap {
+                len: length,
+                aux: self.aux() + offset,
+            };
+            t
         }
     }
 
@@ -1003,7 +1861,7 @@ where
     #[inline]
     pub unsafe fn unsafe_pop_front(&mut self, n: u32) {
         let new_len = self.len32() - n;
-        if new_len <= MAX_INLINE_LEN as u32 {
+        if new_len <= I::LEN as u32 && self.metadata_arc().is_none() {
             *self = Tendril::inline(unsafe_slice(
                 self.as_byte_slice(),
                 n as usize,
@@ -1023,7 +1881,7 @@ where
     #[inline]
     pub unsafe fn unsafe_pop_back(&mut self, n: u32) {
         let new_len = self.len32() - n;
-        if new_len <= MAX_INLINE_LEN as u32 {
+        if new_len <= I::LEN as u32 && self.metadata_arc().is_none() {
             *self = Tendril::inline(unsafe_slice(self.as_byte_slice(), 0, new_len as usize));
         } else {
             self.make_buf_shared();
@@ -1034,7 +1892,9 @@ where
 
     #[inline]
     unsafe fn incref(&self) {
-        (*self.header()).refcount.increment();
+        if !self.is_static() {
+            (*self.header()).refcount.increment();
+        }
     }
 
     #[inline]
@@ -1043,6 +1903,12 @@ where
         if p & 1 == 0 {
             let header = p as *mut Header<A>;
             (*header).cap = self.aux();
+            (*header)
+                .used
+                .store(self.raw_len(), AtomicOrdering::Relaxed);
+            // The buffer may have been made with another `Atomicity`, or on
+            // another thread; see `From<SendTendril>`.
+            ptr::write(&mut (*header).refcount, A::new());
 
             self.ptr.set(NonZeroUsize::new_unchecked(p | 1));
             self.set_aux(0);
@@ -1052,18 +1918,49 @@ where
     // This is not public as it is of no practical value to users.
     // By and large they shouldn't need to worry about the distinction at all,
     // and going out of your way to make it owned is pointless.
+    //
+    // A shared buffer which no other `Tendril` refers to any more, as after
+    // taking a subtendril and dropping the parent, is taken back rather than
+    // copied.
     #[inline]
     fn make_owned(&mut self) {
         unsafe {
             let ptr = self.ptr.get().get();
             if ptr <= MAX_INLINE_TAG || (ptr & 1) == 1 {
-                *self = Tendril::owned_copy(self.as_byte_slice());
+                if ptr > MAX_INLINE_TAG && ptr & TAGS == 1 && (*self.header()).refcount.is_unique()
+                {
+                    self.unshare();
+                } else {
+                    *self = Tendril::owned_copy(self.as_byte_slice());
+                }
             }
         }
     }
 
+    /// Make a shared buffer with no other references owned again, moving
+    /// the bytes to the front.
+    #[inline(never)]
+    unsafe fn unshare(&mut self) {
+        let (buf, _, offset) = self.assume_buf();
+        if offset != 0 {
+            let data = buf.data_ptr();
+            ptr::copy(data.offset(offset as isize), data, self.len32() as usize);
+        }
+        self.ptr.set(NonZeroUsize::new_unchecked(buf.ptr as usize));
+        self.set_aux(buf.cap);
+    }
+
     #[inline]
     unsafe fn make_owned_with_capacity(&mut self, cap: u32) {
+        let p = self.ptr.get().get();
+        if p <= MAX_INLINE_TAG
+            || (p & 1 == 1 && (p & TAGS != 1 || !(*self.header()).refcount.is_unique()))
+        {
+            // Copy straight into a buffer of the full size, rather than
+            // copying and then growing.
+            *self = Tendril::owned_copy_with_capacity(self.as_byte_slice(), cap);
+            return;
+        }
         self.make_owned();
         let mut buf = self.assume_buf().0;
         buf.grow(cap);
@@ -1073,15 +1970,77 @@ where
 
     #[inline(always)]
     unsafe fn header(&self) -> *mut Header<A> {
-        (self.ptr.get().get() & !1) as *mut Header<A>
+        (self.ptr.get().get() & !TAGS) as *mut Header<A>
+    }
+
+    #[inline(always)]
+    fn is_external(&self) -> bool {
+        let p = self.ptr.get().get();
+        (p > MAX_INLINE_TAG) && (p & EXTERNAL != 0)
+    }
+
+    #[inline(always)]
+    fn is_static(&self) -> bool {
+        let p = self.ptr.get().get();
+        (p > MAX_INLINE_TAG) && (p & STATIC != 0)
+    }
+
+    /// Build a `Tendril` on `'static` bytes, stored in-line if they fit.
+    #[inline]
+    unsafe fn from_static_bytes_without_validating(x: &'static [u8]) -> Tendril<F, A, I, Al> {
+        if x.len() <= I::LEN {
+            return Tendril::inline(x);
+        }
+        assert!(x.len() <= buf32::MAX_LEN);
+        let addr = x.as_ptr() as usize;
+        let t = Tendril::new();
+        debug_assert!(addr & !TAGS > MAX_INLINE_TAG);
+        t.ptr
+            .set(NonZeroUsize::new_unchecked((addr & !TAGS) | STATIC | 1));
+        (*t.buf.get()).heap = Heap {
+            len: x.len() as u32,
+            aux: (addr & TAGS) as u32,
+        };
+        t
+    }
+
+    /// Build a shared `Tendril` on bytes kept alive by `owner`.
+    #[inline]
+    unsafe fn boxed_external<T>(
+        data: *const u8,
+        len: u32,
+        owner: Box<T>,
+        metadata: Option<Arc<dyn Any + Send + Sync>>,
+    ) -> Tendril<F, A, I, Al> {
+        let owner = Box::into_raw(owner) as *mut ();
+        let mut header = ExternalHeader::new(data, len, release_boxed::<A, T>, owner);
+        header.metadata = metadata;
+        Tendril::external(Box::into_raw(Box::new(header)))
+    }
+
+    /// Build a shared `Tendril` on the whole of an `ExternalHeader`'s
+    /// bytes, taking over its initial reference.
+    #[inline]
+    unsafe fn external(header: *mut ExternalHeader<A>) -> Tendril<F, A, I, Al> {
+        let t = Tendril::new();
+        t.ptr
+            .set(NonZeroUsize::new_unchecked(header as usize | 1 | EXTERNAL));
+        (*t.buf.get()).heap = Heap {
+            len: (*header).header.cap,
+            aux: 0,
+        };
+        t
     }
 
     #[inline]
-    unsafe fn assume_buf(&self) -> (Buf32<Header<A>>, bool, u32) {
+    unsafe fn assume_buf(&self) -> (Buf32<Header<A>, Al>, bool, u32) {
         let ptr = self.ptr.get().get();
         let header = self.header();
         let shared = (ptr & 1) == 1;
         let (cap, offset) = match shared {
+            // There is no header to read, and nothing uses the capacity of
+            // a shared buffer except to free it.
+            true if ptr & STATIC != 0 => (0, self.aux()),
             true => ((*header).cap, self.aux()),
             false => (self.aux(), 0),
         };
@@ -1091,6 +2050,7 @@ where
                 ptr: header,
                 len: offset + self.len32(),
                 cap: cap,
+                marker: PhantomData,
             },
             shared,
             offset,
@@ -1098,20 +2058,39 @@ where
     }
 
     #[inline]
-    unsafe fn inline(x: &[u8]) -> Tendril<F, A> {
+    unsafe fn inline(x: &[u8]) -> Tendril<F, A, I, Al> {
         let len = x.len();
-        let t = Tendril {
+        let t: Tendril<F, A, I, Al> = Tendril {
             ptr: Cell::new(inline_tag(len as u32)),
-            buf: UnsafeCell::new(Buffer { inline: [0; 8] }),
+            buf: UnsafeCell::new(mem::zeroed()),
             marker: PhantomData,
             refcount_marker: PhantomData,
+            alloc_marker: PhantomData,
         };
-        ptr::copy_nonoverlapping(x.as_ptr(), (*t.buf.get()).inline.as_mut_ptr(), len);
+        ptr::copy_nonoverlapping(x.as_ptr(), t.inline_ptr(), len);
+        t
+    }
+
+    /// Change the format and atomicity parameters, neither of which affect
+    /// the layout.
+    #[inline(always)]
+    unsafe fn cast<G, B>(self) -> Tendril<G, B, I, Al>
+    where
+        G: fmt::Format,
+        B: Atomicity,
+    {
+        let t = ptr::read(&self as *const Self as *const Tendril<G, B, I, Al>);
+        mem::forget(self);
         t
     }
 
+    #[inline(always)]
+    unsafe fn inline_ptr(&self) -> *mut u8 {
+        &mut (*self.buf.get()).inline as *mut I::Storage as *mut u8
+    }
+
     #[inline]
-    unsafe fn owned(x: Buf32<Header<A>>) -> Tendril<F, A> {
+    unsafe fn owned(x: Buf32<Header<A>, Al>) -> Tendril<F, A, I, Al> {
         Tendril {
             ptr: Cell::new(NonZeroUsize::new_unchecked(x.ptr as usize)),
             buf: UnsafeCell::new(Buffer {
@@ -1122,36 +2101,49 @@ where
             }),
             marker: PhantomData,
             refcount_marker: PhantomData,
+            alloc_marker: PhantomData,
         }
     }
 
     #[inline]
-    unsafe fn owned_copy(x: &[u8]) -> Tendril<F, A> {
+    unsafe fn owned_copy(x: &[u8]) -> Tendril<F, A, I, Al> {
+        Tendril::owned_copy_with_capacity(x, 0)
+    }
+
+    #[inline]
+    unsafe fn owned_copy_with_capacity(x: &[u8], cap: u32) -> Tendril<F, A, I, Al> {
         let len32 = x.len() as u32;
-        let mut b = Buf32::with_capacity(len32, Header::new());
+        let mut b = Buf32::with_capacity(cmp::max(len32, cap), Header::new());
         ptr::copy_nonoverlapping(x.as_ptr(), b.data_ptr(), x.len());
         b.len = len32;
         Tendril::owned(b)
     }
 
-    #[inline]
-    unsafe fn shared(buf: Buf32<Header<A>>, off: u32, len: u32) -> Tendril<F, A> {
-        Tendril {
-            ptr: Cell::new(NonZeroUsize::new_unchecked((buf.ptr as usize) | 1)),
-            buf: UnsafeCell::new(Buffer {
-                heap: Heap { len, aux: off },
-            }),
-            marker: PhantomData,
-            refcount_marker: PhantomData,
-        }
-    }
-
     #[inline]
     fn as_byte_slice<'a>(&'a self) -> &'a [u8] {
         unsafe {
             match self.ptr.get().get() {
                 EMPTY_TAG => &[],
-                n if n <= MAX_INLINE_LEN => (*self.buf.get()).inline.get_unchecked(..n),
+                n if n <= I::LEN => {
+                    copy_lifetime(self, slice::from_raw_parts(self.inline_ptr(), n))
+                }
+                p if p & STATIC != 0 => copy_lifetime(
+                    self,
+                    slice::from_raw_parts(
+                        ((p & !TAGS) + self.aux() as usize) as *const u8,
+                        self.len32() as usize,
+                    ),
+                ),
+                p if p & EXTERNAL != 0 => {
+                    let header = self.header() as *const ExternalHeader<A>;
+                    copy_lifetime(
+                        self,
+                        slice::from_raw_parts(
+                            (*header).data.offset(self.aux() as isize),
+                            self.len32() as usize,
+                        ),
+                    )
+                }
                 _ => {
                     let (buf, _, offset) = self.assume_buf();
                     copy_lifetime(
@@ -1170,7 +2162,9 @@ where
         unsafe {
             match self.ptr.get().get() {
                 EMPTY_TAG => &mut [],
-                n if n <= MAX_INLINE_LEN => (*self.buf.get()).inline.get_unchecked_mut(..n),
+                n if n <= I::LEN => {
+                    copy_lifetime_mut(self, slice::from_raw_parts_mut(self.inline_ptr(), n))
+                }
                 _ => {
                     self.make_owned();
                     let (mut buf, _, offset) = self.assume_buf();
@@ -1198,17 +2192,32 @@ where
     }
 }
 
-impl<F, A> Tendril<F, A>
+impl<F, A, I, Al> Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     /// Build a `Tendril` by copying a slice.
     #[inline]
-    pub fn from_slice(x: &F::Slice) -> Tendril<F, A> {
+    pub fn from_slice(x: &F::Slice) -> Tendril<F, A, I, Al> {
         unsafe { Tendril::from_byte_slice_without_validating(x.as_bytes()) }
     }
 
+    /// Build a `Tendril` on a `'static` slice, such as a literal, without
+    /// copying it.
+    ///
+    /// Slices which fit in-line are copied there. Longer ones are borrowed:
+    /// the `Tendril` is shared, cloning or dropping it touches no reference
+    /// count, and its bytes are copied only when it is mutated.
+    ///
+    /// See also the `static_tendril!` macro.
+    #[inline]
+    pub fn from_static(x: &'static F::Slice) -> Tendril<F, A, I, Al> {
+        unsafe { Tendril::from_static_bytes_without_validating(x.as_bytes()) }
+    }
+
     /// Push a slice onto the end of the `Tendril`.
     #[inline]
     pub fn push_slice(&mut self, x: &F::Slice) {
@@ -1216,6 +2225,26 @@ where
     }
 }
 
+impl<A, I, Al> Tendril<fmt::Bytes, A, I, Al>
+where
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Build a `Tendril` on the bytes of a `Vec<u8>`, without copying them.
+    ///
+    /// Bytes which fit in-line are copied there. Otherwise the `Tendril`
+    /// takes over the `Vec`'s buffer, and is shared, so its bytes are copied
+    /// when it is mutated. The header goes in the `Vec`'s spare capacity if
+    /// there is room, or else in a separate allocation.
+    ///
+    /// See `into_vec` for the way back.
+    #[inline]
+    pub fn from_vec(v: Vec<u8>) -> Tendril<fmt::Bytes, A, I, Al> {
+        unsafe { Tendril::from_vec_without_validating(v) }
+    }
+}
+
 /// A simple wrapper to make `Tendril` `Send`.
 ///
 /// Although there is a certain subset of the operations on a `Tendril` that a `SendTendril` could
@@ -1226,37 +2255,283 @@ where
 /// A `SendTendril` may be produced by `Tendril.into_send()` or `SendTendril::from(tendril)`,
 /// and may be returned to a `Tendril` by `Tendril::from(self)`.
 #[derive(Clone)]
-pub struct SendTendril<F>
+pub struct SendTendril<F, I = Inline8, Al = Global>
 where
     F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
 {
-    tendril: Tendril<F>,
+    tendril: Tendril<F, NonAtomic, I, Al>,
 }
 
-unsafe impl<F> Send for SendTendril<F> where F: fmt::Format {}
+unsafe impl<F, I, Al> Send for SendTendril<F, I, Al>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+}
 
-impl<F, A> From<Tendril<F, A>> for SendTendril<F>
+impl<F, A, I, Al> From<Tendril<F, A, I, Al>> for SendTendril<F, I, Al>
 where
     F: fmt::Format,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn from(tendril: Tendril<F, A>) -> SendTendril<F> {
+    fn from(tendril: Tendril<F, A, I, Al>) -> SendTendril<F, I, Al> {
         tendril.into_send()
     }
 }
 
-impl<F, A> From<SendTendril<F>> for Tendril<F, A>
+impl<F, A, I, Al> From<SendTendril<F, I, Al>> for Tendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn from(send: SendTendril<F, I, Al>) -> Tendril<F, A, I, Al> {
+        unsafe { send.tendril.cast() }
+        // header.refcount may have been initialised as any Atomicity, but the buffer is owned,
+        // so nothing reads it until make_buf_shared resets it.
+    }
+}
+
+/// A `Tendril<F, BiasedAtomic>` which can be sent to another thread.
+///
+/// A `SendBiasedTendril` may be produced by `Tendril.into_send_biased()` or
+/// `SendBiasedTendril::from(tendril)`, and may be returned to a `Tendril` by
+/// `Tendril::from(self)` on any thread. Unlike `SendTendril`, it keeps
+/// sharing its buffer.
+pub struct SendBiasedTendril<F, I = Inline8, Al = Global>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    tendril: Tendril<F, BiasedAtomic, I, Al>,
+}
+
+unsafe impl<F, I, Al> Send for SendBiasedTendril<F, I, Al>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+}
+
+impl<F, I, Al> Tendril<F, BiasedAtomic, I, Al>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Convert `self` into a type which is `Send`.
+    ///
+    /// This is free, except for an external buffer, which is copied: the
+    /// `Arena` or `TendrilPool` it came from keeps a count of its own.
+    #[inline]
+    pub fn into_send_biased(mut self) -> SendBiasedTendril<F, I, Al> {
+        if self.is_external() {
+            self.make_owned();
+        }
+        let p = self.ptr.get().get();
+        if p > MAX_INLINE_TAG && p & (1 | STATIC) == 1 {
+            unsafe { (*self.header()).refcount.unbias() };
+        }
+        SendBiasedTendril { tendril: self }
+    }
+}
+
+impl<F, I, Al> From<Tendril<F, BiasedAtomic, I, Al>> for SendBiasedTendril<F, I, Al>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn from(tendril: Tendril<F, BiasedAtomic, I, Al>) -> SendBiasedTendril<F, I, Al> {
+        tendril.into_send_biased()
+    }
+}
+
+impl<F, I, Al> From<SendBiasedTendril<F, I, Al>> for Tendril<F, BiasedAtomic, I, Al>
+where
+    F: fmt::Format,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn from(send: SendBiasedTendril<F, I, Al>) -> Tendril<F, BiasedAtomic, I, Al> {
+        // The reference is in the shared count, which any thread may
+        // decrement, so it needs no fixing up here.
+        send.tendril
+    }
+}
+
+/// A `Tendril` which carries a hash of its contents, to make a `HashMap` key
+/// that is cheap to look up repeatedly, however long it is.
+///
+/// The hash is computed once, when the `HashedTendril` is made, and copied
+/// by `clone`. It is kept here rather than with the buffer, so that tendrils
+/// which are never used as keys pay nothing for it. Hashes are keyed at
+/// random once per process.
+///
+/// Unlike `Tendril`, this does not implement `Borrow<[u8]>`, because a
+/// slice hashes differently. Look keys up with another `HashedTendril`;
+/// a clone of the key costs nothing to hash.
+///
+/// A `HashedTendril` may be produced by `HashedTendril::from(tendril)`, and
+/// may be returned to a `Tendril` by `Tendril::from(self)`. It dereferences
+/// to the `Tendril` it holds.
+pub struct HashedTendril<F, A = NonAtomic, I = Inline8, Al = Global>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    tendril: Tendril<F, A, I, Al>,
+    hash: u32,
+}
+
+impl<F, A, I, Al> HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// The hash of the contents, as computed when this was made.
+    #[inline]
+    pub fn cached_hash(&self) -> u32 {
+        self.hash
+    }
+}
+
+impl<F, A, I, Al> Clone for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn clone(&self) -> HashedTendril<F, A, I, Al> {
+        HashedTendril {
+            tendril: self.tendril.clone(),
+            hash: self.hash,
+        }
+    }
+}
+
+impl<F, A, I, Al> Default for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn default() -> HashedTendril<F, A, I, Al> {
+        HashedTendril::from(Tendril::new())
+    }
+}
+
+impl<F, A, I, Al> From<Tendril<F, A, I, Al>> for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn from(tendril: Tendril<F, A, I, Al>) -> HashedTendril<F, A, I, Al> {
+        HashedTendril {
+            hash: hash_bytes(tendril.as_byte_slice()),
+            tendril: tendril,
+        }
+    }
+}
+
+impl<F, A, I, Al> From<HashedTendril<F, A, I, Al>> for Tendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn from(hashed: HashedTendril<F, A, I, Al>) -> Tendril<F, A, I, Al> {
+        hashed.tendril
+    }
+}
+
+impl<F, A, I, Al> Deref for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    type Target = Tendril<F, A, I, Al>;
+
+    #[inline]
+    fn deref(&self) -> &Tendril<F, A, I, Al> {
+        &self.tendril
+    }
+}
+
+impl<F, A, I, Al> PartialEq for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn eq(&self, other: &Self) -> bool {
+        self.hash == other.hash
+            && (self.tendril.ptr_eq(&other.tendril) || self.tendril == other.tendril)
+    }
+}
+
+impl<F, A, I, Al> Eq for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+}
+
+impl<F, A, I, Al> hash::Hash for HashedTendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn hash<H: hash::Hasher>(&self, hasher: &mut H) {
+        hasher.write_u32(self.hash)
+    }
+}
+
+impl<F, A, I, Al> strfmt::Debug for HashedTendril<F, A, I, Al>
 where
-    F: fmt::Format,
+    F: fmt::SliceFormat + Default + strfmt::Debug,
+    <F as fmt::SliceFormat>::Slice: strfmt::Debug,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn from(send: SendTendril<F>) -> Tendril<F, A> {
-        unsafe { mem::transmute(send.tendril) }
-        // header.refcount may have been initialised as an Atomic or a NonAtomic, but the value
-        // will be the same (1) regardless, because the layout is defined.
-        // Thus we don't need to fiddle about resetting it or anything like that.
+    fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
+        self.tendril.fmt(f)
     }
 }
 
@@ -1279,10 +2554,12 @@ where
 impl SliceExt<fmt::UTF8> for str {}
 impl SliceExt<fmt::Bytes> for [u8] {}
 
-impl<F, A> Tendril<F, A>
+impl<F, A, I, Al> Tendril<F, A, I, Al>
 where
     F: for<'a> fmt::CharFormat<'a>,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     /// Remove and return the first character, if any.
     #[inline]
@@ -1326,7 +2603,10 @@ where
     ///
     /// Returns `None` on an empty string.
     #[inline]
-    pub fn pop_front_char_run<'a, C, R>(&'a mut self, mut classify: C) -> Option<(Tendril<F, A>, R)>
+    pub fn pop_front_char_run<'a, C, R>(
+        &'a mut self,
+        mut classify: C,
+    ) -> Option<(Tendril<F, A, I, Al>, R)>
     where
         C: FnMut(char) -> R,
         R: PartialEq,
@@ -1362,11 +2642,107 @@ where
     }
 }
 
+impl<F, A, I, Al> Tendril<F, A, I, Al>
+where
+    F: for<'a> fmt::CharFormat<'a>,
+    fmt::ASCII: fmt::SubsetOf<F>,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Remove and return a run of characters at the front of the `Tendril`
+    /// which are all in `set`, or all not in it, together with whether they
+    /// are. `non_ascii` decides for characters which are not ASCII.
+    ///
+    /// This is `pop_front_char_run` for a classifier which looks ASCII
+    /// characters up in a table, but it checks 16 or 32 bytes at a time,
+    /// and decodes characters only where they are not ASCII.
+    ///
+    /// Returns `None` on an empty string.
+    #[inline]
+    pub fn pop_front_set_run<N>(
+        &mut self,
+        set: &simd::AsciiSet,
+        mut non_ascii: N,
+    ) -> Option<(Tendril<F, A, I, Al>, bool)>
+    where
+        N: FnMut(char) -> bool,
+    {
+        let (member, end, len);
+        {
+            let bytes = self.as_byte_slice();
+            len = bytes.len();
+            let first = *unwrap_or_return!(bytes.first(), None);
+            member = if first < 0x80 {
+                set.contains(first)
+            } else {
+                let (_, c) = unsafe { F::char_indices(bytes) }.next().unwrap();
+                non_ascii(c)
+            };
+
+            let mut i = 0;
+            loop {
+                i += simd::ascii_run(set, member, &bytes[i..]);
+                if i == len || bytes[i] < 0x80 {
+                    break;
+                }
+                // Decode the characters up to the next ASCII one.
+                let mut mismatch = false;
+                let mut next = len;
+                for (j, c) in unsafe { F::char_indices(&bytes[i..]) } {
+                    let same = if (c as u32) < 0x80 {
+                        set.contains(c as u8) == member
+                    } else {
+                        non_ascii(c) == member
+                    };
+                    if !same || (c as u32) < 0x80 {
+                        next = i + j;
+                        mismatch = !same;
+                        break;
+                    }
+                }
+                i = next;
+                if mismatch {
+                    break;
+                }
+            }
+            end = i;
+        }
+
+        if end == len {
+            let t = self.clone();
+            self.clear();
+            Some((t, member))
+        } else {
+            unsafe {
+                let t = self.unsafe_subtendril(0, end as u32);
+                self.unsafe_pop_front(end as u32);
+                Some((t, member))
+            }
+        }
+    }
+}
+
 /// Extension trait for `io::Read`.
 pub trait ReadExt: io::Read {
-    fn read_to_tendril<A>(&mut self, buf: &mut Tendril<fmt::Bytes, A>) -> io::Result<usize>
+    fn read_to_tendril<A, I, Al>(
+        &mut self,
+        buf: &mut Tendril<fmt::Bytes, A, I, Al>,
+    ) -> io::Result<usize>
     where
-        A: Atomicity;
+        A: Atomicity,
+        I: InlineCapacity,
+        Al: Allocator;
+
+    fn read_to_tendril_with_hint<A, I, Al>(
+        &mut self,
+        buf: &mut Tendril<fmt::Bytes, A, I, Al>,
+        hint: u64,
+    ) -> io::Result<usize>
+    where
+        A: Atomicity,
+        I: InlineCapacity,
+        Al: Allocator;
 }
 
 impl<T> ReadExt for T
@@ -1374,54 +2750,116 @@ where
     T: io::Read,
 {
     /// Read all bytes until EOF.
-    fn read_to_tendril<A>(&mut self, buf: &mut Tendril<fmt::Bytes, A>) -> io::Result<usize>
+    fn read_to_tendril<A, I, Al>(
+        &mut self,
+        buf: &mut Tendril<fmt::Bytes, A, I, Al>,
+    ) -> io::Result<usize>
+    where
+        A: Atomicity,
+        I: InlineCapacity,
+        Al: Allocator,
+    {
+        read_to_end(self, buf, 0)
+    }
+
+    /// Read all bytes until EOF, making room for `hint` of them up front.
+    ///
+    /// With an exact hint, such as the length of a file from
+    /// `File::metadata`, an empty `buf` is allocated once and the bytes are
+    /// read straight into it, never copied. A wrong hint costs no more than
+    /// growing the buffer as `read_to_tendril` does.
+    fn read_to_tendril_with_hint<A, I, Al>(
+        &mut self,
+        buf: &mut Tendril<fmt::Bytes, A, I, Al>,
+        hint: u64,
+    ) -> io::Result<usize>
     where
         A: Atomicity,
+        I: InlineCapacity,
+        Al: Allocator,
     {
-        // Adapted from libstd/io/mod.rs.
-        const DEFAULT_BUF_SIZE: u32 = 64 * 1024;
-
-        let start_len = buf.len();
-        let mut len = start_len;
-        let mut new_write_size = 16;
-        let ret;
-        loop {
-            if len == buf.len() {
+        let room = u32::MAX - buf.len32();
+        read_to_end(self, buf, cmp::min(hint, room as u64) as u32)
+    }
+}
+
+/// Read until EOF onto the end of `buf`, after allocating room for `hint`
+/// bytes at once.
+///
+/// Room is zeroed before it is read into, so that the reader never sees
+/// uninitialized memory; the standard library does the same for `Vec<u8>`.
+/// It is zeroed a chunk at a time, just ahead of the reads, so that the
+/// zeroes are still in cache when they are overwritten.
+fn read_to_end<R, A, I, Al>(
+    r: &mut R,
+    buf: &mut Tendril<fmt::Bytes, A, I, Al>,
+    hint: u32,
+) -> io::Result<usize>
+where
+    R: io::Read + ?Sized,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    // Adapted from libstd/io/mod.rs.
+    const DEFAULT_BUF_SIZE: u32 = 64 * 1024;
+
+    let start_len = buf.len32();
+    let end = start_len + hint;
+    if hint > 0 {
+        buf.force_reserve(hint);
+    }
+    let mut len = start_len;
+    let mut new_write_size = 16;
+    let ret = loop {
+        if len == buf.len32() {
+            if len < end {
+                unsafe {
+                    buf.push_zeroed(cmp::min(end - len, DEFAULT_BUF_SIZE));
+                }
+            } else {
+                if len == end && hint > 0 {
+                    // The hint was likely exact. Check for EOF before
+                    // growing the buffer.
+                    let mut probe = [0; 32];
+                    match r.read(&mut probe) {
+                        Ok(0) => break Ok((len - start_len) as usize),
+                        Ok(n) => {
+                            buf.push_slice(&probe[..n]);
+                            len += n as u32;
+                            continue;
+                        }
+                        Err(ref e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                        Err(e) => break Err(e),
+                    }
+                }
                 if new_write_size < DEFAULT_BUF_SIZE {
                     new_write_size *= 2;
                 }
-                // FIXME: this exposes uninitialized bytes to a generic R type
-                // this is fine for R=File which never reads these bytes,
-                // but user-defined types might.
-                // The standard library pushes zeros to `Vec<u8>` for that reason.
                 unsafe {
-                    buf.push_uninitialized(new_write_size);
+                    buf.push_zeroed(new_write_size);
                 }
             }
+        }
 
-            match self.read(&mut buf[len..]) {
-                Ok(0) => {
-                    ret = Ok(len - start_len);
-                    break;
-                }
-                Ok(n) => len += n,
-                Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
-                Err(e) => {
-                    ret = Err(e);
-                    break;
-                }
-            }
+        match r.read(&mut buf[len as usize..]) {
+            Ok(0) => break Ok((len - start_len) as usize),
+            Ok(n) => len += n as u32,
+            Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
+            Err(e) => break Err(e),
         }
+    };
 
-        let buf_len = buf.len32();
-        buf.pop_back(buf_len - (len as u32));
-        ret
-    }
+    let buf_len = buf.len32();
+    buf.pop_back(buf_len - len);
+    ret
 }
 
-impl<A> io::Write for Tendril<fmt::Bytes, A>
+impl<A, I, Al> io::Write for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
@@ -1442,9 +2880,11 @@ where
 }
 
 #[cfg(feature = "encoding")]
-impl<A> encoding::ByteWriter for Tendril<fmt::Bytes, A>
+impl<A, I, Al> encoding::ByteWriter for Tendril<fmt::Bytes, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn write_byte(&mut self, b: u8) {
@@ -1462,10 +2902,12 @@ where
     }
 }
 
-impl<F, A> Tendril<F, A>
+impl<F, A, I, Al> Tendril<F, A, I, Al>
 where
     A: Atomicity,
     F: fmt::SliceFormat<Slice = [u8]>,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     /// Decode from some character encoding into UTF-8.
     ///
@@ -1477,11 +2919,27 @@ where
         &self,
         encoding: EncodingRef,
         trap: DecoderTrap,
-    ) -> Result<Tendril<fmt::UTF8, A>, ::std::borrow::Cow<'static, str>> {
+    ) -> Result<Tendril<fmt::UTF8, A, I, Al>, ::std::borrow::Cow<'static, str>> {
         let mut ret = Tendril::new();
         encoding.decode_to(&*self, trap, &mut ret).map(|_| ret)
     }
 
+    /// Push `n` zero bytes onto the end.
+    ///
+    /// Unlike `push_uninitialized`, this never lets a reader see
+    /// uninitialized memory.
+    unsafe fn push_zeroed(&mut self, n: u32) {
+        let len = self.len32();
+        self.push_uninitialized(n);
+        // Either in-line, or owned with the bytes at the front.
+        let data = if self.ptr.get().get() <= MAX_INLINE_TAG {
+            self.inline_ptr()
+        } else {
+            self.assume_buf().0.data_ptr()
+        };
+        ptr::write_bytes(data.offset(len as isize), 0, n as usize);
+    }
+
     /// Push "uninitialized bytes" onto the end.
     ///
     /// Really, this grows the tendril without writing anything to the new area.
@@ -1490,7 +2948,7 @@ where
     #[inline]
     pub unsafe fn push_uninitialized(&mut self, n: u32) {
         let new_len = self.len32().checked_add(n).expect(OFLOW);
-        if new_len <= MAX_INLINE_LEN as u32 && self.ptr.get().get() <= MAX_INLINE_TAG {
+        if new_len <= I::LEN as u32 && self.ptr.get().get() <= MAX_INLINE_TAG {
             self.ptr.set(inline_tag(new_len))
         } else {
             self.make_owned_with_capacity(new_len);
@@ -1499,9 +2957,11 @@ where
     }
 }
 
-impl<A> strfmt::Display for Tendril<fmt::UTF8, A>
+impl<A, I, Al> strfmt::Display for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn fmt(&self, f: &mut strfmt::Formatter) -> strfmt::Result {
@@ -1509,9 +2969,11 @@ where
     }
 }
 
-impl<A> str::FromStr for Tendril<fmt::UTF8, A>
+impl<A, I, Al> str::FromStr for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     type Err = ();
 
@@ -1521,9 +2983,11 @@ where
     }
 }
 
-impl<A> strfmt::Write for Tendril<fmt::UTF8, A>
+impl<A, I, Al> strfmt::Write for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn write_str(&mut self, s: &str) -> strfmt::Result {
@@ -1533,9 +2997,11 @@ where
 }
 
 #[cfg(feature = "encoding")]
-impl<A> encoding::StringWriter for Tendril<fmt::UTF8, A>
+impl<A, I, Al> encoding::StringWriter for Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn write_char(&mut self, c: char) {
@@ -1553,10 +3019,26 @@ where
     }
 }
 
-impl<A> Tendril<fmt::UTF8, A>
+impl<A, I, Al> Tendril<fmt::UTF8, A, I, Al>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
+    /// Build a `Tendril` on the bytes of a `String`, without copying them.
+    /// See `from_vec`.
+    #[inline]
+    pub fn from_string(s: String) -> Tendril<fmt::UTF8, A, I, Al> {
+        unsafe { Tendril::from_vec_without_validating(s.into_bytes()) }
+    }
+
+    /// Convert into a `String`. This is free in the cases described for
+    /// `into_vec`.
+    #[inline]
+    pub fn into_string(self) -> String {
+        unsafe { String::from_utf8_unchecked(self.into_vec()) }
+    }
+
     /// Encode from UTF-8 into some other character encoding.
     ///
     /// See the [rust-encoding docs](https://lifthrasiir.github.io/rust-encoding/encoding/)
@@ -1567,7 +3049,7 @@ where
         &self,
         encoding: EncodingRef,
         trap: EncoderTrap,
-    ) -> Result<Tendril<fmt::Bytes, A>, ::std::borrow::Cow<'static, str>> {
+    ) -> Result<Tendril<fmt::Bytes, A, I, Al>, ::std::borrow::Cow<'static, str>> {
         let mut ret = Tendril::new();
         encoding.encode_to(&*self, trap, &mut ret).map(|_| ret)
     }
@@ -1582,17 +3064,17 @@ where
 
     /// Create a `Tendril` from a single character.
     #[inline]
-    pub fn from_char(c: char) -> Tendril<fmt::UTF8, A> {
-        let mut t: Tendril<fmt::UTF8, A> = Tendril::new();
+    pub fn from_char(c: char) -> Tendril<fmt::UTF8, A, I, Al> {
+        let mut t: Tendril<fmt::UTF8, A, I, Al> = Tendril::new();
         t.push_char(c);
         t
     }
 
     /// Helper for the `format_tendril!` macro.
     #[inline]
-    pub fn format(args: strfmt::Arguments) -> Tendril<fmt::UTF8, A> {
+    pub fn format(args: strfmt::Arguments) -> Tendril<fmt::UTF8, A, I, Al> {
         use std::fmt::Write;
-        let mut output: Tendril<fmt::UTF8, A> = Tendril::new();
+        let mut output: Tendril<fmt::UTF8, A, I, Al> = Tendril::new();
         let _ = write!(&mut output, "{}", args);
         output
     }
@@ -1606,31 +3088,85 @@ macro_rules! format_tendril {
     ($($arg:tt)*) => ($crate::StrTendril::format(format_args!($($arg)*)))
 }
 
-impl<'a, F, A> From<&'a F::Slice> for Tendril<F, A>
+/// Create a `Tendril` on a string or byte string literal without copying it.
+///
+/// The type of `Tendril` is inferred, as for `Tendril::from_static`. Literals
+/// which fit in-line are stored there, and the choice is made at compile
+/// time.
+///
+/// ```
+/// # #[macro_use] extern crate tendril;
+/// # use tendril::{ByteTendril, StrTendril};
+/// # fn main() {
+/// let doctype: StrTendril = static_tendril!("<!DOCTYPE html>");
+/// let magic: ByteTendril = static_tendril!(b"\x89PNG");
+/// # }
+/// ```
+#[macro_export]
+macro_rules! static_tendril {
+    ($lit:expr) => {
+        $crate::Tendril::from_static(&$lit[..])
+    };
+}
+
+impl<'a, F, A, I, Al> From<&'a F::Slice> for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn from(input: &F::Slice) -> Tendril<F, A> {
+    fn from(input: &F::Slice) -> Tendril<F, A, I, Al> {
         Tendril::from_slice(input)
     }
 }
 
-impl<A> From<String> for Tendril<fmt::UTF8, A>
+impl<A, I, Al> From<String> for Tendril<fmt::UTF8, A, I, Al>
+where
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Take over the `String`'s buffer, without copying. See `from_vec`.
+    #[inline]
+    fn from(input: String) -> Tendril<fmt::UTF8, A, I, Al> {
+        Tendril::from_string(input)
+    }
+}
+
+impl<A, I, Al> From<Vec<u8>> for Tendril<fmt::Bytes, A, I, Al>
+where
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Take over the `Vec`'s buffer, without copying. See `from_vec`.
+    #[inline]
+    fn from(input: Vec<u8>) -> Tendril<fmt::Bytes, A, I, Al> {
+        Tendril::from_vec(input)
+    }
+}
+
+impl<A, I, Al> From<Tendril<fmt::Bytes, A, I, Al>> for Vec<u8>
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
+    /// Free in the cases described for `into_vec`.
     #[inline]
-    fn from(input: String) -> Tendril<fmt::UTF8, A> {
-        Tendril::from_slice(&*input)
+    fn from(input: Tendril<fmt::Bytes, A, I, Al>) -> Vec<u8> {
+        input.into_vec()
     }
 }
 
-impl<F, A> AsRef<F::Slice> for Tendril<F, A>
+impl<F, A, I, Al> AsRef<F::Slice> for Tendril<F, A, I, Al>
 where
     F: fmt::SliceFormat,
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
     fn as_ref(&self) -> &F::Slice {
@@ -1638,26 +3174,55 @@ where
     }
 }
 
-impl<A> From<Tendril<fmt::UTF8, A>> for String
+impl<A, I, Al> From<Tendril<fmt::UTF8, A, I, Al>> for String
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
+    /// Free in the cases described for `into_vec`.
     #[inline]
-    fn from(input: Tendril<fmt::UTF8, A>) -> String {
-        String::from(&*input)
+    fn from(input: Tendril<fmt::UTF8, A, I, Al>) -> String {
+        input.into_string()
     }
 }
 
-impl<'a, A> From<&'a Tendril<fmt::UTF8, A>> for String
+impl<'a, A, I, Al> From<&'a Tendril<fmt::UTF8, A, I, Al>> for String
 where
     A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
 {
     #[inline]
-    fn from(input: &'a Tendril<fmt::UTF8, A>) -> String {
+    fn from(input: &'a Tendril<fmt::UTF8, A, I, Al>) -> String {
         String::from(&**input)
     }
 }
 
+#[path = "arena.rs"]
+mod arena;
+#[path = "large.rs"]
+mod large;
+#[cfg(target_os = "linux")]
+#[path = "mmap.rs"]
+mod mmap;
+#[path = "pool.rs"]
+mod pool;
+#[path = "split.rs"]
+mod split;
+#[path = "writer.rs"]
+mod writer;
+
+pub use self::arena::Arena;
+pub use self::large::LargeTendril;
+#[cfg(target_os = "linux")]
+pub use self::mmap::map_windows;
+#[cfg(target_os = "linux")]
+pub use self::pool::read_files;
+pub use self::pool::{BlockReader, Blocks, TendrilPool};
+pub use self::split::{Lines, SplitByte, SplitChar};
+pub use self::writer::{write_tendrils, TendrilWriter};
+
 #[cfg(all(test, feature = "bench"))]
 #[path = "bench.rs"]
 mod bench;
@@ -1665,9 +3230,12 @@ mod bench;
 #[cfg(test)]
 mod test {
     use super::{
-        Atomic, ByteTendril, Header, NonAtomic, ReadExt, SendTendril, SliceExt, StrTendril, Tendril,
+        release_vec_fn, Allocator, Atomic, Atomicity, BiasedAtomic, ByteTendril, ExternalHeader,
+        HashedTendril, Header, Inline16, Inline8, NonAtomic, ReadExt, SendBiasedTendril,
+        SendTendril, SliceExt, StrTendril, SubtendrilError, Tendril,
     };
     use fmt;
+    use simd::AsciiSet;
     use std::iter;
     use std::thread;
 
@@ -1708,13 +3276,264 @@ mod test {
         assert_eq!(correct, mem::size_of::<Option<StrTendril>>());
 
         assert_eq!(
-            mem::size_of::<*const ()>() * 2,
+            mem::size_of::<Header<NonAtomic>>(),
             mem::size_of::<Header<Atomic>>(),
         );
         assert_eq!(
-            mem::size_of::<*const ()>() + 4,
             mem::size_of::<Header<NonAtomic>>(),
+            mem::size_of::<Header<BiasedAtomic>>(),
+        );
+        assert_eq!(16, mem::size_of::<Header<Atomic>>());
+    }
+
+    /// The offsets of the fields of an `ExternalHeader<A>` which
+    /// `reclaim_vec` reads without knowing `A`.
+    fn external_offsets<A: Atomicity>() -> [usize; 4] {
+        use std::ptr;
+        unsafe {
+            let h: ExternalHeader<A> =
+                ExternalHeader::new(ptr::null(), 0, release_vec_fn::<A>(), ptr::null_mut());
+            let base = &h as *const _ as usize;
+            [
+                &h.header.cap as *const _ as usize - base,
+                &h.header.used as *const _ as usize - base,
+                &h.data as *const _ as usize - base,
+                &h.owner as *const _ as usize - base,
+            ]
+        }
+    }
+
+    #[test]
+    fn header_layout() {
+        assert_eq!(
+            external_offsets::<NonAtomic>(),
+            external_offsets::<Atomic>()
+        );
+        assert_eq!(
+            external_offsets::<NonAtomic>(),
+            external_offsets::<BiasedAtomic>()
+        );
+    }
+
+    #[test]
+    fn from_static() {
+        static LONG: &'static str = "a string literal too long to be in-line";
+        let t: StrTendril = Tendril::from_static(LONG);
+        assert!(t.is_static() && t.is_shared());
+        assert_eq!(LONG.as_ptr(), t.as_ptr());
+        assert_eq!(LONG, &*t);
+        assert_eq!(
+            "Tendril<UTF8>(static: \"a string literal too long to be in-line\")",
+            &*format!("{:?}", t)
+        );
+
+        // Start the bytes at every alignment.
+        for i in 0..8 {
+            let u: StrTendril = Tendril::from_static(&LONG[i..]);
+            assert_eq!(&LONG[i..], &*u);
+            assert_eq!(&LONG[i + 3..i + 30], &*u.subtendril(3, 27));
+            assert_eq!(LONG[i..].as_ptr(), u.as_ptr());
+        }
+
+        let mut u = t.clone();
+        assert!(u.ptr_eq(&t));
+        assert_eq!(
+            HashedTendril::from(u.clone()),
+            HashedTendril::from(StrTendril::from_slice(LONG))
         );
+        u.pop_front(2);
+        u.pop_back(8);
+        assert_eq!("string literal too long to be", &*u);
+        let mut v = u.subtendril(0, 14);
+        v.push_tendril(&u.subtendril(14, 15));
+        assert!(v.is_static() && v.ptr_eq(&u));
+        u.push_char('!');
+        assert!(!u.is_shared());
+        assert_eq!("string literal too long to be!", &*u);
+        u.clear();
+        v.clear();
+        assert!(!v.is_static());
+        assert_eq!(LONG, &*t);
+
+        let short: ByteTendril = static_tendril!(b"short");
+        assert!(!short.is_static());
+        assert_eq!(b"short", &*short);
+        let long: Tendril<fmt::Bytes, Atomic> = static_tendril!(b"long enough to be static");
+        let clone = long.clone();
+        thread::spawn(move || assert_eq!(b"long enough to be static", &*clone))
+            .join()
+            .unwrap();
+        assert!(long.is_static());
+        assert!(!long.into_send().tendril.is_static());
+    }
+
+    #[test]
+    fn inline_capacity() {
+        use std::mem;
+        type Str16 = Tendril<fmt::UTF8, NonAtomic, Inline16>;
+
+        assert_eq!(mem::size_of::<*const ()>() + 16, mem::size_of::<Str16>());
+
+        let mut t = Str16::from_slice("sixteen bytes!!!");
+        assert!(!t.is_shared());
+        let u = t.clone();
+        assert!(!t.is_shared_with(&u));
+        t.push_char('x');
+        assert!(!t.is_shared());
+        let u = t.subtendril(1, 16);
+        assert!(!t.is_shared_with(&u));
+        assert_eq!("ixteen bytes!!!x", &*u);
+        let u = t.subtendril(0, 17);
+        assert!(t.is_shared_with(&u));
+
+        let mut v = t.clone();
+        v.pop_back(2);
+        v.pop_front(4);
+        assert!(!v.is_shared());
+        assert_eq!("een bytes!!", &*v);
+        v.push_slice("12345");
+        assert_eq!("een bytes!!12345", &*v);
+        v.push_char('6');
+        assert_eq!("een bytes!!123456", &*v);
+
+        let b: Tendril<fmt::Bytes, NonAtomic, Inline16> = t.into_bytes().into_send().into();
+        assert_eq!(b"sixteen bytes!!!x", &*b);
+    }
+
+    #[test]
+    fn metadata() {
+        use std::sync::Arc;
+
+        let source = Arc::new("input.html");
+        let mut t: StrTendril = "Hello, world! How are you?".to_tendril();
+        assert!(t.metadata::<Arc<&str>>().is_none());
+        t.attach_metadata(source.clone());
+        assert_eq!("Hello, world! How are you?", &*t);
+        assert!(t.metadata::<u32>().is_none());
+        assert_eq!(Some(0), t.metadata::<Arc<&str>>().map(|(_, off)| off));
+
+        let mut world = t.subtendril(7, 5);
+        assert!(world.is_shared_with(&t));
+        world.pop_back(1);
+        let (name, off) = world.metadata::<Arc<&str>>().unwrap();
+        assert_eq!(("input.html", 7), (**name, off));
+
+        let mut how = t.clone();
+        how.pop_front(14);
+        assert_eq!("How are you?", &*how);
+        assert_eq!(Some(14), how.metadata::<Arc<&str>>().map(|(_, off)| off));
+
+        let mut copy: StrTendril = "fresh".to_tendril();
+        copy.attach_metadata_from(&how);
+        assert_eq!(Some(0), copy.metadata::<Arc<&str>>().map(|(_, off)| off));
+        copy.push_char('!');
+        assert_eq!("fresh!", &*copy);
+        assert!(copy.metadata::<Arc<&str>>().is_none());
+
+        how.push_char('!');
+        assert!(how.metadata::<Arc<&str>>().is_none());
+        assert_eq!("How are you?!", &*how);
+
+        assert_eq!(2, Arc::strong_count(&source));
+        drop((t, world, copy, how));
+        assert_eq!(1, Arc::strong_count(&source));
+    }
+
+    #[test]
+    fn from_vec() {
+        let mut v = Vec::with_capacity(256);
+        v.extend_from_slice(b"a vector long enough to go on the heap");
+        let data = v.as_ptr();
+        let t: ByteTendril = Tendril::from_vec(v);
+        assert!(t.is_external() && t.is_shared());
+        assert_eq!(data, t.as_ptr());
+        assert_eq!(b"a vector long enough to go on the heap", &*t);
+
+        let u = t.subtendril(2, 11);
+        assert_eq!(b"vector long", &*u);
+        let v = t.into_vec();
+        assert!(data != v.as_ptr());
+        drop(u);
+
+        // No spare capacity for the header.
+        let s = String::from("a string with no spare capacity at all");
+        let data = s.as_ptr();
+        let mut t: StrTendril = s.into();
+        assert_eq!(data, t.as_ptr());
+        let u = t.clone();
+        assert_eq!("a string with no spare capacity at all", &*u);
+        drop(u);
+        t.pop_back(7);
+        let s = t.into_string();
+        assert_eq!(data, s.as_ptr());
+        assert_eq!("a string with no spare capacity", s);
+
+        let t: Tendril<fmt::UTF8, Atomic> = String::from("short").into();
+        assert!(!t.is_shared());
+        assert_eq!("short", String::from(t));
+
+        let s: String = "Hello, world! How are you?".to_tendril().into();
+        assert_eq!("Hello, world! How are you?", s);
+
+        assert!(StrTendril::try_from_vec(vec![0xFF; 16]).is_err());
+        let v: Vec<u8> = ByteTendril::from(vec![0xFF; 16]).into();
+        assert_eq!(vec![0xFF; 16], v);
+    }
+
+    #[test]
+    fn allocator() {
+        use std::alloc::{self, Layout};
+        use std::sync::atomic::{AtomicUsize, Ordering};
+
+        static LIVE: AtomicUsize = AtomicUsize::new(0);
+        static CALLS: AtomicUsize = AtomicUsize::new(0);
+
+        struct Counting;
+
+        unsafe impl Allocator for Counting {
+            unsafe fn alloc(layout: Layout) -> *mut u8 {
+                LIVE.fetch_add(1, Ordering::SeqCst);
+                CALLS.fetch_add(1, Ordering::SeqCst);
+                alloc::alloc(layout)
+            }
+
+            unsafe fn dealloc(ptr: *mut u8, layout: Layout) {
+                LIVE.fetch_sub(1, Ordering::SeqCst);
+                alloc::dealloc(ptr, layout)
+            }
+
+            unsafe fn realloc(ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+                CALLS.fetch_add(1, Ordering::SeqCst);
+                alloc::realloc(ptr, layout, new_size)
+            }
+        }
+
+        type CountingTendril = Tendril<fmt::UTF8, NonAtomic, Inline8, Counting>;
+
+        let mut t = CountingTendril::from_slice("inline");
+        assert_eq!(0, CALLS.load(Ordering::SeqCst));
+        t.push_slice(" no longer, now on the heap");
+        assert_eq!(1, LIVE.load(Ordering::SeqCst));
+        for _ in 0..10 {
+            t.push_slice(" and growing");
+        }
+        assert!(CALLS.load(Ordering::SeqCst) > 1);
+        assert_eq!(1, LIVE.load(Ordering::SeqCst));
+
+        let mut u = t.subtendril(10, 6);
+        assert_eq!("longer", &*u);
+        u.push_char('!');
+        assert_eq!("longer!", &*u);
+        assert_eq!(1, LIVE.load(Ordering::SeqCst));
+
+        let mut v = t.subtendril(0, 20);
+        v.push_char('!');
+        assert_eq!("inline no longer, no!", &*v);
+        assert_eq!(2, LIVE.load(Ordering::SeqCst));
+
+        drop((t, u, v));
+        assert_eq!(0, LIVE.load(Ordering::SeqCst));
+        assert_eq!(16, ::std::mem::size_of::<CountingTendril>());
     }
 
     #[test]
@@ -1747,11 +3566,145 @@ mod test {
         assert!(s.is_shared());
         assert!(t.is_shared());
 
+        // `t` ends where the buffer's bytes do, so it appends in place.
         t.push_slice(b"quux");
         assert_eq!(b"foobarbaz", &*s);
         assert_eq!(b"foobarbazquux", &*t);
+        assert_eq!(s.as_ptr(), t.as_ptr());
+        assert!(t.is_shared());
+
+        // `s` does not any more, so it copies.
+        let mut s = s;
+        s.push_slice(b"!");
+        assert_eq!(b"foobarbaz!", &*s);
+        assert_eq!(b"foobarbazquux", &*t);
         assert!(s.as_ptr() != t.as_ptr());
+        assert!(!s.is_shared());
+    }
+
+    #[test]
+    fn push_in_place() {
+        let mut t = StrTendril::with_capacity(64);
+        t.push_slice("some words: ");
+        let mut parts = vec![];
+        for i in 0..8 {
+            t.push_slice("word ");
+            parts.push(t.clone());
+            assert_eq!(parts[0].as_ptr(), t.as_ptr());
+            assert_eq!(12 + 5 * (i + 1), parts[i].len());
+        }
+        assert_eq!("some words: word word ", &*parts[1]);
+
+        // Only the last one can append; the others copy.
+        let mut u = parts[6].clone();
+        u.push_slice("x");
+        assert!(!u.is_shared());
+        parts[7].push_slice("x");
+        assert!(parts[7].is_shared_with(&t));
+        assert_eq!("some words: word word ", &*parts[1]);
+
+        // Out of room.
+        t.push_slice(&"x".repeat(64));
         assert!(!t.is_shared());
+        assert_eq!(&*parts[7], &t[..53]);
+    }
+
+    #[test]
+    fn split_at_and_off() {
+        let t = "some words, then more words".to_tendril();
+        let (a, b) = t.split_at(10);
+        assert_eq!("some words", &*a);
+        assert_eq!(", then more words", &*b);
+        assert!(a.is_shared_with(&t) && b.is_shared_with(&t));
+        assert_eq!(Err(SubtendrilError::OutOfBounds), t.try_split_at(28));
+
+        let t = "\u{a66e}\u{a66e}\u{a66e}\u{a66e}".to_tendril();
+        assert_eq!(Err(SubtendrilError::ValidationFailed), t.try_split_at(4));
+        let (a, b) = t.split_at(0);
+        assert_eq!(("", &*t), (&*a, &*b));
+
+        let mut t = "some words, then more words".to_tendril();
+        let u = t.split_off(16);
+        assert_eq!(("some words, then", " more words"), (&*t, &*u));
+        let mut v = t.clone();
+        assert_eq!(Err(SubtendrilError::OutOfBounds), v.try_split_off(17));
+        assert_eq!("some words, then", &*v);
+        assert_eq!("", &*v.split_off(16));
+    }
+
+    #[test]
+    fn split_byte() {
+        let t = "a long first piece,,and a long last piece,".to_tendril();
+        let pieces: Vec<_> = t.split_byte(b',').collect();
+        assert_eq!(4, pieces.len());
+        assert_eq!(
+            vec!["a long first piece", "", "and a long last piece", ""],
+            pieces.iter().map(|p| &**p).collect::<Vec<_>>()
+        );
+        assert!(pieces[0].is_shared_with(&t));
+        assert_eq!(
+            vec![""],
+            "".to_tendril()
+                .split_byte(b',')
+                .map(|p| p.to_string())
+                .collect::<Vec<_>>()
+        );
+
+        // 0x99 is also the middle byte of U+A66E, which is not a delimiter.
+        let t = unsafe {
+            "x\u{a66e}y"
+                .to_tendril()
+                .reinterpret_without_validating::<fmt::Bytes>()
+        };
+        assert_eq!(2, t.split_byte(0x99).count());
+        let t = "x\u{a66e}y".to_tendril();
+        let pieces: Vec<_> = t.split_byte(0x99).collect();
+        assert_eq!(
+            vec!["x\u{a66e}y"],
+            pieces.iter().map(|p| &**p).collect::<Vec<_>>()
+        );
+    }
+
+    #[test]
+    fn split_char() {
+        let t = "one two  three\u{a0}four".to_tendril();
+        let pieces: Vec<_> = t.split_char(char::is_whitespace).collect();
+        assert_eq!(
+            "one two  three\u{a0}four"
+                .split(char::is_whitespace)
+                .collect::<Vec<_>>(),
+            pieces.iter().map(|p| &**p).collect::<Vec<_>>()
+        );
+        let t = " x ".to_tendril();
+        assert_eq!(3, t.split_char(|c| c == ' ').count());
+        assert_eq!(1, "".to_tendril().split_char(|_| true).count());
+    }
+
+    #[test]
+    fn lines() {
+        // Spelled out, as `str::lines` kept a lone trailing "\r" only from
+        // Rust 1.77.
+        let cases: &[(&str, &[&str])] = &[
+            ("", &[]),
+            ("\n", &[""]),
+            (
+                "first line\nsecond line\r\n\nlast line",
+                &["first line", "second line", "", "last line"],
+            ),
+            (
+                "first line\r\nsecond line\n",
+                &["first line", "second line"],
+            ),
+            ("a lone carriage return\r", &["a lone carriage return\r"]),
+            ("\r\n\r\n", &["", ""]),
+        ];
+        for &(s, expected) in cases {
+            let t = s.to_tendril();
+            let lines: Vec<_> = t.lines().collect();
+            assert_eq!(expected, &*lines.iter().map(|l| &**l).collect::<Vec<_>>());
+        }
+        let t = "a line long enough to share\nand another".to_tendril();
+        assert!(t.lines().all(|l| l.is_shared_with(&t)));
     }
 
     #[test]
@@ -2006,6 +3959,32 @@ mod test {
         }
     }
 
+    #[test]
+    fn set_run() {
+        let long = "some words\u{a0}and\u{3000}more中文 words\t\u{a0}\u{2003} end  ";
+        for s in &[
+            "",
+            " ",
+            "x",
+            "中 ",
+            " 中 ",
+            "\u{a0}\u{a0} x",
+            "xyzzy\u{a0}",
+            long,
+            &long.repeat(4),
+        ] {
+            let mut t = s.to_tendril();
+            let mut u = t.clone();
+            loop {
+                let run = t.pop_front_set_run(&AsciiSet::WHITESPACE, char::is_whitespace);
+                assert!(run == u.pop_front_char_run(char::is_whitespace));
+                if run.is_none() {
+                    break;
+                }
+            }
+        }
+    }
+
     #[test]
     fn deref_mut_inline() {
         let mut t = "xyő".to_tendril().into_bytes();
@@ -2394,6 +4373,72 @@ mod test {
         check(&long);
     }
 
+    #[test]
+    fn read_with_hint() {
+        use std::alloc::{self, Layout};
+        use std::io::Cursor;
+        use std::sync::atomic::{AtomicUsize, Ordering};
+
+        static CALLS: AtomicUsize = AtomicUsize::new(0);
+
+        struct Counting;
+
+        unsafe impl Allocator for Counting {
+            unsafe fn alloc(layout: Layout) -> *mut u8 {
+                CALLS.fetch_add(1, Ordering::SeqCst);
+                alloc::alloc(layout)
+            }
+
+            unsafe fn dealloc(ptr: *mut u8, layout: Layout) {
+                alloc::dealloc(ptr, layout)
+            }
+
+            unsafe fn realloc(ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+                CALLS.fetch_add(1, Ordering::SeqCst);
+                alloc::realloc(ptr, layout, new_size)
+            }
+        }
+
+        type CountingTendril = Tendril<fmt::Bytes, NonAtomic, Inline8, Counting>;
+
+        let long: Vec<u8> = (0..100_000).map(|i| i as u8).collect();
+        let mut t = CountingTendril::new();
+        let n = Cursor::new(&long[..])
+            .read_to_tendril_with_hint(&mut t, long.len() as u64)
+            .unwrap();
+        assert_eq!(long.len(), n);
+        assert_eq!(&long[..], &*t);
+        assert_eq!(1, CALLS.load(Ordering::SeqCst));
+
+        for &hint in &[0, 1, 7, 9, 50_000, 99_999, 100_001, 1_000_000] {
+            let mut t = ByteTendril::from_slice(b"head");
+            let n = Cursor::new(&long[..])
+                .read_to_tendril_with_hint(&mut t, hint)
+                .unwrap();
+            assert_eq!(long.len(), n);
+            assert_eq!(b"head", &t[..4]);
+            assert_eq!(&long[..], &t[4..]);
+        }
+
+        // A shared buffer is left alone.
+        let s = ByteTendril::from_slice(&long[..100]);
+        let mut t = s.clone();
+        Cursor::new(b"tail")
+            .read_to_tendril_with_hint(&mut t, 4)
+            .unwrap();
+        assert_eq!(&long[..100], &*s);
+        assert_eq!(b"tail", &t[100..]);
+
+        let mut t = ByteTendril::new();
+        assert_eq!(
+            0,
+            Cursor::new(b"")
+                .read_to_tendril_with_hint(&mut t, 1000)
+                .unwrap()
+        );
+        assert_eq!(0, t.len32());
+    }
+
     #[test]
     fn hash_map_key() {
         use std::collections::HashMap;
@@ -2411,6 +4456,84 @@ mod test {
         assert_eq!(map.get(b"bar".as_ref()), None);
     }
 
+    #[test]
+    fn mismatch_index() {
+        let long = "a string long enough to be compared a vector at a time, twice over";
+        let t: StrTendril = long.to_tendril();
+        let u = t.clone();
+        assert_eq!(None, t.mismatch_index(&u));
+        assert_eq!(t.len32(), t.common_prefix_len(&u));
+        assert_eq!(::std::cmp::Ordering::Equal, t.cmp(&u));
+
+        let mut v: StrTendril = long.to_tendril();
+        v.pop_back(1);
+        v.push_char('!');
+        assert_eq!(Some(65), t.mismatch_index(&v));
+        assert_eq!(65, v.common_prefix_len(&t));
+        assert!(t != v && v < t);
+
+        assert_eq!(Some(30), t.mismatch_index(&t.subtendril(0, 30)));
+        assert_eq!(Some(0), t.mismatch_index(&t.subtendril(1, 30)));
+        assert!(t.subtendril(0, 30) < t && t.subtendril(1, 30) < t);
+        assert_eq!(0, "".to_tendril().common_prefix_len(&t));
+
+        let bytes = |x: &[u8]| ByteTendril::from_slice(x);
+        assert_eq!(
+            Some(1),
+            bytes(b"\xce\xb1").mismatch_index(&bytes(b"\xce\xb2"))
+        );
+        assert!(bytes(b"\xff") > bytes(b"\x00\x00"));
+        assert_eq!(
+            "\u{3b1}".cmp("\u{3b2}"),
+            "\u{3b1}".to_tendril().cmp(&"\u{3b2}".to_tendril())
+        );
+    }
+
+    #[test]
+    fn cached_hash() {
+        use std::collections::HashMap;
+
+        let hashed = |x: &[u8]| HashedTendril::from(ByteTendril::from_slice(x));
+        let t = hashed(b"a key long enough to live on the heap");
+        let u = t.clone();
+        assert!(u.ptr_eq(&t));
+        assert_eq!(t.cached_hash(), u.cached_hash());
+        assert_eq!(
+            t.cached_hash(),
+            hashed(b"a key long enough to live on the heap").cached_hash()
+        );
+        assert_eq!(
+            hashed(b"key long").cached_hash(),
+            HashedTendril::from(t.subtendril(2, 8)).cached_hash()
+        );
+        assert_eq!(
+            hashed(b"").cached_hash(),
+            HashedTendril::<fmt::Bytes>::default().cached_hash()
+        );
+
+        let mut v = ByteTendril::from(u);
+        v[0] = b'A';
+        assert_eq!(
+            hashed(b"A key long enough to live on the heap").cached_hash(),
+            HashedTendril::from(v.clone()).cached_hash()
+        );
+
+        let mut map = HashMap::new();
+        map.insert(HashedTendril::from(v.clone()), 1);
+        map.insert(HashedTendril::from(b"short".to_tendril()), 2);
+        assert_eq!(Some(&1), map.get(&HashedTendril::from(v)));
+        assert_eq!(
+            Some(&1),
+            map.get(&hashed(b"A key long enough to live on the heap"))
+        );
+        assert_eq!(
+            Some(&2),
+            map.get(&HashedTendril::from(b"short".to_tendril()))
+        );
+        assert_eq!(None, map.get(&HashedTendril::from(b"other".to_tendril())));
+        assert_eq!(None, map.get(&t));
+    }
+
     #[test]
     fn atomic() {
         assert_send::<Tendril<fmt::UTF8, Atomic>>();
@@ -2432,6 +4555,47 @@ mod test {
         assert_eq!("this is a string", &*s);
     }
 
+    #[test]
+    fn biased_atomic() {
+        assert_send::<SendBiasedTendril<fmt::UTF8>>();
+        let s: Tendril<fmt::UTF8, BiasedAtomic> = Tendril::from_slice("this is a string");
+        let t = s.clone();
+        let u = s.clone().into_send_biased();
+        let sp = s.as_ptr() as usize;
+        let v = thread::spawn(move || {
+            let u = Tendril::from(u);
+            assert!(u.is_shared());
+            let w = u.clone();
+            drop(u);
+            assert_eq!("this is a string", &*w);
+            w.into_send_biased()
+        })
+        .join()
+        .unwrap();
+        let v = Tendril::from(v);
+        assert_eq!(sp, v.as_ptr() as usize);
+        assert!(!unsafe { (*v.header()).refcount.is_unique() });
+        drop(s);
+        drop(t);
+        assert!(unsafe { (*v.header()).refcount.is_unique() });
+
+        // The owner's count is merged, so clones go to the shared count.
+        let w = v.clone();
+        assert!(!unsafe { (*v.header()).refcount.is_unique() });
+        drop(w);
+        let v = v.into_send_biased();
+        thread::spawn(move || drop(Tendril::from(v)))
+            .join()
+            .unwrap();
+
+        // More clones than the owner's count holds.
+        let s: Tendril<fmt::UTF8, BiasedAtomic> = Tendril::from_slice("this is a string");
+        let clones: Vec<_> = (0..70000).map(|_| s.clone()).collect();
+        assert!(!unsafe { (*s.header()).refcount.is_unique() });
+        drop(clones);
+        assert!(unsafe { (*s.header()).refcount.is_unique() });
+    }
+
     #[test]
     fn send() {
         assert_send::<SendTendril<fmt::UTF8>>();
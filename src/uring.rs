@@ -0,0 +1,630 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Reading many files at once with io_uring.
+//!
+//! This is a submodule of `pool` so that it can hand the kernel a buffer
+//! from a `TendrilPool` before anything has been read into it.
+
+use libc;
+use std::collections::BTreeMap;
+use std::fs::File;
+use std::io::{self, Seek, SeekFrom};
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::{cmp, mem, ptr};
+
+use fmt;
+use stream::TendrilSink;
+
+use super::super::{Atomicity, Tendril};
+use super::TendrilPool;
+
+const IORING_OFF_SQ_RING: libc::off_t = 0;
+const IORING_OFF_CQ_RING: libc::off_t = 0x8000000;
+const IORING_OFF_SQES: libc::off_t = 0x10000000;
+const IORING_OP_READV: u8 = 1;
+const IORING_ENTER_GETEVENTS: libc::c_uint = 1;
+
+#[repr(C)]
+#[derive(Default)]
+struct SqRingOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqRingOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    resv: [u32; 3],
+    sq_off: SqRingOffsets,
+    cq_off: CqRingOffsets,
+}
+
+#[repr(C)]
+struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    rw_flags: u32,
+    user_data: u64,
+    buf_index: u16,
+    personality: u16,
+    splice_fd_in: i32,
+    addr3: u64,
+    pad: u64,
+}
+
+#[repr(C)]
+struct Cqe {
+    user_data: u64,
+    res: i32,
+    flags: u32,
+}
+
+/// A region mapped from the ring's file descriptor.
+struct Mapping {
+    ptr: *mut u8,
+    len: usize,
+}
+
+impl Mapping {
+    unsafe fn new(fd: libc::c_int, len: usize, offset: libc::off_t) -> io::Result<Mapping> {
+        let ptr = libc::mmap(
+            ptr::null_mut(),
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED | libc::MAP_POPULATE,
+            fd,
+            offset,
+        );
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Mapping {
+            ptr: ptr as *mut u8,
+            len: len,
+        })
+    }
+
+    #[inline(always)]
+    unsafe fn at<T>(&self, offset: u32) -> *mut T {
+        self.ptr.offset(offset as isize) as *mut T
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+/// An io_uring instance, used from one thread.
+struct Ring {
+    fd: libc::c_int,
+    sq_head: *const AtomicU32,
+    sq_tail: *const AtomicU32,
+    sq_mask: u32,
+    sq_entries: u32,
+    sq_array: *mut u32,
+    sqes: *mut Sqe,
+    cq_head: *const AtomicU32,
+    cq_tail: *const AtomicU32,
+    cq_mask: u32,
+    cqes: *const Cqe,
+    /// Entries queued but not yet passed to the kernel.
+    to_submit: u32,
+    // Unmapped when dropped, after `fd` is closed.
+    _maps: [Mapping; 3],
+}
+
+impl Ring {
+    /// Set up a ring with room for `entries` submissions.
+    fn new(entries: u32) -> io::Result<Ring> {
+        unsafe {
+            let mut p: Params = Default::default();
+            let fd = libc::syscall(
+                libc::SYS_io_uring_setup,
+                entries as libc::c_long,
+                &mut p as *mut Params,
+            ) as libc::c_int;
+            if fd < 0 {
+                return Err(io::Error::last_os_error());
+            }
+            // Closes `fd` if mapping fails.
+            let guard = FdGuard(fd);
+
+            let sq_len = p.sq_off.array as usize + p.sq_entries as usize * mem::size_of::<u32>();
+            let cq_len = p.cq_off.cqes as usize + p.cq_entries as usize * mem::size_of::<Cqe>();
+            let sqes_len = p.sq_entries as usize * mem::size_of::<Sqe>();
+            let sq = Mapping::new(fd, sq_len, IORING_OFF_SQ_RING)?;
+            let cq = Mapping::new(fd, cq_len, IORING_OFF_CQ_RING)?;
+            let sqes = Mapping::new(fd, sqes_len, IORING_OFF_SQES)?;
+            mem::forget(guard);
+
+            Ok(Ring {
+                fd: fd,
+                sq_head: sq.at(p.sq_off.head),
+                sq_tail: sq.at(p.sq_off.tail),
+                sq_mask: *sq.at::<u32>(p.sq_off.ring_mask),
+                sq_entries: p.sq_entries,
+                sq_array: sq.at(p.sq_off.array),
+                sqes: sqes.at(0),
+                cq_head: cq.at(p.cq_off.head),
+                cq_tail: cq.at(p.cq_off.tail),
+                cq_mask: *cq.at::<u32>(p.cq_off.ring_mask),
+                cqes: cq.at(p.cq_off.cqes),
+                to_submit: 0,
+                _maps: [sq, cq, sqes],
+            })
+        }
+    }
+
+    /// Queue a read from `fd` at `offset` into the buffer `iov` describes,
+    /// which must stay put until its completion is popped. Return `false`
+    /// if the submission queue is full.
+    unsafe fn push_readv(
+        &mut self,
+        fd: libc::c_int,
+        iov: *const libc::iovec,
+        offset: u64,
+        user_data: u64,
+    ) -> bool {
+        let tail = (*self.sq_tail).load(Ordering::Relaxed);
+        let head = (*self.sq_head).load(Ordering::Acquire);
+        if tail.wrapping_sub(head) >= self.sq_entries {
+            return false;
+        }
+        let index = tail & self.sq_mask;
+        ptr::write(
+            self.sqes.offset(index as isize),
+            Sqe {
+                opcode: IORING_OP_READV,
+                flags: 0,
+                ioprio: 0,
+                fd: fd,
+                off: offset,
+                addr: iov as u64,
+                len: 1,
+                rw_flags: 0,
+                user_data: user_data,
+                buf_index: 0,
+                personality: 0,
+                splice_fd_in: 0,
+                addr3: 0,
+                pad: 0,
+            },
+        );
+        *self.sq_array.offset(index as isize) = index;
+        (*self.sq_tail).store(tail.wrapping_add(1), Ordering::Release);
+        self.to_submit += 1;
+        true
+    }
+
+    /// Submit what is queued, and wait for at least one completion.
+    ///
+    /// This fails with `EAGAIN` or `EBUSY` if the kernel cannot take more
+    /// work until completions are reaped with `pop`. What was not submitted
+    /// stays queued for the next call.
+    fn submit_and_wait(&mut self) -> io::Result<()> {
+        loop {
+            let n = unsafe {
+                libc::syscall(
+                    libc::SYS_io_uring_enter,
+                    self.fd as libc::c_long,
+                    self.to_submit as libc::c_long,
+                    1 as libc::c_long,
+                    IORING_ENTER_GETEVENTS as libc::c_long,
+                    ptr::null::<libc::sigset_t>(),
+                    0 as libc::c_long,
+                )
+            };
+            if n < 0 {
+                let err = io::Error::last_os_error();
+                if err.raw_os_error() == Some(libc::EINTR) {
+                    continue;
+                }
+                return Err(err);
+            }
+            self.to_submit -= n as u32;
+            return Ok(());
+        }
+    }
+
+    /// Take the next completion, as its `user_data` and result.
+    fn pop(&mut self) -> Option<(u64, i32)> {
+        unsafe {
+            let head = (*self.cq_head).load(Ordering::Relaxed);
+            if head == (*self.cq_tail).load(Ordering::Acquire) {
+                return None;
+            }
+            let cqe = &*self.cqes.offset((head & self.cq_mask) as isize);
+            let result = (cqe.user_data, cqe.res);
+            (*self.cq_head).store(head.wrapping_add(1), Ordering::Release);
+            Some(result)
+        }
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.fd);
+        }
+    }
+}
+
+struct FdGuard(libc::c_int);
+
+impl Drop for FdGuard {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.0);
+        }
+    }
+}
+
+/// A file being read, and the sink its bytes go to.
+struct Input<S, F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    index: usize,
+    file: File,
+    sink: S,
+    /// The length of the file when opened, or where a read found it ended.
+    size: u64,
+    /// Where the next read not yet submitted starts.
+    next: u64,
+    /// Reads to submit again after returning fewer bytes than asked for.
+    retry: Vec<(u64, u32)>,
+    /// How many bytes have gone to the sink.
+    delivered: u64,
+    /// Completed reads, by offset, not yet in order to go to the sink.
+    ready: BTreeMap<u64, Tendril<F, A>>,
+    in_flight: u32,
+    error: Option<io::Error>,
+}
+
+impl<S, F, A> Input<S, F, A>
+where
+    S: TendrilSink<F, A>,
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+{
+    /// The next read to submit, if any.
+    fn next_read(&mut self, block_size: u32) -> Option<(u64, u32)> {
+        if self.error.is_some() {
+            return None;
+        }
+        if let Some(read) = self.retry.pop() {
+            return Some(read);
+        }
+        if self.next >= self.size {
+            return None;
+        }
+        let len = cmp::min(block_size as u64, self.size - self.next) as u32;
+        let read = (self.next, len);
+        self.next += len as u64;
+        Some(read)
+    }
+
+    fn deliver(&mut self) {
+        while let Some(t) = self.ready.remove(&self.delivered) {
+            self.delivered += t.len32() as u64;
+            self.sink.process(t);
+        }
+    }
+
+    fn is_done(&self) -> bool {
+        self.in_flight == 0
+            && (self.error.is_some() || (self.retry.is_empty() && self.delivered >= self.size))
+    }
+
+    /// Read whatever was appended since the file was opened, and finish.
+    fn finish(mut self, pool: &TendrilPool<A>) -> io::Result<S::Output> {
+        if let Some(e) = self.error {
+            return Err(e);
+        }
+        self.file.seek(SeekFrom::Start(self.delivered))?;
+        self.sink.read_from_pool(&mut self.file, pool)
+    }
+}
+
+/// A read the kernel is doing.
+struct Slot<F, A>
+where
+    F: fmt::Format,
+    A: Atomicity,
+{
+    /// A `Tendril` on the whole buffer read into.
+    block: Tendril<F, A>,
+    input: usize,
+    offset: u64,
+    len: u32,
+}
+
+/// Read each of `paths` into the sink `new_sink` makes for it, with up to
+/// `depth` reads in flight at once across all of them, each into a buffer
+/// from `pool`.
+///
+/// Fails only if io_uring is not available, before calling `new_sink`. If
+/// the ring fails later, every file not yet finished gets the error.
+pub fn read_files<S, F, A, P, M>(
+    paths: &[P],
+    mut new_sink: M,
+    pool: &TendrilPool<A>,
+    depth: u32,
+) -> io::Result<Vec<io::Result<S::Output>>>
+where
+    S: TendrilSink<F, A>,
+    F: fmt::SliceFormat<Slice = [u8]>,
+    A: Atomicity,
+    P: AsRef<Path>,
+    M: FnMut(usize) -> S,
+{
+    let mut ring = Ring::new(depth)?;
+    let depth = cmp::min(depth, ring.sq_entries) as usize;
+    let block_size = pool.block_size();
+
+    let mut results: Vec<Option<io::Result<S::Output>>> = paths.iter().map(|_| None).collect();
+    let mut next_path = 0;
+    let mut inputs: Vec<Option<Input<S, F, A>>> = vec![];
+    let mut slots: Vec<Option<Slot<F, A>>> = (0..depth).map(|_| None).collect();
+    // Each slot's `iovec` stays at the same address while the kernel uses it.
+    let mut iovs: Vec<libc::iovec> = (0..depth)
+        .map(|_| libc::iovec {
+            iov_base: ptr::null_mut(),
+            iov_len: 0,
+        })
+        .collect();
+    let mut free: Vec<usize> = (0..depth).rev().collect();
+    let mut open = 0;
+
+    loop {
+        // Keep enough files open to fill the queue.
+        while open < depth && next_path < paths.len() {
+            let index = next_path;
+            next_path += 1;
+            let sink = new_sink(index);
+            let input = File::open(&paths[index]).and_then(|file| {
+                let size = file.metadata()?.len();
+                Ok(Input {
+                    index: index,
+                    file: file,
+                    sink: sink,
+                    size: size,
+                    next: 0,
+                    retry: vec![],
+                    delivered: 0,
+                    ready: BTreeMap::new(),
+                    in_flight: 0,
+                    error: None,
+                })
+            });
+            match input {
+                // Empty files, and those like `/proc` files which claim to
+                // be, are read as usual.
+                Ok(input) if input.size == 0 => results[index] = Some(input.finish(pool)),
+                Ok(input) => {
+                    match inputs.iter().position(|i| i.is_none()) {
+                        Some(i) => inputs[i] = Some(input),
+                        None => inputs.push(Some(input)),
+                    }
+                    open += 1;
+                }
+                Err(e) => results[index] = Some(Err(e)),
+            }
+        }
+
+        // Queue reads, taking turns between the open files.
+        let mut queued = true;
+        while queued && !free.is_empty() {
+            queued = false;
+            for (i, input) in inputs.iter_mut().enumerate() {
+                let input = match *input {
+                    Some(ref mut input) => input,
+                    None => continue,
+                };
+                let slot = match free.last() {
+                    Some(&slot) => slot,
+                    None => break,
+                };
+                let (offset, len) = match input.next_read(block_size) {
+                    Some(read) => read,
+                    None => continue,
+                };
+                let (block, data) = unsafe { pool.block::<F>() };
+                iovs[slot] = libc::iovec {
+                    iov_base: data as *mut libc::c_void,
+                    iov_len: len as usize,
+                };
+                let pushed = unsafe {
+                    ring.push_readv(input.file.as_raw_fd(), &iovs[slot], offset, slot as u64)
+                };
+                debug_assert!(pushed, "more reads in flight than the ring holds");
+                free.pop();
+                slots[slot] = Some(Slot {
+                    block: block,
+                    input: i,
+                    offset: offset,
+                    len: len,
+                });
+                input.in_flight += 1;
+                queued = true;
+            }
+        }
+
+        if open == 0 {
+            debug_assert!(next_path == paths.len());
+            break;
+        }
+        match ring.submit_and_wait() {
+            Ok(()) => {}
+            // Out of resources for now: reap what has completed, which
+            // frees some, and submit again next time round.
+            Err(ref e)
+                if e.raw_os_error() == Some(libc::EAGAIN)
+                    || e.raw_os_error() == Some(libc::EBUSY) => {}
+            Err(e) => {
+                // The kernel may yet write to the buffers in flight, so they
+                // must never be freed.
+                for slot in slots.iter_mut() {
+                    if let Some(slot) = slot.take() {
+                        mem::forget(slot.block);
+                    }
+                }
+                for result in results.iter_mut().filter(|r| r.is_none()) {
+                    *result = Some(Err(io::Error::new(e.kind(), e.to_string())));
+                }
+                break;
+            }
+        }
+
+        while let Some((user_data, res)) = ring.pop() {
+            let slot = user_data as usize;
+            let Slot {
+                block,
+                input,
+                offset,
+                len,
+            } = slots[slot].take().unwrap();
+            free.push(slot);
+            let input = inputs[input].as_mut().unwrap();
+            input.in_flight -= 1;
+            if res < 0 {
+                match -res {
+                    libc::EINTR | libc::EAGAIN => input.retry.push((offset, len)),
+                    errno => input.error = Some(io::Error::from_raw_os_error(errno)),
+                }
+            } else if res == 0 {
+                // The file is shorter than it was.
+                input.size = cmp::min(input.size, offset);
+                input.retry.retain(|&(o, _)| o < offset);
+            } else {
+                let n = res as u32;
+                if n < len {
+                    input.retry.push((offset + n as u64, len - n));
+                }
+                input
+                    .ready
+                    .insert(offset, unsafe { block.unsafe_subtendril(0, n) });
+            }
+        }
+
+        for input in inputs.iter_mut() {
+            let done = match *input {
+                Some(ref mut input) => {
+                    input.deliver();
+                    input.is_done()
+                }
+                None => false,
+            };
+            if done {
+                let input = input.take().unwrap();
+                let index = input.index;
+                results[index] = Some(input.finish(pool));
+                open -= 1;
+            }
+        }
+    }
+
+    Ok(results.into_iter().map(|r| r.unwrap()).collect())
+}
+
+#[cfg(test)]
+mod test {
+    use super::{read_files, Ring};
+    use fmt;
+    use std::borrow::Cow;
+    use std::{env, fs, process};
+    use stream::TendrilSink;
+    use tendril::{ByteTendril, TendrilPool};
+
+    struct Collect(Vec<ByteTendril>);
+
+    impl TendrilSink<fmt::Bytes> for Collect {
+        fn process(&mut self, t: ByteTendril) {
+            self.0.push(t);
+        }
+
+        fn error(&mut self, _: Cow<'static, str>) {}
+
+        type Output = Vec<ByteTendril>;
+
+        fn finish(self) -> Vec<ByteTendril> {
+            self.0
+        }
+    }
+
+    #[test]
+    fn read_many() {
+        if Ring::new(4).is_err() {
+            return;
+        }
+        let dir = env::temp_dir().join(format!("tendril-{}-read_many", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let mut paths = vec![];
+        let mut contents = vec![];
+        for i in 0..20 {
+            let path = dir.join(i.to_string());
+            let bytes: Vec<u8> = (0..i * 1000).map(|j| (i + j) as u8).collect();
+            fs::write(&path, &bytes).unwrap();
+            paths.push(path);
+            contents.push(bytes);
+        }
+        paths.push(dir.join("missing"));
+
+        let pool = TendrilPool::with_block_size(4096);
+        let results = read_files(&paths, |_| Collect(vec![]), &pool, 8).unwrap();
+        fs::remove_dir_all(&dir).unwrap();
+
+        assert_eq!(21, results.len());
+        for (result, expected) in results.iter().zip(&contents) {
+            let tendrils = result.as_ref().unwrap();
+            let bytes: Vec<u8> = tendrils.iter().flat_map(|t| t.iter().cloned()).collect();
+            assert_eq!(expected, &bytes);
+            assert!(tendrils.iter().all(|t| t.len() <= 4096));
+        }
+        assert!(results[20].is_err());
+    }
+}
@@ -0,0 +1,405 @@
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Writing many tendrils with few system calls.
+//!
+//! This is a submodule of `tendril` so that it can see the bytes of a
+//! `Tendril` in any format.
+
+use std::io::{self, IoSlice, Write};
+
+use fmt;
+
+use super::{Allocator, Atomicity, Global, Inline8, InlineCapacity, NonAtomic, Tendril};
+
+/// Tendrils at most this long are copied into the scratch buffer, rather
+/// than written from their own `IoSlice`.
+const COALESCE_LEN: usize = 64;
+
+/// The most `IoSlice`s passed to one `write_vectored`. This is `IOV_MAX`
+/// on Linux.
+const MAX_SLICES: usize = 1024;
+
+/// Write out the batch once this many bytes are in the scratch buffer.
+const SCRATCH_LEN: usize = 64 * 1024;
+
+/// Something whose bytes can be queued in a `Batch`.
+trait Bytes {
+    fn bytes(&self) -> &[u8];
+}
+
+impl<'a> Bytes for &'a [u8] {
+    #[inline(always)]
+    fn bytes(&self) -> &[u8] {
+        self
+    }
+}
+
+impl<F, A, I, Al> Bytes for Tendril<F, A, I, Al>
+where
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline(always)]
+    fn bytes(&self) -> &[u8] {
+        self.as_byte_slice()
+    }
+}
+
+enum Piece<T> {
+    Bytes(T),
+    /// The bytes of the scratch buffer up to this offset, from the end of
+    /// the previous `Scratch` piece.
+    Scratch(usize),
+}
+
+/// Pieces waiting to be written together.
+struct Batch<T> {
+    pieces: Vec<Piece<T>>,
+    scratch: Vec<u8>,
+}
+
+impl<T> Batch<T>
+where
+    T: Bytes,
+{
+    fn new() -> Batch<T> {
+        Batch {
+            pieces: Vec::new(),
+            scratch: Vec::new(),
+        }
+    }
+
+    #[inline]
+    fn push(&mut self, x: T) {
+        if x.bytes().len() <= COALESCE_LEN {
+            self.push_bytes(x.bytes());
+        } else {
+            self.pieces.push(Piece::Bytes(x));
+        }
+    }
+
+    #[inline]
+    fn push_bytes(&mut self, x: &[u8]) {
+        if x.is_empty() {
+            return;
+        }
+        self.scratch.extend_from_slice(x);
+        let end = self.scratch.len();
+        match self.pieces.last_mut() {
+            Some(&mut Piece::Scratch(ref mut last)) => *last = end,
+            _ => self.pieces.push(Piece::Scratch(end)),
+        }
+    }
+
+    #[inline]
+    fn is_full(&self) -> bool {
+        self.pieces.len() >= MAX_SLICES || self.scratch.len() >= SCRATCH_LEN
+    }
+
+    /// Write out and empty the batch.
+    ///
+    /// On error, the batch is emptied all the same, and some of it may have
+    /// been written.
+    fn write_to<W>(&mut self, w: &mut W) -> io::Result<()>
+    where
+        W: Write,
+    {
+        let result = {
+            let mut start = 0;
+            let mut bufs: Vec<&[u8]> = Vec::with_capacity(self.pieces.len());
+            for piece in &self.pieces {
+                bufs.push(match *piece {
+                    Piece::Bytes(ref x) => x.bytes(),
+                    Piece::Scratch(end) => {
+                        let s = &self.scratch[start..end];
+                        start = end;
+                        s
+                    }
+                });
+            }
+            write_all_vectored(w, &mut bufs)
+        };
+        self.pieces.clear();
+        self.scratch.clear();
+        result
+    }
+}
+
+/// Like the unstable `Write::write_all_vectored`.
+///
+/// `bufs` is left with what remains of the first slice not fully written.
+fn write_all_vectored<W>(w: &mut W, bufs: &mut [&[u8]]) -> io::Result<()>
+where
+    W: Write,
+{
+    let mut slices: Vec<IoSlice> = bufs.iter().map(|x| IoSlice::new(x)).collect();
+    // The slices before this have been written.
+    let mut first = 0;
+    while first < slices.len() {
+        match w.write_vectored(&slices[first..]) {
+            Ok(0) => {
+                return Err(io::Error::new(
+                    io::ErrorKind::WriteZero,
+                    "failed to write whole buffer",
+                ))
+            }
+            Ok(mut n) => {
+                while first < bufs.len() && n >= bufs[first].len() {
+                    n -= bufs[first].len();
+                    first += 1;
+                }
+                if n > 0 {
+                    bufs[first] = &bufs[first][n..];
+                    slices[first] = IoSlice::new(bufs[first]);
+                }
+            }
+            Err(ref e) if e.kind() == io::ErrorKind::Interrupted => (),
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(())
+}
+
+/// Write `tendrils` to `w`, one after another, in as few calls to
+/// `write_vectored` as possible.
+///
+/// Each long `Tendril` is written straight from its buffer. Runs of short
+/// ones, including all those stored in-line, are first copied together
+/// into a scratch buffer.
+pub fn write_tendrils<W, F, A, I, Al>(
+    w: &mut W,
+    tendrils: &[Tendril<F, A, I, Al>],
+) -> io::Result<()>
+where
+    W: Write,
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    let mut batch = Batch::new();
+    for t in tendrils {
+        batch.push(t.as_byte_slice());
+        if batch.is_full() {
+            batch.write_to(w)?;
+        }
+    }
+    batch.write_to(w)
+}
+
+/// Writes tendrils to an `io::Write` in few system calls.
+///
+/// Pushed tendrils are held, still sharing their buffers, until enough are
+/// queued, and are then written by one `write_vectored`, which is `writev`
+/// on Unix. As with `write_tendrils`, short ones are copied together into a
+/// scratch buffer rather than taking a slice each.
+///
+/// Bytes written to the `TendrilWriter` through `io::Write`, for example
+/// by `write!`, go to the scratch buffer in order with the tendrils.
+///
+/// Like `BufWriter`, it writes what is queued when dropped, ignoring any
+/// error. Call `flush` to see errors.
+pub struct TendrilWriter<W, F, A = NonAtomic, I = Inline8, Al = Global>
+where
+    W: Write,
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    // `None` only once `into_inner` has taken it.
+    inner: Option<W>,
+    batch: Batch<Tendril<F, A, I, Al>>,
+}
+
+impl<W, F, A, I, Al> TendrilWriter<W, F, A, I, Al>
+where
+    W: Write,
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    /// Create a `TendrilWriter` writing to `inner`.
+    #[inline]
+    pub fn new(inner: W) -> TendrilWriter<W, F, A, I, Al> {
+        TendrilWriter {
+            inner: Some(inner),
+            batch: Batch::new(),
+        }
+    }
+
+    /// Queue a `Tendril` to be written.
+    ///
+    /// This writes out the queue if it is full.
+    #[inline]
+    pub fn push(&mut self, t: Tendril<F, A, I, Al>) -> io::Result<()> {
+        self.batch.push(t);
+        if self.batch.is_full() {
+            self.write_batch()?;
+        }
+        Ok(())
+    }
+
+    /// Get a reference to the underlying writer.
+    #[inline]
+    pub fn get_ref(&self) -> &W {
+        self.inner.as_ref().unwrap()
+    }
+
+    /// Write out the queue, and return the underlying writer.
+    pub fn into_inner(mut self) -> io::Result<W> {
+        self.write_batch()?;
+        Ok(self.inner.take().unwrap())
+    }
+
+    fn write_batch(&mut self) -> io::Result<()> {
+        self.batch.write_to(self.inner.as_mut().unwrap())
+    }
+}
+
+impl<W, F, A, I, Al> Write for TendrilWriter<W, F, A, I, Al>
+where
+    W: Write,
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    #[inline]
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        self.batch.push_bytes(buf);
+        if self.batch.is_full() {
+            self.write_batch()?;
+        }
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        self.write_batch()?;
+        self.inner.as_mut().unwrap().flush()
+    }
+}
+
+impl<W, F, A, I, Al> Drop for TendrilWriter<W, F, A, I, Al>
+where
+    W: Write,
+    F: fmt::Format,
+    A: Atomicity,
+    I: InlineCapacity,
+    Al: Allocator,
+{
+    fn drop(&mut self) {
+        if self.inner.is_some() {
+            let _ = self.write_batch();
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{write_tendrils, TendrilWriter, MAX_SLICES};
+    use fmt;
+    use std::io::{self, IoSlice, Write};
+    use tendril::{SliceExt, StrTendril};
+
+    /// Records each call to `write_vectored`, taking at most `limit` bytes.
+    struct Recorder {
+        out: Vec<u8>,
+        calls: Vec<usize>,
+        limit: usize,
+    }
+
+    impl Recorder {
+        fn new(limit: usize) -> Recorder {
+            Recorder {
+                out: vec![],
+                calls: vec![],
+                limit: limit,
+            }
+        }
+    }
+
+    impl Write for Recorder {
+        fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+            self.write_vectored(&[IoSlice::new(buf)])
+        }
+
+        fn write_vectored(&mut self, bufs: &[IoSlice]) -> io::Result<usize> {
+            assert!(bufs.len() <= MAX_SLICES);
+            self.calls.push(bufs.len());
+            let mut n = 0;
+            for buf in bufs {
+                let take = buf.len().min(self.limit - n);
+                self.out.extend_from_slice(&buf[..take]);
+                n += take;
+            }
+            Ok(n)
+        }
+
+        fn flush(&mut self) -> io::Result<()> {
+            Ok(())
+        }
+    }
+
+    fn pieces() -> Vec<StrTendril> {
+        (0..3000)
+            .map(|i| {
+                if i % 100 == 0 {
+                    "a long piece, too long to be worth copying, at least on its own ".repeat(2)
+                } else {
+                    format!("<{}>", i)
+                }
+                .to_tendril()
+            })
+            .collect()
+    }
+
+    #[test]
+    fn write_many() {
+        let pieces = pieces();
+        let expected: String = pieces.iter().map(|t| &**t).collect();
+
+        let mut w = Recorder::new(usize::max_value());
+        write_tendrils(&mut w, &pieces).unwrap();
+        assert_eq!(expected.as_bytes(), &*w.out);
+        // 30 long pieces, each between runs of short ones.
+        assert_eq!(vec![60], w.calls);
+
+        // Partial writes.
+        let mut w = Recorder::new(1000);
+        write_tendrils(&mut w, &pieces).unwrap();
+        assert_eq!(expected.as_bytes(), &*w.out);
+    }
+
+    #[test]
+    fn writer() {
+        let pieces = pieces();
+        let mut w: TendrilWriter<_, fmt::UTF8> = TendrilWriter::new(Recorder::new(4096));
+        let mut expected = String::new();
+        for (i, t) in pieces.into_iter().enumerate() {
+            expected.push_str(&t);
+            w.push(t).unwrap();
+            if i % 1000 == 0 {
+                write!(w, "[{}]", i).unwrap();
+                expected.push_str(&format!("[{}]", i));
+            }
+        }
+        assert!(w.get_ref().out.is_empty());
+        let w = w.into_inner().unwrap();
+        assert_eq!(expected.as_bytes(), &*w.out);
+
+        let mut out = vec![];
+        {
+            let mut w: TendrilWriter<_, fmt::UTF8> = TendrilWriter::new(&mut out);
+            w.push("dropped".to_tendril()).unwrap();
+        }
+        assert_eq!(b"dropped", &*out);
+    }
+}